@@ -10,6 +10,7 @@
 #include "convert.h"
 #include "diff.h"
 #include "diffcore.h"
+#include "dir.h"
 #include "gettext.h"
 #include "hex.h"
 #include "path.h"
@@ -23,6 +24,13 @@
 #include "commit-slab.h"
 #include "bloom.h"
 #include "commit-graph.h"
+#include "lockfile.h"
+#include "quote.h"
+#include "replace-object.h"
+#include "shallow.h"
+#include "userdiff.h"
+#include "thread-utils.h"
+#include "strmap.h"
 
 define_commit_slab(blame_suspects, struct blame_origin *);
 static struct blame_suspects blame_suspects;
@@ -327,6 +335,144 @@ static int diff_hunks(mmfile_t *file_a, mmfile_t *file_b,
 	return xdi_diff(file_a, file_b, &xpp, &xecfg, &ecb);
 }
 
+/*
+ * The diffs blame needs for a commit can be computed in threads.  Only
+ * the diffs themselves are: each job records the hunks of one diff,
+ * and the caller replays them afterwards in the same order as if it
+ * had computed them one after the other, so the result does not
+ * depend on the number of threads.
+ */
+#define BLAME_THREAD_MIN_BYTES (256 * 1024)
+
+struct blame_hunk {
+	long start_a, count_a;
+	long start_b, count_b;
+};
+
+struct blame_diff_job {
+	/* a job with a.ptr == NULL is skipped */
+	mmfile_t a, b;
+	struct blame_hunk *hunks;
+	size_t nr, alloc;
+	int failed;
+};
+
+struct blame_diff_pool {
+	struct blame_diff_job *jobs;
+	size_t nr;
+	int xdl_opts;
+	pthread_mutex_t mutex;
+	size_t next; /* next job to take, under mutex */
+};
+
+static int record_hunk_cb(long start_a, long count_a,
+			  long start_b, long count_b, void *data)
+{
+	struct blame_diff_job *job = data;
+	struct blame_hunk *h;
+
+	ALLOC_GROW(job->hunks, job->nr + 1, job->alloc);
+	h = &job->hunks[job->nr++];
+	h->start_a = start_a;
+	h->count_a = count_a;
+	h->start_b = start_b;
+	h->count_b = count_b;
+	return 0;
+}
+
+static void run_blame_diff_job(struct blame_diff_job *job, int xdl_opts)
+{
+	if (!job->a.ptr)
+		return;
+	if (diff_hunks(&job->a, &job->b, record_hunk_cb, job, xdl_opts))
+		job->failed = 1;
+}
+
+static void *blame_diff_thread(void *data)
+{
+	struct blame_diff_pool *pool = data;
+
+	for (;;) {
+		size_t i;
+
+		pthread_mutex_lock(&pool->mutex);
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->mutex);
+		if (i >= pool->nr)
+			break;
+		run_blame_diff_job(&pool->jobs[i], pool->xdl_opts);
+	}
+	return NULL;
+}
+
+/* Are these jobs worth spreading over threads? */
+static int use_blame_threads(struct blame_scoreboard *sb,
+			     struct blame_diff_job *jobs, size_t nr)
+{
+	size_t i, valid = 0, bytes = 0;
+
+	if (!HAVE_THREADS || sb->num_threads <= 1)
+		return 0;
+	for (i = 0; i < nr; i++) {
+		if (!jobs[i].a.ptr)
+			continue;
+		valid++;
+		bytes += jobs[i].a.size + jobs[i].b.size;
+	}
+	return valid > 1 && bytes >= BLAME_THREAD_MIN_BYTES;
+}
+
+static void run_blame_diff_jobs(struct blame_scoreboard *sb,
+				struct blame_diff_job *jobs, size_t nr)
+{
+	struct blame_diff_pool pool = {
+		.jobs = jobs,
+		.nr = nr,
+		.xdl_opts = sb->xdl_opts,
+	};
+	pthread_t *threads;
+	int nr_threads, t, err;
+
+	if (!use_blame_threads(sb, jobs, nr)) {
+		for (size_t i = 0; i < nr; i++)
+			run_blame_diff_job(&jobs[i], sb->xdl_opts);
+		return;
+	}
+
+	sb->num_threaded_diffs += nr;
+	nr_threads = sb->num_threads;
+	if (nr < (size_t)nr_threads)
+		nr_threads = nr;
+	pthread_mutex_init(&pool.mutex, NULL);
+	ALLOC_ARRAY(threads, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		err = pthread_create(&threads[t], NULL, blame_diff_thread, &pool);
+		if (err)
+			die(_("unable to create blame thread: %s"), strerror(err));
+	}
+	for (t = 0; t < nr_threads; t++)
+		pthread_join(threads[t], NULL);
+	free(threads);
+	pthread_mutex_destroy(&pool.mutex);
+}
+
+static void replay_blame_diff_job(struct blame_diff_job *job,
+				  xdl_emit_hunk_consume_func_t hunk_func,
+				  void *cb_data)
+{
+	for (size_t i = 0; i < job->nr; i++)
+		hunk_func(job->hunks[i].start_a, job->hunks[i].count_a,
+			  job->hunks[i].start_b, job->hunks[i].count_b,
+			  cb_data);
+}
+
+static void clear_blame_diff_jobs(struct blame_diff_job *jobs, size_t nr)
+{
+	for (size_t i = 0; i < nr; i++)
+		free(jobs[i].hunks);
+	free(jobs);
+}
+
 static const char *get_next_line(const char *start, const char *end)
 {
 	const char *nl = memchr(start, '\n', end - start);
@@ -1257,62 +1403,70 @@ static int fill_blob_sha1_and_mode(struct repository *r,
 
 struct blame_bloom_data {
 	/*
-	 * Changed-path Bloom filter keys. These can help prevent
-	 * computing diffs against first parents, but we need to
-	 * expand the list as code is moved or files are renamed.
+	 * Changed-path Bloom filter keys, one for each path we have been
+	 * looking for, i.e. the final path and any path it was renamed
+	 * or moved from.  They can help prevent computing diffs against
+	 * first parents.
 	 */
 	struct bloom_filter_settings *settings;
-	struct bloom_key **keys;
-	int nr;
-	int alloc;
+	struct strmap keys;
+
+	/* pass_blame() may ask about the same commit twice in a row */
+	struct commit *last_commit;
+	const char *last_path;
+	int last_answer;
 };
 
 static int bloom_count_queries = 0;
 static int bloom_count_no = 0;
+static int bloom_count_skipped = 0;
+
+static struct bloom_key *get_bloom_key(struct blame_bloom_data *bd,
+				       const char *path)
+{
+	struct bloom_key *key = strmap_get(&bd->keys, path);
+
+	if (!key) {
+		key = xmalloc(sizeof(*key));
+		bloom_key_fill(key, path, strlen(path), bd->settings);
+		strmap_put(&bd->keys, path, key);
+	}
+	return key;
+}
+
+/*
+ * Return 0 if the Bloom filter of "commit" says that "path" is the
+ * same as in its first parent, 1 if it may have changed.
+ */
 static int maybe_changed_path(struct repository *r,
-			      struct blame_origin *origin,
+			      struct commit *commit, const char *path,
 			      struct blame_bloom_data *bd)
 {
-	int i;
 	struct bloom_filter *filter;
+	struct bloom_key *key;
 
 	if (!bd)
 		return 1;
 
-	if (commit_graph_generation(origin->commit) == GENERATION_NUMBER_INFINITY)
+	if (commit_graph_generation(commit) == GENERATION_NUMBER_INFINITY)
 		return 1;
 
-	filter = get_bloom_filter(r, origin->commit);
+	if (bd->last_commit == commit && !strcmp(bd->last_path, path))
+		return bd->last_answer;
+
+	filter = get_bloom_filter(r, commit);
 
 	if (!filter)
 		return 1;
 
 	bloom_count_queries++;
-	for (i = 0; i < bd->nr; i++) {
-		if (bloom_filter_contains(filter,
-					  bd->keys[i],
-					  bd->settings))
-			return 1;
-	}
-
-	bloom_count_no++;
-	return 0;
-}
-
-static void add_bloom_key(struct blame_bloom_data *bd,
-			  const char *path)
-{
-	if (!bd)
-		return;
-
-	if (bd->nr >= bd->alloc) {
-		bd->alloc *= 2;
-		REALLOC_ARRAY(bd->keys, bd->alloc);
-	}
-
-	bd->keys[bd->nr] = xmalloc(sizeof(struct bloom_key));
-	bloom_key_fill(bd->keys[bd->nr], path, strlen(path), bd->settings);
-	bd->nr++;
+	key = get_bloom_key(bd, path);
+	bd->last_commit = commit;
+	bd->last_path = strmap_get_entry(&bd->keys, path)->key;
+	bd->last_answer = bloom_filter_contains(filter, key, bd->settings);
+	if (!bd->last_answer)
+		bloom_count_no++;
+	return bd->last_answer;
 }
 
 /*
@@ -1361,7 +1515,8 @@ static struct blame_origin *find_origin(struct repository *r,
 		if (origin->commit->parents &&
 		    oideq(&parent->object.oid,
 			  &origin->commit->parents->item->object.oid))
-			compute_diff = maybe_changed_path(r, origin, bd);
+			compute_diff = maybe_changed_path(r, origin->commit,
+							  origin->path, bd);
 
 		if (compute_diff)
 			diff_tree_oid(get_commit_tree_oid(parent),
@@ -1419,7 +1574,7 @@ static struct blame_origin *find_origin(struct repository *r,
 static struct blame_origin *find_rename(struct repository *r,
 					struct commit *parent,
 					struct blame_origin *origin,
-					struct blame_bloom_data *bd)
+					struct blame_bloom_data *bd UNUSED)
 {
 	struct blame_origin *porigin = NULL;
 	struct diff_options diff_opts;
@@ -1444,7 +1599,6 @@ static struct blame_origin *find_rename(struct repository *r,
 		struct diff_filepair *p = diff_queued_diff.queue[i];
 		if ((p->status == 'R' || p->status == 'C') &&
 		    !strcmp(p->two->path, origin->path)) {
-			add_bloom_key(bd, p->one->path);
 			porigin = get_origin(parent, p->one->path);
 			oidcpy(&porigin->blob_oid, &p->one->oid);
 			porigin->mode = p->one->mode;
@@ -1938,13 +2092,20 @@ static int blame_chunk_cb(long start_a, long count_a,
  * for the lines it is suspected to its parent.  Run diff to find
  * which lines came from parent and pass blame for them.
  */
+/*
+ * Pass the blame for the lines target and parent have in common to the
+ * parent.  "job", if not NULL, is the already computed diff between the
+ * two.
+ */
 static void pass_blame_to_parent(struct blame_scoreboard *sb,
 				 struct blame_origin *target,
-				 struct blame_origin *parent, int ignore_diffs)
+				 struct blame_origin *parent, int ignore_diffs,
+				 struct blame_diff_job *job)
 {
 	mmfile_t file_p, file_o;
 	struct blame_chunk_cb_data d;
 	struct blame_entry *newdest = NULL;
+	int ret;
 
 	if (!target->suspects)
 		return; /* nothing remains for this target */
@@ -1955,13 +2116,19 @@ static void pass_blame_to_parent(struct blame_scoreboard *sb,
 	d.ignore_diffs = ignore_diffs;
 	d.dstq = &newdest; d.srcq = &target->suspects;
 
-	fill_origin_blob(&sb->revs->diffopt, parent, &file_p,
-			 &sb->num_read_blob, ignore_diffs);
-	fill_origin_blob(&sb->revs->diffopt, target, &file_o,
-			 &sb->num_read_blob, ignore_diffs);
 	sb->num_get_patch++;
-
-	if (diff_hunks(&file_p, &file_o, blame_chunk_cb, &d, sb->xdl_opts))
+	if (job) {
+		replay_blame_diff_job(job, blame_chunk_cb, &d);
+		ret = job->failed;
+	} else {
+		fill_origin_blob(&sb->revs->diffopt, parent, &file_p,
+				 &sb->num_read_blob, ignore_diffs);
+		fill_origin_blob(&sb->revs->diffopt, target, &file_o,
+				 &sb->num_read_blob, ignore_diffs);
+		ret = diff_hunks(&file_p, &file_o, blame_chunk_cb, &d,
+				 sb->xdl_opts);
+	}
+	if (ret)
 		die("unable to generate diff (%s -> %s)",
 		    oid_to_hex(&parent->commit->object.oid),
 		    oid_to_hex(&target->commit->object.oid));
@@ -2086,37 +2253,49 @@ static int handle_split_cb(long start_a, long count_a,
 }
 
 /*
- * Find the lines from parent that are the same as ent so that
- * we can pass blames to it.  file_p has the blob contents for
+ * Prepare "job" to find the lines from parent that are the same as ent
+ * so that we can pass blames to it.  file_p has the blob contents for
  * the parent.
  */
-static void find_copy_in_blob(struct blame_scoreboard *sb,
-			      struct blame_entry *ent,
-			      struct blame_origin *parent,
-			      struct blame_entry *split,
-			      mmfile_t *file_p)
+static void setup_copy_job(struct blame_scoreboard *sb,
+			   struct blame_entry *ent, mmfile_t *file_p,
+			   struct blame_diff_job *job)
 {
 	const char *cp;
-	mmfile_t file_o;
-	struct handle_split_cb_data d;
 
-	memset(&d, 0, sizeof(d));
-	d.sb = sb; d.ent = ent; d.parent = parent; d.split = split;
+	job->a = *file_p;
 	/*
 	 * Prepare mmfile that contains only the lines in ent.
 	 */
 	cp = blame_nth_line(sb, ent->lno);
-	file_o.ptr = (char *) cp;
-	file_o.size = blame_nth_line(sb, ent->lno + ent->num_lines) - cp;
+	job->b.ptr = (char *) cp;
+	job->b.size = blame_nth_line(sb, ent->lno + ent->num_lines) - cp;
+}
+
+/*
+ * Find the best split of ent into lines that can be passed to
+ * parent and the rest, from the diff computed by "job".
+ */
+static void find_copy_in_job(struct blame_scoreboard *sb,
+			     struct blame_entry *ent,
+			     struct blame_origin *parent,
+			     struct blame_entry *split,
+			     struct blame_diff_job *job)
+{
+	struct handle_split_cb_data d;
+
+	memset(&d, 0, sizeof(d));
+	d.sb = sb; d.ent = ent; d.parent = parent; d.split = split;
 
 	/*
-	 * file_o is a part of final image we are annotating.
-	 * file_p partially may match that image.
+	 * The b side of the job is a part of final image we are
+	 * annotating.  The parent partially may match that image.
 	 */
 	memset(split, 0, sizeof(struct blame_entry [3]));
-	if (diff_hunks(file_p, &file_o, handle_split_cb, &d, sb->xdl_opts))
+	if (job->failed)
 		die("unable to generate diff (%s)",
 		    oid_to_hex(&parent->commit->object.oid));
+	replay_blame_diff_job(job, handle_split_cb, &d);
 	/* remainder, if any, all match the preimage */
 	handle_split(sb, ent, d.tlno, d.plno, ent->num_lines, parent, split);
 }
@@ -2180,9 +2359,19 @@ static void find_move_in_parent(struct blame_scoreboard *sb,
 	do {
 		struct blame_entry **unblamedtail = &unblamed;
 		struct blame_entry *next;
-		for (e = unblamed; e; e = next) {
+		struct blame_diff_job *jobs;
+		size_t nr = 0, i = 0;
+
+		for (e = unblamed; e; e = e->next)
+			nr++;
+		CALLOC_ARRAY(jobs, nr);
+		for (e = unblamed; e; e = e->next)
+			setup_copy_job(sb, e, &file_p, &jobs[i++]);
+		run_blame_diff_jobs(sb, jobs, nr);
+
+		for (e = unblamed, i = 0; e; e = next, i++) {
 			next = e->next;
-			find_copy_in_blob(sb, e, parent, split, &file_p);
+			find_copy_in_job(sb, e, parent, split, &jobs[i]);
 			if (split[1].suspect &&
 			    sb->move_score < blame_entry_score(sb, &split[1])) {
 				split_blame(blamed, &unblamedtail, split, e);
@@ -2192,6 +2381,7 @@ static void find_move_in_parent(struct blame_scoreboard *sb,
 			}
 			decref_split(split);
 		}
+		clear_blame_diff_jobs(jobs, nr);
 		*unblamedtail = NULL;
 		toosmall = filter_small(sb, toosmall, &unblamed, sb->move_score);
 	} while (unblamed);
@@ -2244,6 +2434,8 @@ static void find_copy_in_parent(struct blame_scoreboard *sb,
 	int num_ents;
 	struct blame_entry *unblamed = target->suspects;
 	struct blame_entry *leftover = NULL;
+	struct blame_origin **batch;
+	int batch_max;
 
 	if (!unblamed)
 		return; /* nothing remains for this target */
@@ -2276,40 +2468,68 @@ static void find_copy_in_parent(struct blame_scoreboard *sb,
 	if (!diff_opts.flags.find_copies_harder)
 		diffcore_std(&diff_opts);
 
+	/*
+	 * Read the files of the parent in batches, so that the diffs
+	 * against all of them can be computed in threads.
+	 */
+	batch_max = sb->num_threads > 1 ? 4 * sb->num_threads : 1;
+	ALLOC_ARRAY(batch, batch_max);
+
 	do {
 		struct blame_entry **unblamedtail = &unblamed;
 		blame_list = setup_blame_list(unblamed, &num_ents);
 
-		for (i = 0; i < diff_queued_diff.nr; i++) {
-			struct diff_filepair *p = diff_queued_diff.queue[i];
-			struct blame_origin *norigin;
-			mmfile_t file_p;
-			struct blame_entry potential[3];
-
-			if (!DIFF_FILE_VALID(p->one))
-				continue; /* does not exist in parent */
-			if (S_ISGITLINK(p->one->mode))
-				continue; /* ignore git links */
-			if (porigin && !strcmp(p->one->path, porigin->path))
-				/* find_move already dealt with this path */
-				continue;
+		for (i = 0; i < diff_queued_diff.nr; ) {
+			struct blame_diff_job *jobs;
+			int batch_nr = 0, b;
+
+			for (; i < diff_queued_diff.nr && batch_nr < batch_max; i++) {
+				struct diff_filepair *p = diff_queued_diff.queue[i];
+				struct blame_origin *norigin;
+				mmfile_t file_p;
+
+				if (!DIFF_FILE_VALID(p->one))
+					continue; /* does not exist in parent */
+				if (S_ISGITLINK(p->one->mode))
+					continue; /* ignore git links */
+				if (porigin && !strcmp(p->one->path, porigin->path))
+					/* find_move already dealt with this path */
+					continue;
 
-			norigin = get_origin(parent, p->one->path);
-			oidcpy(&norigin->blob_oid, &p->one->oid);
-			norigin->mode = p->one->mode;
-			fill_origin_blob(&sb->revs->diffopt, norigin, &file_p,
-					 &sb->num_read_blob, 0);
-			if (!file_p.ptr)
-				continue;
+				norigin = get_origin(parent, p->one->path);
+				oidcpy(&norigin->blob_oid, &p->one->oid);
+				norigin->mode = p->one->mode;
+				fill_origin_blob(&sb->revs->diffopt, norigin, &file_p,
+						 &sb->num_read_blob, 0);
+				if (!file_p.ptr) {
+					blame_origin_decref(norigin);
+					continue;
+				}
+				batch[batch_nr++] = norigin;
+			}
 
-			for (j = 0; j < num_ents; j++) {
-				find_copy_in_blob(sb, blame_list[j].ent,
-						  norigin, potential, &file_p);
-				copy_split_if_better(sb, blame_list[j].split,
-						     potential);
-				decref_split(potential);
+			CALLOC_ARRAY(jobs, st_mult(batch_nr, num_ents));
+			for (b = 0; b < batch_nr; b++)
+				for (j = 0; j < num_ents; j++)
+					setup_copy_job(sb, blame_list[j].ent,
+						       &batch[b]->file,
+						       &jobs[b * num_ents + j]);
+			run_blame_diff_jobs(sb, jobs, st_mult(batch_nr, num_ents));
+
+			for (b = 0; b < batch_nr; b++) {
+				for (j = 0; j < num_ents; j++) {
+					struct blame_entry potential[3];
+
+					find_copy_in_job(sb, blame_list[j].ent,
+							 batch[b], potential,
+							 &jobs[b * num_ents + j]);
+					copy_split_if_better(sb, blame_list[j].split,
+							     potential);
+					decref_split(potential);
+				}
+				blame_origin_decref(batch[b]);
 			}
-			blame_origin_decref(norigin);
+			clear_blame_diff_jobs(jobs, st_mult(batch_nr, num_ents));
 		}
 
 		for (j = 0; j < num_ents; j++) {
@@ -2329,6 +2549,7 @@ static void find_copy_in_parent(struct blame_scoreboard *sb,
 		toosmall = filter_small(sb, toosmall, &unblamed, sb->copy_score);
 	} while (unblamed);
 	target->suspects = reverse_blame(leftover, NULL);
+	free(batch);
 	diff_flush(&diff_opts);
 }
 
@@ -2405,6 +2626,61 @@ static void distribute_blame(struct blame_scoreboard *sb, struct blame_entry *bl
 
 #define MAXSG 16
 
+static int blame_cache_contains(struct blame_scoreboard *sb,
+				struct commit *commit, const char *path);
+
+/*
+ * The Bloom filters can tell that the path of "origin" did not change
+ * in its commit.  Instead of passing the blame to its parent, where we
+ * would find out the same again, follow the run of single-parent
+ * ancestors that do not change the path either, and return an origin
+ * for the path in the oldest commit of the run, or NULL if there is
+ * no such run.  The blob is the same as in "origin" all the way.
+ *
+ * We stop early at commits that need to be looked at on their own:
+ * ones that are already being blamed through another line of
+ * history, boundaries, and ones with a cached blame.
+ */
+static struct blame_origin *skip_unchanged_commits(struct blame_scoreboard *sb,
+						   struct blame_origin *origin)
+{
+	struct rev_info *revs = sb->revs;
+	struct commit *commit = origin->commit;
+	struct blame_origin *porigin;
+	int skipped = 0;
+
+	if (!sb->bloom_data || sb->reverse ||
+	    is_null_oid(&commit->object.oid))
+		return NULL;
+
+	while (num_scapegoats(revs, commit, 0) == 1 &&
+	       maybe_changed_path(sb->repo, commit, origin->path,
+				  sb->bloom_data) == 0) {
+		struct commit *parent = commit->parents->item;
+
+		if (repo_parse_commit(sb->repo, parent))
+			break;
+		commit = parent;
+		skipped++;
+
+		if (get_blame_suspects(commit) ||
+		    commit->object.flags & UNINTERESTING ||
+		    (revs->max_age != -1 && commit->date < revs->max_age) ||
+		    (sb->use_cache &&
+		     blame_cache_contains(sb, commit, origin->path)))
+			break;
+	}
+	if (!skipped)
+		return NULL;
+
+	bloom_count_skipped += skipped - 1;
+	porigin = get_origin(commit, origin->path);
+	oidcpy(&porigin->blob_oid, &origin->blob_oid);
+	porigin->mode = origin->mode;
+	return porigin;
+}
+
+
 typedef struct blame_origin *(*blame_find_alg)(struct repository *,
 					       struct commit *,
 					       struct blame_origin *,
@@ -2420,6 +2696,7 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 	struct blame_origin *porigin, **sg_origin = sg_buf;
 	struct blame_entry *toosmall = NULL;
 	struct blame_entry *blames, **blametail = &blames;
+	struct blame_diff_job *parent_jobs = NULL;
 
 	num_sg = num_scapegoats(revs, commit, sb->reverse);
 	if (!num_sg)
@@ -2429,6 +2706,13 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 	else
 		CALLOC_ARRAY(sg_origin, num_sg);
 
+	porigin = skip_unchanged_commits(sb, origin);
+	if (porigin) {
+		pass_whole_blame(sb, origin, porigin);
+		blame_origin_decref(porigin);
+		goto finish;
+	}
+
 	/*
 	 * The first pass looks for unrenamed path to optimize for
 	 * common cases, then we look for renames in the second pass.
@@ -2468,6 +2752,32 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 	}
 
 	sb->num_commits++;
+
+	/*
+	 * With several parents, their diffs can be computed in threads
+	 * up front, even though we may not need all of them.
+	 */
+	if (num_sg > 1 && sb->num_threads > 1) {
+		mmfile_t file_o;
+
+		fill_origin_blob(&sb->revs->diffopt, origin, &file_o,
+				 &sb->num_read_blob, 0);
+		CALLOC_ARRAY(parent_jobs, num_sg);
+		for (i = 0; i < num_sg; i++) {
+			if (!sg_origin[i])
+				continue;
+			fill_origin_blob(&sb->revs->diffopt, sg_origin[i],
+					 &parent_jobs[i].a, &sb->num_read_blob, 0);
+			parent_jobs[i].b = file_o;
+		}
+		if (use_blame_threads(sb, parent_jobs, num_sg)) {
+			run_blame_diff_jobs(sb, parent_jobs, num_sg);
+		} else {
+			clear_blame_diff_jobs(parent_jobs, num_sg);
+			parent_jobs = NULL;
+		}
+	}
+
 	for (i = 0, sg = first_scapegoat(revs, commit, sb->reverse);
 	     i < num_sg && sg;
 	     sg = sg->next, i++) {
@@ -2478,7 +2788,8 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 			blame_origin_incref(porigin);
 			origin->previous = porigin;
 		}
-		pass_blame_to_parent(sb, origin, porigin, 0);
+		pass_blame_to_parent(sb, origin, porigin, 0,
+				     parent_jobs ? &parent_jobs[i] : NULL);
 		if (!origin->suspects)
 			goto finish;
 	}
@@ -2494,7 +2805,7 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 
 			if (!porigin)
 				continue;
-			pass_blame_to_parent(sb, origin, porigin, 1);
+			pass_blame_to_parent(sb, origin, porigin, 1, NULL);
 			/*
 			 * Preemptively drop porigin so we can refresh the
 			 * fingerprints if we use the parent again, which can
@@ -2574,10 +2885,476 @@ static void pass_blame(struct blame_scoreboard *sb, struct blame_origin *origin,
 		}
 	}
 	drop_origin_blob(origin);
+	if (parent_jobs)
+		clear_blame_diff_jobs(parent_jobs, num_sg);
 	if (sg_buf != sg_origin)
 		free(sg_origin);
 }
 
+/*
+ * The blame of a whole file at a commit only depends on the history
+ * leading to that commit, so it can be kept around and reused by any
+ * later blame that reaches the same commit and path, e.g. when blaming
+ * a descendant of a commit that has been blamed before.
+ *
+ * Each result lives in its own file under $GIT_DIR/blame-cache, named
+ * after a hash of the commit, the path and the options that can change
+ * the result.  The file starts with a "blame-cache 1 <lines>" header,
+ * followed by one line per blame entry, sorted by line number:
+ *
+ *   <lno> <num_lines> <s_lno> <flags> <commit>\t<path>[\t<commit>\t<path>]
+ *
+ * where the optional second commit and path name the "previous" origin
+ * of the guilty one.  Paths are C-quoted when needed.
+ */
+#define BLAME_CACHE_BOUNDARY 01
+
+struct blame_cache_entry {
+	long lno, num_lines, s_lno;
+	unsigned flags;
+	struct object_id oid;
+	char *path;
+	struct object_id prev_oid;
+	char *prev_path;
+	/* resolved lazily when the entry is used */
+	struct blame_origin *origin;
+};
+
+struct blame_cache_file {
+	long num_lines;
+	struct blame_cache_entry *entries;
+	size_t nr, alloc;
+};
+
+static char *blame_cache_filename(struct blame_scoreboard *sb,
+				  struct commit *commit, const char *path)
+{
+	const struct git_hash_algo *algo = sb->repo->hash_algo;
+	struct strbuf key = STRBUF_INIT;
+	unsigned char hash[GIT_MAX_RAWSZ];
+	struct git_hash_ctx ctx;
+
+	strbuf_addstr(&key, oid_to_hex(&commit->object.oid));
+	strbuf_addch(&key, '\0');
+	strbuf_addstr(&key, path);
+	strbuf_addch(&key, '\0');
+	strbuf_addf(&key, "%d %d %d %d", sb->xdl_opts, sb->show_root,
+		    sb->revs->first_parent_only, sb->no_whole_file_rename);
+
+	algo->init_fn(&ctx);
+	git_hash_update(&ctx, key.buf, key.len);
+	git_hash_final(hash, &ctx);
+	strbuf_release(&key);
+
+	return repo_git_path(sb->repo, "blame-cache/%s",
+			     hash_to_hex_algop(hash, algo));
+}
+
+static int blame_cache_contains(struct blame_scoreboard *sb,
+				struct commit *commit, const char *path)
+{
+	char *filename = blame_cache_filename(sb, commit, path);
+	int ret = !access(filename, F_OK);
+
+	free(filename);
+	return ret;
+}
+
+/*
+ * A textconv filter can change the lines we blame without the history
+ * changing, so do not cache anything for paths that use one.
+ */
+static int blame_cache_path_ok(struct blame_scoreboard *sb, const char *path)
+{
+	struct userdiff_driver *driver;
+
+	if (!sb->revs->diffopt.flags.allow_textconv)
+		return 1;
+	driver = userdiff_find_by_path(sb->repo->index, path);
+	return !driver || !driver->textconv;
+}
+
+static const char *parse_blame_cache_path(const char *p, char **path)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	if (*p == '"') {
+		const char *end;
+		if (unquote_c_style(&buf, p, &end))
+			goto error;
+		p = end;
+	} else {
+		const char *end = strchrnul(p, '\t');
+		strbuf_add(&buf, p, end - p);
+		p = end;
+	}
+	if (!buf.len)
+		goto error;
+	*path = strbuf_detach(&buf, NULL);
+	return p;
+error:
+	strbuf_release(&buf);
+	return NULL;
+}
+
+static int parse_blame_cache_line(const char *p, const struct git_hash_algo *algo,
+				  struct blame_cache_entry *ce)
+{
+	char *end;
+
+	ce->lno = strtol(p, &end, 10);
+	if (*end != ' ')
+		return -1;
+	ce->num_lines = strtol(end + 1, &end, 10);
+	if (*end != ' ')
+		return -1;
+	ce->s_lno = strtol(end + 1, &end, 10);
+	if (*end != ' ')
+		return -1;
+	ce->flags = strtoul(end + 1, &end, 10);
+	if (*end != ' ' || ce->lno < 0 || ce->num_lines <= 0 || ce->s_lno < 0)
+		return -1;
+	if (parse_oid_hex_algop((const char *)end + 1, &ce->oid, &p, algo) || *p++ != '\t')
+		return -1;
+	p = parse_blame_cache_path(p, &ce->path);
+	if (!p)
+		return -1;
+	if (!*p)
+		return 0;
+	if (*p++ != '\t' ||
+	    parse_oid_hex_algop(p, &ce->prev_oid, &p, algo) || *p++ != '\t')
+		return -1;
+	p = parse_blame_cache_path(p, &ce->prev_path);
+	if (!p || *p)
+		return -1;
+	return 0;
+}
+
+static void clear_blame_cache_file(struct blame_cache_file *cf)
+{
+	for (size_t i = 0; i < cf->nr; i++) {
+		free(cf->entries[i].path);
+		free(cf->entries[i].prev_path);
+		blame_origin_decref(cf->entries[i].origin);
+	}
+	free(cf->entries);
+}
+
+/*
+ * Read the cached blame of "origin", if any.  The entries must cover
+ * each line of the file exactly once; anything else is treated as if
+ * there was no cache at all.
+ */
+static int read_blame_cache(struct blame_scoreboard *sb,
+			    struct blame_origin *origin,
+			    struct blame_cache_file *cf)
+{
+	const struct git_hash_algo *algo = sb->repo->hash_algo;
+	struct strbuf line = STRBUF_INIT;
+	char *filename;
+	const char *p;
+	long next_lno = 0;
+	char *end;
+	FILE *fp;
+	int ret = -1;
+
+	memset(cf, 0, sizeof(*cf));
+
+	if (!blame_cache_path_ok(sb, origin->path))
+		return -1;
+	filename = blame_cache_filename(sb, origin->commit, origin->path);
+	fp = fopen(filename, "r");
+	if (!fp) {
+		free(filename);
+		return -1;
+	}
+
+	if (strbuf_getline(&line, fp) ||
+	    !skip_prefix(line.buf, "blame-cache 1 ", &p))
+		goto out;
+	cf->num_lines = strtol(p, &end, 10);
+	if (*end || cf->num_lines < 0)
+		goto out;
+
+	while (!strbuf_getline(&line, fp)) {
+		struct blame_cache_entry *ce;
+
+		ALLOC_GROW(cf->entries, cf->nr + 1, cf->alloc);
+		ce = &cf->entries[cf->nr++];
+		memset(ce, 0, sizeof(*ce));
+		if (parse_blame_cache_line(line.buf, algo, ce) ||
+		    ce->lno != next_lno)
+			goto out;
+		next_lno += ce->num_lines;
+	}
+	if (next_lno == cf->num_lines) {
+		ret = 0;
+		/* the mtime tells expire_blame_cache() when it was last used */
+		utime(filename, NULL);
+	}
+out:
+	fclose(fp);
+	free(filename);
+	strbuf_release(&line);
+	if (ret) {
+		clear_blame_cache_file(cf);
+		memset(cf, 0, sizeof(*cf));
+	}
+	return ret;
+}
+
+static struct blame_origin *get_cached_origin(struct blame_scoreboard *sb,
+					      const struct object_id *oid,
+					      const char *path)
+{
+	struct commit *commit = lookup_commit(sb->repo, oid);
+	struct blame_origin *o;
+
+	if (!commit || repo_parse_commit(sb->repo, commit))
+		return NULL;
+	o = get_origin(commit, path);
+	if (fill_blob_sha1_and_mode(sb->repo, o)) {
+		blame_origin_decref(o);
+		return NULL;
+	}
+	return o;
+}
+
+static int resolve_blame_cache_entry(struct blame_scoreboard *sb,
+				     struct blame_cache_entry *ce)
+{
+	struct blame_origin *o;
+
+	if (ce->origin)
+		return 0;
+	o = get_cached_origin(sb, &ce->oid, ce->path);
+	if (!o)
+		return -1;
+	if (ce->prev_path && !o->previous) {
+		o->previous = get_cached_origin(sb, &ce->prev_oid, ce->prev_path);
+		if (!o->previous) {
+			blame_origin_decref(o);
+			return -1;
+		}
+	}
+	if (ce->flags & BLAME_CACHE_BOUNDARY)
+		o->commit->object.flags |= UNINTERESTING;
+	ce->origin = o;
+	return 0;
+}
+
+static size_t find_blame_cache_entry(struct blame_cache_file *cf, long lno)
+{
+	size_t lo = 0, hi = cf->nr;
+
+	while (hi - lo > 1) {
+		size_t mi = lo + (hi - lo) / 2;
+		if (cf->entries[mi].lno <= lno)
+			lo = mi;
+		else
+			hi = mi;
+	}
+	return lo;
+}
+
+/*
+ * If the blame of "suspect" is in the cache, hand each of its entries
+ * over to the commits the cache found guilty and return 1.  Otherwise
+ * leave everything alone and return 0.
+ */
+static int blame_from_cache(struct blame_scoreboard *sb,
+			    struct blame_origin *suspect)
+{
+	struct blame_cache_file cf;
+	struct blame_entry *e, *next;
+
+	if (read_blame_cache(sb, suspect, &cf))
+		return 0;
+
+	/* Resolve everything we need before touching any entry. */
+	for (e = suspect->suspects; e; e = e->next) {
+		long lno = e->s_lno, end = e->s_lno + e->num_lines;
+		size_t i;
+
+		if (end > cf.num_lines)
+			goto miss;
+		for (i = find_blame_cache_entry(&cf, lno);
+		     i < cf.nr && cf.entries[i].lno < end; i++)
+			if (resolve_blame_cache_entry(sb, &cf.entries[i]))
+				goto miss;
+	}
+
+	for (e = suspect->suspects; e; e = next) {
+		long lno = e->s_lno, end = e->s_lno + e->num_lines;
+		size_t i = find_blame_cache_entry(&cf, lno);
+
+		next = e->next;
+		while (lno < end) {
+			struct blame_cache_entry *ce = &cf.entries[i++];
+			struct blame_entry *n = xcalloc(1, sizeof(*n));
+
+			n->num_lines = (end < ce->lno + ce->num_lines ?
+					end : ce->lno + ce->num_lines) - lno;
+			n->lno = e->lno + (lno - e->s_lno);
+			n->s_lno = ce->s_lno + (lno - ce->lno);
+			n->suspect = blame_origin_incref(ce->origin);
+			n->suspect->guilty = 1;
+			if (sb->found_guilty_entry)
+				sb->found_guilty_entry(n, sb->found_guilty_entry_data);
+			n->next = sb->ent;
+			sb->ent = n;
+			lno += n->num_lines;
+		}
+		blame_origin_decref(e->suspect);
+		free(e);
+	}
+	suspect->suspects = NULL;
+	sb->cache_hits++;
+	clear_blame_cache_file(&cf);
+	return 1;
+
+miss:
+	clear_blame_cache_file(&cf);
+	return 0;
+}
+
+void setup_blame_cache(struct blame_scoreboard *sb, int opt)
+{
+	struct repository *r = sb->repo;
+
+	sb->use_cache = 0;
+
+	/*
+	 * Only cache results that depend on nothing but the commit and
+	 * the path: no moved or copied lines (their scores depend on how
+	 * the lines are split into entries), no ignored revisions, and no
+	 * limits on how far back we dig.
+	 */
+	if (sb->reverse || opt || oidset_size(&sb->ignore_list) ||
+	    sb->revs->max_age != -1 || sb->revs->limited ||
+	    sb->revs->topo_order)
+		return;
+
+	/* Nor when the history itself can be rewritten under us. */
+	if (is_repository_shallow(r))
+		return;
+	if (replace_refs_enabled(r)) {
+		prepare_replace_object(r);
+		if (oidmap_get_size(&r->objects->replace_map))
+			return;
+	}
+	prepare_commit_graft(r);
+	if (r->parsed_objects && r->parsed_objects->grafts_nr)
+		return;
+
+	sb->use_cache = 1;
+}
+
+static int compare_blame_entry_lno(const void *a_, const void *b_)
+{
+	const struct blame_entry *a = *(const struct blame_entry **)a_;
+	const struct blame_entry *b = *(const struct blame_entry **)b_;
+
+	return a->lno < b->lno ? -1 : a->lno > b->lno;
+}
+
+static void add_blame_cache_origin(struct strbuf *buf, struct blame_origin *o)
+{
+	strbuf_addstr(buf, oid_to_hex(&o->commit->object.oid));
+	strbuf_addch(buf, '\t');
+	quote_c_style(o->path, buf, NULL, 0);
+}
+
+void write_blame_cache(struct blame_scoreboard *sb)
+{
+	struct lock_file lk = LOCK_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	struct blame_entry **entries = NULL, *e;
+	size_t nr = 0, alloc = 0;
+	long num_lines = 0;
+	char *filename = NULL;
+
+	if (!sb->use_cache || is_null_oid(&sb->final->object.oid) ||
+	    !blame_cache_path_ok(sb, sb->path))
+		return;
+
+	for (e = sb->ent; e; e = e->next) {
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr++] = e;
+		num_lines += e->num_lines;
+	}
+	/* only the blame of the whole file is worth keeping */
+	if (num_lines != sb->num_lines)
+		goto out;
+	QSORT(entries, nr, compare_blame_entry_lno);
+
+	filename = blame_cache_filename(sb, sb->final, sb->path);
+	if (!access(filename, F_OK))
+		goto out;
+
+	strbuf_addf(&buf, "blame-cache 1 %d\n", sb->num_lines);
+	for (size_t i = 0; i < nr; i++) {
+		struct blame_origin *o = entries[i]->suspect;
+		unsigned flags = 0;
+
+		if (o->commit->object.flags & UNINTERESTING)
+			flags |= BLAME_CACHE_BOUNDARY;
+		strbuf_addf(&buf, "%d %d %d %u ", entries[i]->lno,
+			    entries[i]->num_lines, entries[i]->s_lno, flags);
+		add_blame_cache_origin(&buf, o);
+		if (o->previous) {
+			strbuf_addch(&buf, '\t');
+			add_blame_cache_origin(&buf, o->previous);
+		}
+		strbuf_addch(&buf, '\n');
+	}
+
+	/*
+	 * Failing to write the cache is not an error; somebody else may
+	 * be writing the same result right now.
+	 */
+	if (safe_create_leading_directories_const(sb->repo, filename) != SCLD_OK ||
+	    hold_lock_file_for_update(&lk, filename, 0) < 0)
+		goto out;
+	if (write_in_full(get_lock_file_fd(&lk), buf.buf, buf.len) < 0)
+		rollback_lock_file(&lk);
+	else
+		commit_lock_file(&lk);
+
+out:
+	free(entries);
+	free(filename);
+	strbuf_release(&buf);
+}
+
+void expire_blame_cache(struct repository *r, timestamp_t expire)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	size_t baselen;
+	DIR *dir;
+
+	repo_git_path_replace(r, &path, "blame-cache");
+	dir = opendir(path.buf);
+	if (!dir)
+		goto out;
+	strbuf_addch(&path, '/');
+	baselen = path.len;
+
+	while ((de = readdir_skip_dot_and_dotdot(dir))) {
+		struct stat st;
+
+		strbuf_setlen(&path, baselen);
+		strbuf_addstr(&path, de->d_name);
+		if (!lstat(path.buf, &st) && S_ISREG(st.st_mode) &&
+		    (timestamp_t)st.st_mtime < expire)
+			unlink_or_warn(path.buf);
+	}
+	closedir(dir);
+out:
+	strbuf_release(&path);
+}
+
 /*
  * The main loop -- while we have blobs with lines whose true origin
  * is still unknown, pick one blob, and allow its lines to pass blames
@@ -2608,7 +3385,10 @@ void assign_blame(struct blame_scoreboard *sb, int opt)
 		 */
 		blame_origin_incref(suspect);
 		repo_parse_commit(the_repository, commit);
-		if (sb->reverse ||
+		if (sb->use_cache && !is_null_oid(&commit->object.oid) &&
+		    blame_from_cache(sb, suspect))
+			; /* all of its entries have been taken care of */
+		else if (sb->reverse ||
 		    (!(commit->object.flags & UNINTERESTING) &&
 		     !(revs->max_age != -1 && commit->date < revs->max_age)))
 			pass_blame(sb, suspect, opt);
@@ -2916,12 +3696,8 @@ void setup_blame_bloom_data(struct blame_scoreboard *sb)
 	bd = xmalloc(sizeof(struct blame_bloom_data));
 
 	bd->settings = bs;
-
-	bd->alloc = 4;
-	bd->nr = 0;
-	ALLOC_ARRAY(bd->keys, bd->alloc);
-
-	add_bloom_key(bd, sb->path);
+	strmap_init(&bd->keys);
+	bd->last_commit = NULL;
 
 	sb->bloom_data = bd;
 }
@@ -2934,17 +3710,27 @@ void cleanup_scoreboard(struct blame_scoreboard *sb)
 	oidset_clear(&sb->ignore_list);
 
 	if (sb->bloom_data) {
-		int i;
-		for (i = 0; i < sb->bloom_data->nr; i++) {
-			free(sb->bloom_data->keys[i]->hashes);
-			free(sb->bloom_data->keys[i]);
+		struct hashmap_iter iter;
+		struct strmap_entry *e;
+
+		strmap_for_each_entry(&sb->bloom_data->keys, &iter, e) {
+			bloom_key_clear(e->value);
+			free(e->value);
 		}
-		free(sb->bloom_data->keys);
+		strmap_clear(&sb->bloom_data->keys, 0);
 		FREE_AND_NULL(sb->bloom_data);
 
 		trace2_data_intmax("blame", sb->repo,
 				   "bloom/queries", bloom_count_queries);
 		trace2_data_intmax("blame", sb->repo,
 				   "bloom/response-no", bloom_count_no);
+		trace2_data_intmax("blame", sb->repo,
+				   "bloom/skipped-commits", bloom_count_skipped);
 	}
+	if (sb->use_cache)
+		trace2_data_intmax("blame", sb->repo,
+				   "cache/hits", sb->cache_hits);
+	if (sb->num_threads > 1)
+		trace2_data_intmax("blame", sb->repo,
+				   "threaded-diffs", sb->num_threaded_diffs);
 }
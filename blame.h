@@ -150,6 +150,14 @@ struct blame_scoreboard {
 	int no_whole_file_rename;
 	int debug;
 
+	/* number of threads to compute diffs in */
+	int num_threads;
+	int num_threaded_diffs;
+
+	/* look up and store whole-file results in $GIT_DIR/blame-cache */
+	int use_cache;
+	int cache_hits;
+
 	/* callbacks */
 	void(*on_sanity_fail)(struct blame_scoreboard *, int);
 	void(*found_guilty_entry)(struct blame_entry *, void *);
@@ -180,6 +188,19 @@ void init_scoreboard(struct blame_scoreboard *sb);
 void setup_scoreboard(struct blame_scoreboard *sb,
 		      struct blame_origin **orig);
 void setup_blame_bloom_data(struct blame_scoreboard *sb);
+
+/*
+ * Decide whether the blame cache can be used for the options in "sb"
+ * and "opt"; call right before assign_blame().  After assign_blame(),
+ * write_blame_cache() stores the result if it covers the whole file.
+ */
+void setup_blame_cache(struct blame_scoreboard *sb, int opt);
+void write_blame_cache(struct blame_scoreboard *sb);
+
+/*
+ * Remove the cached results that have not been used since "expire".
+ */
+void expire_blame_cache(struct repository *r, timestamp_t expire);
 void cleanup_scoreboard(struct blame_scoreboard *sb);
 
 struct blame_entry *blame_entry_prepend(struct blame_entry *head,
@@ -129,6 +129,17 @@ void setup_auto_pager(const char *cmd, int def);
 
 int is_builtin(const char *s);
 
+struct strvec;
+
+/*
+ * Run "git pack-objects <args>" within the current process, reading
+ * its input from "in" and writing the pack to "out" (which has to be
+ * asked for with "--stdout"). Both descriptors are closed. This can
+ * only be done once per process, and not after cmd_pack_objects().
+ */
+int pack_objects_in_process(struct repository *repo, const struct strvec *args,
+			    int in, int out);
+
 /*
  * Builtins which do not use RUN_SETUP should never see
  * a prefix that is not empty; use this to protect downstream
@@ -33,6 +33,7 @@
 #include "refs.h"
 #include "setup.h"
 #include "tag.h"
+#include "thread-utils.h"
 #include "write-or-die.h"
 
 static const char blame_usage[] = N_("git blame [<options>] [<rev-opts>] [<rev>] [--] <file>");
@@ -64,6 +65,8 @@ static int incremental;
 static int xdl_opts;
 static int abbrev = -1;
 static int no_whole_file_rename;
+static int use_blame_cache;
+static int blame_threads;
 static int show_progress;
 static char repeated_meta_color[COLOR_MAXLEN];
 static int coloring_mode;
@@ -752,6 +755,17 @@ static int git_blame_config(const char *var, const char *value,
 		mark_unblamable_lines = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "blame.cache")) {
+		use_blame_cache = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "blame.threads")) {
+		blame_threads = git_config_int(var, value, ctx->kvi);
+		if (blame_threads < 0)
+			return error(_("invalid number of threads specified (%d) for %s"),
+				     blame_threads, var);
+		return 0;
+	}
 	if (!strcmp(var, "blame.markignoredlines")) {
 		mark_ignored_lines = git_config_bool(var, value);
 		return 0;
@@ -1251,6 +1265,7 @@ int cmd_blame(int argc,
 	sb.show_root = show_root;
 	sb.xdl_opts = xdl_opts;
 	sb.no_whole_file_rename = no_whole_file_rename;
+	sb.num_threads = blame_threads ? blame_threads : online_cpus();
 
 	read_mailmap(the_repository, &mailmap);
 
@@ -1261,10 +1276,15 @@ int cmd_blame(int argc,
 						     _("Blaming lines"),
 						     num_lines);
 
+	if (use_blame_cache)
+		setup_blame_cache(&sb, opt);
+
 	assign_blame(&sb, opt);
 
 	stop_progress(&pi.progress);
 
+	write_blame_cache(&sb);
+
 	if (!incremental)
 		setup_pager(the_repository);
 	else
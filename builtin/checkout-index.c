@@ -137,6 +137,20 @@ static int checkout_file(struct index_state *index, const char *name, const char
 	return -1;
 }
 
+/*
+ * Could the sparse directory entry `ce` contain paths below `prefix`?
+ */
+static int sparse_dir_in_prefix(const struct cache_entry *ce,
+				const char *prefix, int prefix_length)
+{
+	int len;
+
+	if (!prefix || !*prefix)
+		return 1;
+	len = ce_namelen(ce) < prefix_length ? ce_namelen(ce) : prefix_length;
+	return !memcmp(ce->name, prefix, len);
+}
+
 static int checkout_all(struct index_state *index, const char *prefix, int prefix_length)
 {
 	int i, errs = 0;
@@ -154,8 +168,13 @@ static int checkout_all(struct index_state *index, const char *prefix, int prefi
 			 * entries are being checked out, expand the index and continue
 			 * the loop on the current index position (now pointing to the
 			 * first entry inside the expanded sparse directory).
+			 *
+			 * A sparse directory only stands for stage #0 entries below
+			 * its own path, so there is nothing to expand when checking
+			 * out other stages or when it lies outside of the prefix.
 			 */
-			if (ignore_skip_worktree) {
+			if (ignore_skip_worktree && !checkout_stage &&
+			    sparse_dir_in_prefix(ce, prefix, prefix_length)) {
 				ensure_full_index(index);
 				ce = index->cache[i];
 			}
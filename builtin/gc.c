@@ -28,6 +28,9 @@
 #include "strvec.h"
 #include "commit.h"
 #include "commit-graph.h"
+#include "blame.h"
+#include "bundle-uri.h"
+#include "grep-index.h"
 #include "packfile.h"
 #include "object-file.h"
 #include "pack.h"
@@ -136,6 +139,7 @@ struct gc_config {
 	char *gc_log_expire;
 	char *prune_expire;
 	char *prune_worktrees_expire;
+	char *blame_cache_expire;
 	char *repack_filter;
 	char *repack_filter_to;
 	char *repack_expire_to;
@@ -160,6 +164,7 @@ struct gc_config {
 	.gc_log_expire = xstrdup("1.day.ago"), \
 	.prune_expire = xstrdup("2.weeks.ago"), \
 	.prune_worktrees_expire = xstrdup("3.months.ago"), \
+	.blame_cache_expire = xstrdup("1.month.ago"), \
 	.max_delta_cache_size = DEFAULT_DELTA_CACHE_SIZE, \
 	.delta_base_cache_limit = DEFAULT_DELTA_BASE_CACHE_LIMIT, \
 }
@@ -169,6 +174,7 @@ static void gc_config_release(struct gc_config *cfg)
 	free(cfg->gc_log_expire);
 	free(cfg->prune_expire);
 	free(cfg->prune_worktrees_expire);
+	free(cfg->blame_cache_expire);
 	free(cfg->repack_filter);
 	free(cfg->repack_filter_to);
 }
@@ -208,6 +214,11 @@ static void gc_config(struct gc_config *cfg)
 		cfg->prune_worktrees_expire = owned;
 	}
 
+	if (!repo_config_get_expiry(the_repository, "gc.blamecacheexpire", &owned)) {
+		free(cfg->blame_cache_expire);
+		cfg->blame_cache_expire = owned;
+	}
+
 	if (!repo_config_get_expiry(the_repository, "gc.logexpiry", &owned)) {
 		free(cfg->gc_log_expire);
 		cfg->gc_log_expire = owned;
@@ -263,6 +274,8 @@ enum maintenance_task_label {
 	TASK_REFLOG_EXPIRE,
 	TASK_WORKTREE_PRUNE,
 	TASK_RERERE_GC,
+	TASK_GREP_INDEX,
+	TASK_BUNDLE_URI,
 
 	/* Leave as final value */
 	TASK__COUNT
@@ -1046,6 +1059,15 @@ int cmd_gc(int argc,
 	if (maintenance_task_rerere_gc(&opts, &cfg))
 		die(FAILED_RUN, "rerere");
 
+	if (cfg.blame_cache_expire) {
+		timestamp_t expire;
+
+		if (parse_expiry_date(cfg.blame_cache_expire, &expire))
+			die(_("failed to parse gc.blameCacheExpire value %s"),
+			    cfg.blame_cache_expire);
+		expire_blame_cache(the_repository, expire);
+	}
+
 	report_garbage = report_pack_garbage;
 	odb_reprepare(the_repository->objects);
 	if (pack_garbage.nr > 0) {
@@ -1213,6 +1235,33 @@ static int maintenance_task_commit_graph(struct maintenance_run_opts *opts,
 	return 0;
 }
 
+static int maintenance_task_grep_index(struct maintenance_run_opts *opts,
+				       struct gc_config *cfg UNUSED)
+{
+	enum grep_index_write_flags flags = 0;
+
+	if (!opts->quiet)
+		flags |= GREP_INDEX_WRITE_PROGRESS;
+
+	if (write_grep_index(the_repository, flags)) {
+		error(_("failed to write grep index"));
+		return 1;
+	}
+
+	return 0;
+}
+
+static int maintenance_task_bundle_uri(struct maintenance_run_opts *opts,
+				       struct gc_config *cfg UNUSED)
+{
+	if (generate_bundle_uri_list(the_repository, opts->quiet)) {
+		error(_("failed to write bundles for bundle URIs"));
+		return 1;
+	}
+
+	return 0;
+}
+
 static int fetch_remote(struct remote *remote, void *cbdata)
 {
 	struct maintenance_run_opts *opts = cbdata;
@@ -1748,6 +1797,14 @@ static const struct maintenance_task tasks[] = {
 		.background = maintenance_task_rerere_gc,
 		.auto_condition = rerere_gc_condition,
 	},
+	[TASK_GREP_INDEX] = {
+		.name = "grep-index",
+		.background = maintenance_task_grep_index,
+	},
+	[TASK_BUNDLE_URI] = {
+		.name = "bundle-uri",
+		.background = maintenance_task_bundle_uri,
+	},
 };
 
 enum task_phase {
@@ -19,12 +19,14 @@
 #include "string-list.h"
 #include "run-command.h"
 #include "grep.h"
+#include "grep-index.h"
 #include "quote.h"
 #include "dir.h"
 #include "pathspec.h"
 #include "setup.h"
 #include "submodule.h"
 #include "submodule-config.h"
+#include "trace2.h"
 #include "object-file.h"
 #include "object-name.h"
 #include "odb.h"
@@ -48,6 +50,11 @@ static int recurse_submodules;
 
 static int num_threads;
 
+static int use_grep_index = 1;
+static struct grep_index *grep_index;
+static struct grep_index_query *grep_index_query;
+static intmax_t grep_index_skipped;
+
 static pthread_t *threads;
 
 /* We use one producer thread and THREADS consumer
@@ -320,6 +327,9 @@ static int grep_cmd_config(const char *var, const char *value,
 		}
 	}
 
+	if (!strcmp(var, "grep.useindex"))
+		use_grep_index = git_config_bool(var, value);
+
 	if (!strcmp(var, "submodule.recurse"))
 		recurse_submodules = git_config_bool(var, value);
 
@@ -365,6 +375,12 @@ static int grep_oid(struct grep_opt *opt, const struct object_id *oid,
 	struct strbuf pathbuf = STRBUF_INIT;
 	struct grep_source gs;
 
+	if (grep_index_query && opt->repo == the_repository &&
+	    !grep_index_may_match(grep_index, grep_index_query, oid)) {
+		grep_index_skipped++;
+		return 0;
+	}
+
 	grep_source_name(opt, filename, tree_name_len, &pathbuf);
 	grep_source_init_oid(&gs, pathbuf.buf, path, oid, opt->repo);
 	strbuf_release(&pathbuf);
@@ -1408,6 +1424,10 @@ int cmd_grep(int argc,
 				  untracked, "--untracked",
 				  cached, "--cached");
 
+	if (use_index && !untracked && use_grep_index &&
+	    (grep_index = grep_index_load(the_repository)))
+		grep_index_query = grep_index_query_new(&opt);
+
 	if (!use_index || untracked) {
 		int use_exclude = (opt_exclude < 0) ? use_index : !!opt_exclude;
 		hit = grep_directory(&opt, &pathspec, use_exclude, use_index);
@@ -1430,9 +1450,15 @@ int cmd_grep(int argc,
 	if (hit && show_in_pager)
 		run_pager(&opt, prefix);
 
+	if (grep_index_query)
+		trace2_data_intmax("grep", the_repository,
+				   "index/skipped-blobs", grep_index_skipped);
+
 	ret = !hit;
 
 out:
+	grep_index_query_free(grep_index_query);
+	grep_index_free(grep_index);
 	clear_pathspec(&pathspec);
 	string_list_clear(&path_list, 0);
 	free_grep_patterns(&opt);
@@ -22,6 +22,7 @@
 #include "string-list.h"
 #include "parse-options.h"
 #include "read-cache-ll.h"
+#include "sparse-index.h"
 
 #include "setup.h"
 #include "strvec.h"
@@ -168,6 +169,33 @@ static int empty_dir_has_sparse_contents(const char *name)
 	return ret;
 }
 
+/*
+ * Can moving from or to "path" touch entries that a sparse index hides
+ * inside a sparse directory?
+ */
+static int needs_full_index(const char *path)
+{
+	char *with_slash;
+	int pos;
+
+	if (!path_in_sparse_checkout(path, the_repository->index))
+		return 1;
+	with_slash = add_slash(path);
+	pos = index_name_pos_sparse(the_repository->index, with_slash,
+				    strlen(with_slash));
+	free(with_slash);
+	return pos >= 0 &&
+	       S_ISSPARSEDIR(the_repository->index->cache[pos]->ce_mode);
+}
+
+static int range_has_sparse_dir(int first, int last)
+{
+	for (int i = first; i < last; i++)
+		if (S_ISSPARSEDIR(the_repository->index->cache[i]->ce_mode))
+			return 1;
+	return 0;
+}
+
 static void remove_empty_src_dirs(const char **src_dir, size_t src_dir_nr)
 {
 	size_t i;
@@ -247,6 +275,8 @@ int cmd_mv(int argc,
 	if (--argc < 1)
 		usage_with_options(builtin_mv_usage, builtin_mv_options);
 
+	prepare_repo_settings(the_repository);
+	the_repository->settings.command_requires_full_index = 0;
 	repo_hold_locked_index(the_repository, &lock_file, LOCK_DIE_ON_ERROR);
 	if (repo_read_index(the_repository) < 0)
 		die(_("index file corrupt"));
@@ -266,6 +296,20 @@ int cmd_mv(int argc,
 	dst_w_slash = add_slash(dest_paths.v[0]);
 	submodule_gitfiles = xcalloc(argc, sizeof(char *));
 
+	/*
+	 * Entries inside the sparse-checkout definition are all present
+	 * in a sparse index. Only moves from or to paths outside of it
+	 * need to look inside sparse directories.
+	 */
+	if (the_repository->index->sparse_index) {
+		int expand = needs_full_index(dest_paths.v[0]);
+
+		for (i = 0; !expand && i < argc; i++)
+			expand = needs_full_index(sources.v[i]);
+		if (expand)
+			ensure_full_index(the_repository->index);
+	}
+
 	if (dest_paths.v[0][0] == '\0')
 		/* special case: "." was normalized to "" */
 		internal_prefix_pathspec(&destinations, dest_paths.v[0], argv, argc, DUP_BASENAME);
@@ -292,6 +336,15 @@ int cmd_mv(int argc,
 			dst_mode = SPARSE;
 	}
 
+	if (the_repository->index->sparse_index) {
+		for (i = 0; i < argc; i++) {
+			if (needs_full_index(destinations.v[i])) {
+				ensure_full_index(the_repository->index);
+				break;
+			}
+		}
+	}
+
 	/* Checking */
 	for (i = 0; i < argc; i++) {
 		const char *src = sources.v[i], *dst = destinations.v[i];
@@ -374,6 +427,16 @@ int cmd_mv(int argc,
 				goto act_on_entry;
 			}
 
+			/*
+			 * A directory in the cone can still contain sparse
+			 * directories, e.g. when only its parent is in the
+			 * sparse-checkout definition.
+			 */
+			if (range_has_sparse_dir(first, last)) {
+				ensure_full_index(the_repository->index);
+				index_range_of_same_dir(src, length, &first, &last);
+			}
+
 			entry = xmalloc(sizeof(*entry));
 			entry->path = src;
 			hashmap_entry_init(&entry->ent, fspathhash(src));
@@ -235,6 +235,13 @@ static int path_walk = -1;
 static int num_preferred_base;
 static struct progress *progress_state;
 
+/*
+ * Where the pack goes with --stdout, and where lists of objects,
+ * revisions or packs come from. See pack_objects_in_process().
+ */
+static int pack_out_fd = 1;
+static FILE *pack_in;
+
 static struct bitmapped_pack *reuse_packfiles;
 static size_t reuse_packfiles_nr;
 static size_t reuse_packfiles_used_nr;
@@ -1014,10 +1021,8 @@ static struct object_entry **compute_write_order(void)
 	refs_for_each_tag_ref(get_main_ref_store(the_repository), mark_tagged,
 			      NULL);
 
-	if (use_delta_islands) {
+	if (use_delta_islands)
 		max_layers = compute_pack_layers(&to_pack);
-		free_island_marks();
-	}
 
 	ALLOC_ARRAY(wo, to_pack.nr_objects);
 	wo_end = 0;
@@ -1089,11 +1094,28 @@ static off_t find_reused_offset(off_t where)
 	return reused_chunks[lo-1].difference;
 }
 
-static void write_reused_pack_one(struct packed_git *reuse_packfile,
+/*
+ * Returns true if the copy of the object at "offset" in "pack" is the one
+ * chosen by the MIDX. Only the chosen copies are reused, so a delta whose
+ * base was chosen from a different pack can not refer to it by offset.
+ */
+static int reused_base_in_pack(struct bitmapped_pack *pack, off_t offset)
+{
+	uint32_t pos;
+
+	/* The preferred pack wins all ties; see try_partial_reuse(). */
+	if (!pack->bitmap_pos)
+		return 1;
+	return midx_pair_to_pack_pos(pack->from_midx, pack->pack_int_id,
+				     offset, &pos) >= 0;
+}
+
+static void write_reused_pack_one(struct bitmapped_pack *pack,
 				  size_t pos, struct hashfile *out,
 				  off_t pack_start,
 				  struct pack_window **w_curs)
 {
+	struct packed_git *reuse_packfile = pack->p;
 	off_t offset, next, cur;
 	enum object_type type;
 	size_t size;
@@ -1119,7 +1141,7 @@ static void write_reused_pack_one(struct packed_git *reuse_packfile,
 		assert(base_offset != 0);
 
 		/* Convert to REF_DELTA if we must... */
-		if (!allow_ofs_delta) {
+		if (!allow_ofs_delta || !reused_base_in_pack(pack, base_offset)) {
 			uint32_t base_pos;
 			struct object_id base_oid;
 
@@ -1290,7 +1312,7 @@ static void write_reused_pack(struct bitmapped_pack *reuse_packfile,
 				pack_pos = pos + offset;
 			}
 
-			write_reused_pack_one(reuse_packfile->p, pack_pos, f,
+			write_reused_pack_one(reuse_packfile, pack_pos, f,
 					      pack_start, &w_curs);
 			display_progress(progress_state, ++written);
 		}
@@ -1312,10 +1334,10 @@ static void write_excluded_by_configs(void)
 
 		if (!ex)
 			BUG("configured exclusion wasn't configured");
-		write_in_full(1, ex->pack_hash_hex, strlen(ex->pack_hash_hex));
-		write_in_full(1, " ", 1);
-		write_in_full(1, ex->uri, strlen(ex->uri));
-		write_in_full(1, "\n", 1);
+		write_in_full(pack_out_fd, ex->pack_hash_hex, strlen(ex->pack_hash_hex));
+		write_in_full(pack_out_fd, " ", 1);
+		write_in_full(pack_out_fd, ex->uri, strlen(ex->uri));
+		write_in_full(pack_out_fd, "\n", 1);
 	}
 }
 
@@ -1356,7 +1378,7 @@ static void write_pack_file(void)
 				.progress = progress_state,
 				.buffer_len = LARGE_PACKET_DATA_MAX - 1,
 			};
-			f = hashfd_ext(the_repository->hash_algo, 1,
+			f = hashfd_ext(the_repository->hash_algo, pack_out_fd,
 				       "<stdout>", &opts);
 		} else {
 			f = create_tmp_packfile(the_repository, &pack_tmp_name);
@@ -1479,6 +1501,15 @@ static void write_pack_file(void)
 				bitmap_writer_free(&bitmap_writer);
 				write_bitmap_index = 0;
 				strbuf_setlen(&tmpname, tmpname_len);
+
+				if (use_delta_islands) {
+					strbuf_addstr(&tmpname, "islands");
+					write_island_marks(the_repository,
+							   written_list,
+							   nr_written, hash,
+							   tmpname.buf);
+					strbuf_setlen(&tmpname, tmpname_len);
+				}
 			}
 
 			rename_tmp_packfile_idx(the_repository, &tmpname, &idx_tmp_name);
@@ -3975,7 +4006,7 @@ static void stdin_packs_read_input(struct rev_info *revs,
 	struct strmap packs = STRMAP_INIT;
 	struct packed_git *p;
 
-	while (strbuf_getline(&buf, stdin) != EOF) {
+	while (strbuf_getline(&buf, pack_in) != EOF) {
 		struct stdin_pack_info *info;
 		enum stdin_pack_info_kind kind = STDIN_PACK_INCLUDE;
 		const char *key = buf.buf;
@@ -4293,7 +4324,7 @@ static void read_cruft_objects(void)
 
 	ignore_packed_keep_in_core = 1;
 
-	while (strbuf_getline(&buf, stdin) != EOF) {
+	while (strbuf_getline(&buf, pack_in) != EOF) {
 		if (!buf.len)
 			continue;
 
@@ -4350,14 +4381,14 @@ static void read_object_list_from_stdin(void)
 	const char *p;
 
 	for (;;) {
-		if (!fgets(line, sizeof(line), stdin)) {
-			if (feof(stdin))
+		if (!fgets(line, sizeof(line), pack_in)) {
+			if (feof(pack_in))
 				break;
-			if (!ferror(stdin))
+			if (!ferror(pack_in))
 				BUG("fgets returned NULL, not EOF, not error!");
 			if (errno != EINTR)
 				die_errno("fgets");
-			clearerr(stdin);
+			clearerr(pack_in);
 			continue;
 		}
 		if (line[0] == '-') {
@@ -4818,7 +4849,7 @@ static void get_object_list(struct rev_info *revs, struct strvec *argv)
 	save_warning = cfg->warn_on_object_refname_ambiguity;
 	cfg->warn_on_object_refname_ambiguity = 0;
 
-	while (fgets(line, sizeof(line), stdin) != NULL) {
+	while (fgets(line, sizeof(line), pack_in) != NULL) {
 		int len = strlen(line);
 		if (len && line[len - 1] == '\n')
 			line[--len] = 0;
@@ -5144,6 +5175,9 @@ int cmd_pack_objects(int argc,
 	if (DFS_NUM_STATES > (1 << OE_DFS_STATE_BITS))
 		BUG("too many dfs states, increase OE_DFS_STATE_BITS");
 
+	if (!pack_in)
+		pack_in = stdin;
+
 	disable_replace_refs();
 
 	sparse = git_env_bool("GIT_TEST_PACK_SPARSE", -1);
@@ -5412,6 +5446,8 @@ int cmd_pack_objects(int argc,
 	write_excluded_by_configs();
 	write_pack_file();
 	trace2_region_leave("pack-objects", "write-pack-file", the_repository);
+	if (use_delta_islands)
+		free_island_marks();
 
 	if (progress)
 		fprintf_ln(stderr,
@@ -5437,3 +5473,28 @@ int cmd_pack_objects(int argc,
 
 	return 0;
 }
+
+int pack_objects_in_process(struct repository *repo, const struct strvec *args,
+			    int in, int out)
+{
+	const char **argv;
+	int ret;
+
+	/* Our global state is only good for one run. */
+	if (pack_in)
+		BUG("pack-objects can only run once per process");
+
+	pack_in = xfdopen(in, "r");
+	pack_out_fd = out;
+
+	/* parse_options() shuffles argv around, so give it a copy. */
+	CALLOC_ARRAY(argv, args->nr + 2);
+	argv[0] = "pack-objects";
+	COPY_ARRAY(argv + 1, args->v, args->nr);
+
+	ret = cmd_pack_objects(args->nr + 1, argv, NULL, repo);
+
+	fclose(pack_in);
+	free(argv);
+	return ret;
+}
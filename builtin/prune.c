@@ -130,9 +130,10 @@ static int prune_subdir(unsigned int nr UNUSED, const char *path,
  * Write errors (particularly out of space) can result in
  * failed temporary packs (and more rarely indexes and other
  * files beginning with "tmp_") accumulating in the object
- * and the pack directories.
+ * and the pack directories. Similarly, interrupted bundle-uri
+ * downloads leave "uri-*" files behind in "bundles/".
  */
-static void remove_temporary_files(const char *path)
+static void remove_temporary_files(const char *path, const char *prefix)
 {
 	DIR *dir;
 	struct dirent *de;
@@ -145,7 +146,7 @@ static void remove_temporary_files(const char *path)
 		return;
 	}
 	while ((de = readdir(dir)) != NULL)
-		if (starts_with(de->d_name, "tmp_"))
+		if (starts_with(de->d_name, prefix))
 			prune_tmp_file(mkpath("%s/%s", path, de->d_name));
 	closedir(dir);
 }
@@ -202,9 +203,12 @@ int cmd_prune(int argc,
 				      prune_object, prune_cruft, prune_subdir, &revs);
 
 	prune_packed_objects(show_only ? PRUNE_PACKED_DRY_RUN : 0);
-	remove_temporary_files(repo_get_object_directory(repo));
+	remove_temporary_files(repo_get_object_directory(repo), "tmp_");
 	s = mkpathdup("%s/pack", repo_get_object_directory(repo));
-	remove_temporary_files(s);
+	remove_temporary_files(s, "tmp_");
+	free(s);
+	s = mkpathdup("%s/bundles", repo_get_object_directory(repo));
+	remove_temporary_files(s, "uri-");
 	free(s);
 
 	if (is_repository_shallow(repo)) {
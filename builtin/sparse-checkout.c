@@ -1205,6 +1205,8 @@ int cmd_sparse_checkout(int argc,
 
 	prepare_repo_settings(repo);
 	repo->settings.command_requires_full_index = 0;
+	/* Changing the sparsity rules is expected to expand the index. */
+	repo->settings.forbid_sparse_index_expansion = 0;
 
 	return fn(argc, argv, prefix, repo);
 }
@@ -18,6 +18,7 @@
 #include "sparse-index.h"
 #include "submodule.h"
 #include "submodule-config.h"
+#include "tree-walk.h"
 #include "string-list.h"
 #include "run-command.h"
 #include "remote.h"
@@ -3589,10 +3590,27 @@ static void configure_added_submodule(struct add_data *add_data)
 	}
 }
 
+/*
+ * Look up `path` below the sparse directory entry `ce` without
+ * expanding the index.  Returns 1 and sets `mode` if the tree of the
+ * sparse directory contains it.
+ */
+static int sparse_dir_has_path(const struct cache_entry *ce, const char *path,
+			       unsigned short *mode)
+{
+	struct object_id oid;
+	const char *rest;
+
+	if (!skip_prefix(path, ce->name, &rest) || !*rest)
+		return 0;
+	return !get_tree_entry(the_repository, &ce->oid, rest, &oid, mode);
+}
+
 static void die_on_index_match(const char *path, int force)
 {
 	struct pathspec ps;
 	const char *args[] = { path, NULL };
+	struct index_state *istate = the_repository->index;
 	parse_pathspec(&ps, 0, PATHSPEC_PREFER_CWD, NULL, args);
 
 	if (repo_read_index_preload(the_repository, NULL, 0) < 0)
@@ -3601,22 +3619,33 @@ static void die_on_index_match(const char *path, int force)
 	if (ps.nr) {
 		char *ps_matched = xcalloc(ps.nr, 1);
 
-		/* TODO: audit for interaction with sparse-index. */
-		ensure_full_index(the_repository->index);
+		/*
+		 * A literal path that lies inside a sparse directory can be
+		 * looked up in that directory's tree; only a pattern needs
+		 * to see every entry.
+		 */
+		if (ps.has_wildcard || ps.magic)
+			ensure_full_index(istate);
 
 		/*
 		 * Since there is only one pathspec, we just need to
 		 * check ps_matched[0] to know if a cache entry matched.
 		 */
-		for (size_t i = 0; i < the_repository->index->cache_nr; i++) {
-			ce_path_match(the_repository->index, the_repository->index->cache[i], &ps,
-				      ps_matched);
+		for (size_t i = 0; i < istate->cache_nr; i++) {
+			struct cache_entry *ce = istate->cache[i];
+			unsigned short mode = ce->ce_mode;
+
+			if (S_ISSPARSEDIR(ce->ce_mode) &&
+			    sparse_dir_has_path(ce, ps.items[0].match, &mode))
+				ps_matched[0] = 1;
+			else
+				ce_path_match(istate, ce, &ps, ps_matched);
 
 			if (ps_matched[0]) {
 				if (!force)
 					die(_("'%s' already exists in the index"),
 					    path);
-				if (!S_ISGITLINK(the_repository->index->cache[i]->ce_mode))
+				if (!S_ISGITLINK(mode))
 					die(_("'%s' already exists in the index "
 					      "and is not a submodule"), path);
 				break;
@@ -3676,6 +3705,10 @@ static int module_add(int argc, const char **argv, const char *prefix,
 
 	argc = parse_options(argc, argv, prefix, options, usage, 0);
 
+	repo_config(the_repository, git_default_config, NULL);
+	prepare_repo_settings(the_repository);
+	the_repository->settings.command_requires_full_index = 0;
+
 	if (!is_writing_gitmodules_ok())
 		die(_("please make sure that the .gitmodules file is in the working tree"));
 
@@ -663,6 +663,19 @@ static int do_unresolve(int ac, const char **av,
 	return err;
 }
 
+/*
+ * Would update_one() change the index for a path that is marked
+ * skip-worktree, like all paths inside a sparse directory? Unless
+ * asked to change the flags or to remove paths, process_path() leaves
+ * such entries alone.
+ */
+static int updates_skip_worktree_entries(void)
+{
+	return mark_valid_only || mark_skip_worktree_only ||
+	       mark_fsmonitor_only || force_remove ||
+	       (allow_remove && !ignore_skip_worktree_entries);
+}
+
 static int do_reupdate(const char **paths,
 		       const char *prefix)
 {
@@ -702,10 +715,14 @@ static int do_reupdate(const char **paths,
 		}
 
 		/* At this point, we know the contents of the sparse directory are
-		 * modified with respect to HEAD, so we expand the index and restart
-		 * to process each path individually
+		 * modified with respect to HEAD. If updating its paths can change
+		 * anything, we expand the index and restart to process each path
+		 * individually.
 		 */
 		if (S_ISSPARSEDIR(ce->ce_mode)) {
+			discard_cache_entry(old);
+			if (!updates_skip_worktree_entries())
+				continue;
 			ensure_full_index(the_repository->index);
 			goto redo;
 		}
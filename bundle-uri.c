@@ -2,19 +2,27 @@
 #define DISABLE_SIGN_COMPARE_WARNINGS
 
 #include "git-compat-util.h"
+#include "abspath.h"
 #include "bundle-uri.h"
 #include "bundle.h"
+#include "commit.h"
+#include "commit-reach.h"
 #include "copy.h"
+#include "dir.h"
 #include "gettext.h"
 #include "refs.h"
 #include "run-command.h"
 #include "hashmap.h"
+#include "hex.h"
+#include "lockfile.h"
+#include "path.h"
 #include "pkt-line.h"
 #include "config.h"
 #include "fetch-pack.h"
 #include "remote.h"
 #include "trace2.h"
 #include "odb.h"
+#include "oidset.h"
 #include "transport.h"
 #include "url.h"
 
@@ -386,13 +394,194 @@ static int download_https_uri_to_file(const char *file, const char *uri)
 	return result;
 }
 
+static off_t partial_download_size(const char *partial)
+{
+	struct stat st;
+
+	if (stat(partial, &st))
+		return 0;
+	return st.st_size;
+}
+
+/*
+ * git-remote-https(1) downloads into "<file>.temp", which it renames to
+ * "<file>" once complete, and continues from the end of an existing
+ * "<file>.temp" with a range request. Retry the download for as long
+ * as each attempt makes progress, so that a dropped connection does
+ * not throw away what we already have.
+ */
+static int download_https_uri_with_retries(const char *file, const char *uri)
+{
+	struct strbuf partial = STRBUF_INIT;
+	struct strbuf validator = STRBUF_INIT;
+	off_t size;
+	int restarted = 0;
+	int result;
+
+	strbuf_addf(&partial, "%s.temp", file);
+	strbuf_addf(&validator, "%s.validator", file);
+	size = partial_download_size(partial.buf);
+
+	while ((result = download_https_uri_to_file(file, uri))) {
+		off_t new_size = partial_download_size(partial.buf);
+
+		if (new_size > size) {
+			warning(_("download of '%s' interrupted after %"PRIuMAX" bytes; resuming"),
+				uri, (uintmax_t)new_size);
+			size = new_size;
+			continue;
+		}
+
+		/*
+		 * No progress. The partial file may be stale (e.g. already
+		 * complete, or for a file that has since changed on the
+		 * server); give it one more chance from scratch.
+		 */
+		if (!size || restarted)
+			break;
+		unlink(partial.buf);
+		unlink(validator.buf);
+		size = 0;
+		restarted = 1;
+	}
+
+	if (result && !partial_download_size(partial.buf)) {
+		unlink(partial.buf);
+		unlink(validator.buf);
+	}
+	strbuf_release(&partial);
+	strbuf_release(&validator);
+	return result;
+}
+
+/*
+ * The lock next to a partial download names the process holding it.
+ * The lock is stale if that process is gone. As we cannot check
+ * processes on other machines sharing the repository, it is also
+ * considered stale if neither the lock nor the partial download have
+ * changed for an hour.
+ */
+static int partial_download_lock_is_stale(const char *resumable)
+{
+	char my_host[HOST_NAME_MAX + 1];
+	char *lock_path = xstrfmt("%s.lock", resumable);
+	char *partial = xstrfmt("%s.temp", resumable);
+	char *scan_fmt = xstrfmt("%s %%%ds", "%"SCNuMAX, HOST_NAME_MAX);
+	char locking_host[HOST_NAME_MAX + 1] = { 0 };
+	time_t last_change = 0;
+	struct stat st;
+	uintmax_t pid;
+	FILE *fp;
+	int stale = 0;
+
+	if (xgethostname(my_host, sizeof(my_host)))
+		xsnprintf(my_host, sizeof(my_host), "unknown");
+
+	fp = fopen(lock_path, "r");
+	if (!fp || fstat(fileno(fp), &st))
+		goto out;
+	last_change = st.st_mtime;
+	if (!stat(partial, &st) && st.st_mtime > last_change)
+		last_change = st.st_mtime;
+
+	if (time(NULL) - last_change > 3600)
+		stale = 1;
+	else if (fscanf(fp, scan_fmt, &pid, locking_host) == 2 &&
+		 !strcmp(locking_host, my_host) &&
+		 kill(pid, 0) && errno == ESRCH)
+		stale = 1;
+
+out:
+	if (fp)
+		fclose(fp);
+	free(scan_fmt);
+	free(partial);
+	free(lock_path);
+	return stale;
+}
+
+static int lock_partial_download(struct lock_file *lock, const char *resumable)
+{
+	char my_host[HOST_NAME_MAX + 1];
+	struct strbuf sb = STRBUF_INIT;
+	int fd;
+
+	fd = hold_lock_file_for_update(lock, resumable, 0);
+	if (fd < 0 && errno == EEXIST &&
+	    partial_download_lock_is_stale(resumable)) {
+		char *lock_path = xstrfmt("%s.lock", resumable);
+
+		trace2_data_string("bundle-uri", the_repository,
+				   "stale_lock", lock_path);
+		unlink(lock_path);
+		free(lock_path);
+		fd = hold_lock_file_for_update(lock, resumable, 0);
+	}
+	if (fd < 0)
+		return fd;
+
+	if (xgethostname(my_host, sizeof(my_host)))
+		xsnprintf(my_host, sizeof(my_host), "unknown");
+	strbuf_addf(&sb, "%"PRIuMAX" %s", (uintmax_t)getpid(), my_host);
+	write_in_full(fd, sb.buf, sb.len);
+	strbuf_release(&sb);
+	return fd;
+}
+
+/*
+ * Download over HTTP(S) to a location derived from the URI, so that an
+ * interrupted download can be resumed by a later process fetching the
+ * same URI. The result is then moved to "filename". If another process
+ * is downloading the same URI, download to "filename" directly instead
+ * of sharing its partial file.
+ */
+static int download_https_uri_resumable(const char *filename, const char *uri)
+{
+	struct lock_file lock = LOCK_INIT;
+	struct git_hash_ctx ctx;
+	struct object_id oid;
+	char *resumable;
+	int result;
+
+	the_hash_algo->init_fn(&ctx);
+	git_hash_update(&ctx, uri, strlen(uri));
+	git_hash_final_oid(&oid, &ctx);
+	resumable = xstrfmt("%s/bundles/uri-%s",
+			    repo_get_object_directory(the_repository),
+			    oid_to_hex(&oid));
+
+	if (safe_create_leading_directories_const(the_repository, resumable) ||
+	    lock_partial_download(&lock, resumable) < 0) {
+		struct strbuf partial = STRBUF_INIT;
+
+		result = download_https_uri_with_retries(filename, uri);
+		strbuf_addf(&partial, "%s.temp", filename);
+		unlink(partial.buf);
+		strbuf_reset(&partial);
+		strbuf_addf(&partial, "%s.validator", filename);
+		unlink(partial.buf);
+		strbuf_release(&partial);
+		goto cleanup;
+	}
+
+	result = download_https_uri_with_retries(resumable, uri);
+	if (!result && rename(resumable, filename))
+		result = error_errno(_("unable to rename '%s' to '%s'"),
+				     resumable, filename);
+	rollback_lock_file(&lock);
+
+cleanup:
+	free(resumable);
+	return result;
+}
+
 static int copy_uri_to_file(const char *filename, const char *uri)
 {
 	const char *out;
 
 	if (starts_with(uri, "https:") ||
 	    starts_with(uri, "http:"))
-		return download_https_uri_to_file(filename, uri);
+		return download_https_uri_resumable(filename, uri);
 
 	if (skip_prefix(uri, "file://", &out))
 		uri = out;
@@ -976,6 +1165,48 @@ int fetch_bundle_list(struct repository *r, struct bundle_list *list)
  * API for serve.c.
  */
 
+/*
+ * The "bundle-uri" maintenance task writes its bundles and a bundle list
+ * describing them to this directory.
+ */
+static char *generated_bundle_dir(struct repository *r)
+{
+	const char *dir;
+
+	if (repo_config_get_string_tmp(r, "maintenance.bundle-uri.directory", &dir))
+		return repo_git_path(r, "bundle-uri");
+	if (is_absolute_path(dir))
+		return xstrdup(dir);
+	return repo_git_path(r, "%s", dir);
+}
+
+static char *generated_bundle_list_path(struct repository *r)
+{
+	char *dir = generated_bundle_dir(r);
+	char *path = xstrfmt("%s/bundle-list", dir);
+
+	free(dir);
+	return path;
+}
+
+/*
+ * The generated bundle list can be advertised if we know the URI it is
+ * served from, and if it has been written.
+ */
+static int can_advertise_generated_bundles(struct repository *r)
+{
+	const char *base;
+	char *list;
+	int ret;
+
+	if (repo_config_get_string_tmp(r, "uploadpack.bundleuribase", &base))
+		return 0;
+	list = generated_bundle_list_path(r);
+	ret = file_exists(list);
+	free(list);
+	return ret;
+}
+
 int bundle_uri_advertise(struct repository *r, struct strbuf *value UNUSED)
 {
 	static int advertise_bundle_uri = -1;
@@ -983,21 +1214,51 @@ int bundle_uri_advertise(struct repository *r, struct strbuf *value UNUSED)
 	if (advertise_bundle_uri != -1)
 		goto cached;
 
-	advertise_bundle_uri = 0;
-	repo_config_get_maybe_bool(r, "uploadpack.advertisebundleuris", &advertise_bundle_uri);
+	if (repo_config_get_maybe_bool(r, "uploadpack.advertisebundleuris",
+				       &advertise_bundle_uri))
+		advertise_bundle_uri = can_advertise_generated_bundles(r);
 
 cached:
 	return advertise_bundle_uri;
 }
 
+struct bundle_uri_advertisement {
+	struct packet_writer *writer;
+
+	/*
+	 * When sending the generated bundle list, its relative URIs are
+	 * made absolute by prepending this.
+	 */
+	const char *base_uri;
+
+	int nr;
+};
+
 static int config_to_packet_line(const char *key, const char *value,
 				 const struct config_context *ctx UNUSED,
 				 void *data)
 {
-	struct packet_reader *writer = data;
+	struct bundle_uri_advertisement *adv = data;
+	const char *subsection, *subkey;
+	size_t subsection_len;
 
-	if (starts_with(key, "bundle."))
-		packet_write_fmt(writer->fd, "%s=%s", key, value);
+	if (!starts_with(key, "bundle."))
+		return 0;
+
+	if (adv->base_uri && value && !strstr(value, "://") &&
+	    !parse_config_key(key, "bundle", &subsection, &subsection_len,
+			      &subkey) &&
+	    subsection && !strcmp(subkey, "uri")) {
+		size_t base_len = strlen(adv->base_uri);
+
+		while (base_len && adv->base_uri[base_len - 1] == '/')
+			base_len--;
+		packet_writer_write(adv->writer, "%s=%.*s/%s", key,
+				    (int)base_len, adv->base_uri, value);
+	} else {
+		packet_writer_write(adv->writer, "%s=%s", key, value);
+	}
+	adv->nr++;
 
 	return 0;
 }
@@ -1006,6 +1267,7 @@ int bundle_uri_command(struct repository *r,
 		       struct packet_reader *request)
 {
 	struct packet_writer writer;
+	struct bundle_uri_advertisement adv = { .writer = &writer };
 	packet_writer_init(&writer, 1);
 
 	while (packet_reader_read(request) == PACKET_READ_NORMAL)
@@ -1017,13 +1279,311 @@ int bundle_uri_command(struct repository *r,
 	 * Read all "bundle.*" config lines to the client as key=value
 	 * packet lines.
 	 */
-	repo_config(r, config_to_packet_line, &writer);
+	repo_config(r, config_to_packet_line, &adv);
+
+	/*
+	 * Without an explicitly configured bundle list, send the one
+	 * written by the "bundle-uri" maintenance task, if any.
+	 */
+	if (!adv.nr && can_advertise_generated_bundles(r)) {
+		char *list = generated_bundle_list_path(r);
+
+		repo_config_get_string_tmp(r, "uploadpack.bundleuribase",
+					   &adv.base_uri);
+		git_config_from_file(config_to_packet_line, list, &adv);
+		free(list);
+	}
 
 	packet_writer_flush(&writer);
 
 	return 0;
 }
 
+struct generated_bundle {
+	uint64_t token;
+	char *path;
+};
+
+static int generated_bundle_cmp(const void *va, const void *vb)
+{
+	const struct generated_bundle *a = va, *b = vb;
+
+	if (a->token < b->token)
+		return -1;
+	return a->token > b->token;
+}
+
+struct changed_refs_data {
+	struct oidset *bundled_tips;
+	struct string_list *changed;
+	int nr_refs;
+};
+
+static int collect_changed_ref(const struct reference *ref, void *cb_data)
+{
+	struct changed_refs_data *data = cb_data;
+
+	data->nr_refs++;
+	if (!oidset_contains(data->bundled_tips, ref->oid))
+		string_list_append(data->changed, ref->name)->util =
+			oiddup(ref->oid);
+	return 0;
+}
+
+/*
+ * Drop the refs that point at commits which are already in a bundle,
+ * like a new branch created at an old commit or a branch that was
+ * rewound. Bundling them again would bring nothing new, and "git bundle
+ * create" refuses to write an empty bundle.
+ */
+static void drop_bundled_refs(struct repository *r,
+			      struct oidset *bundled_tips,
+			      struct string_list *changed)
+{
+	struct commit **from = NULL, **to = NULL;
+	size_t from_nr = 0, from_alloc = 0, to_nr = 0, to_alloc = 0;
+	struct commit_list *reachable, *list;
+	struct oidset_iter iter;
+	const struct object_id *oid;
+	struct oidset bundled = OIDSET_INIT;
+	size_t j = 0;
+
+	oidset_iter_init(bundled_tips, &iter);
+	while ((oid = oidset_iter_next(&iter))) {
+		struct commit *c = lookup_commit_reference_gently(r, oid, 1);
+
+		if (!c)
+			continue;
+		ALLOC_GROW(from, from_nr + 1, from_alloc);
+		from[from_nr++] = c;
+	}
+	for (size_t i = 0; i < changed->nr; i++) {
+		oid = changed->items[i].util;
+		if (odb_read_object_info(r->objects, oid, NULL) != OBJ_COMMIT)
+			continue;
+		ALLOC_GROW(to, to_nr + 1, to_alloc);
+		to[to_nr++] = lookup_commit(r, oid);
+	}
+
+	if (!from_nr || !to_nr)
+		goto out;
+
+	reachable = get_reachable_subset(from, from_nr, to, to_nr, 0);
+	for (list = reachable; list; list = list->next)
+		oidset_insert(&bundled, &list->item->object.oid);
+	commit_list_free(reachable);
+
+	for (size_t i = 0; i < changed->nr; i++) {
+		if (oidset_contains(&bundled, changed->items[i].util)) {
+			free(changed->items[i].string);
+			free(changed->items[i].util);
+			continue;
+		}
+		changed->items[j++] = changed->items[i];
+	}
+	changed->nr = j;
+
+out:
+	oidset_clear(&bundled);
+	free(from);
+	free(to);
+}
+
+static int write_generated_bundle_list(const char *dir,
+				       struct generated_bundle *bundles,
+				       size_t nr)
+{
+	struct lock_file lock = LOCK_INIT;
+	char *path = xstrfmt("%s/bundle-list", dir);
+	FILE *fp;
+	int ret = 0;
+
+	if (hold_lock_file_for_update(&lock, path, 0) < 0) {
+		ret = error_errno(_("unable to lock '%s'"), path);
+		goto out;
+	}
+	fp = fdopen_lock_file(&lock, "w");
+	if (!fp) {
+		ret = error_errno(_("unable to write '%s'"), path);
+		rollback_lock_file(&lock);
+		goto out;
+	}
+
+	fprintf(fp, "[bundle]\n");
+	fprintf(fp, "\tversion = 1\n");
+	fprintf(fp, "\tmode = all\n");
+	fprintf(fp, "\theuristic = creationToken\n");
+	for (size_t i = 0; i < nr; i++) {
+		fprintf(fp, "[bundle \"bundle-%"PRIu64"\"]\n", bundles[i].token);
+		fprintf(fp, "\turi = %s\n", find_last_dir_sep(bundles[i].path) + 1);
+		fprintf(fp, "\tcreationToken = %"PRIu64"\n", bundles[i].token);
+	}
+
+	if (commit_lock_file(&lock))
+		ret = error_errno(_("unable to write '%s'"), path);
+out:
+	free(path);
+	return ret;
+}
+
+int generate_bundle_uri_list(struct repository *r, int quiet)
+{
+	char *dir = generated_bundle_dir(r);
+	char *list = generated_bundle_list_path(r);
+	DIR *dh;
+	struct dirent *de;
+	struct generated_bundle *bundles = NULL;
+	size_t nr = 0, alloc = 0, first_kept = 0;
+	struct oidset bundled_tips = OIDSET_INIT;
+	struct string_list changed = STRING_LIST_INIT_DUP;
+	struct changed_refs_data data = {
+		.bundled_tips = &bundled_tips,
+		.changed = &changed,
+	};
+	const char *prefixes[] = { "refs/heads/", "refs/tags/", NULL };
+	struct refs_for_each_ref_options opts = { 0 };
+	int max_incrementals = 7;
+	int full;
+	uint64_t token;
+	struct child_process cmd = CHILD_PROCESS_INIT;
+	int ret = 0;
+
+	repo_config_get_int(r, "maintenance.bundle-uri.maxincrementals",
+			    &max_incrementals);
+
+	if (safe_create_leading_directories_const(r, list)) {
+		ret = error_errno(_("unable to create directory '%s'"), dir);
+		goto out;
+	}
+
+	dh = opendir(dir);
+	if (!dh) {
+		ret = error_errno(_("unable to open directory '%s'"), dir);
+		goto out;
+	}
+	while ((de = readdir(dh))) {
+		const char *rest;
+		char *end;
+		uint64_t t;
+
+		if (!skip_prefix(de->d_name, "bundle-", &rest) || !isdigit(*rest))
+			continue;
+		errno = 0;
+		t = strtoull(rest, &end, 10);
+		if (errno || strcmp(end, ".bundle"))
+			continue;
+		ALLOC_GROW(bundles, nr + 1, alloc);
+		bundles[nr].token = t;
+		bundles[nr].path = xstrfmt("%s/%s", dir, de->d_name);
+		nr++;
+	}
+	closedir(dh);
+	QSORT(bundles, nr, generated_bundle_cmp);
+
+	/* The tips of the existing bundles need not be bundled again. */
+	for (size_t i = 0; i < nr; i++) {
+		struct bundle_header header = BUNDLE_HEADER_INIT;
+		struct string_list_item *item;
+		int fd = read_bundle_header(bundles[i].path, &header);
+
+		if (fd < 0) {
+			bundle_header_release(&header);
+			ret = error(_("unable to read bundle '%s'"),
+				    bundles[i].path);
+			goto out;
+		}
+		close(fd);
+		for_each_string_list_item(item, &header.references) {
+			struct object_id *oid = item->util;
+
+			if (odb_has_object(r->objects, oid, 0))
+				oidset_insert(&bundled_tips, oid);
+		}
+		bundle_header_release(&header);
+	}
+
+	refs_for_each_ref_in_prefixes(get_main_ref_store(r), prefixes, &opts,
+				      collect_changed_ref, &data);
+	drop_bundled_refs(r, &bundled_tips, &changed);
+
+	/*
+	 * Start over with a new base bundle once there are too many
+	 * increments on top of the current one.
+	 */
+	full = !nr || nr > (size_t)max_incrementals;
+	if (!data.nr_refs || (!full && !changed.nr)) {
+		if (nr && !file_exists(list))
+			ret = write_generated_bundle_list(dir, bundles, nr);
+		goto out;
+	}
+
+	token = time(NULL);
+	if (nr && token <= bundles[nr - 1].token)
+		token = bundles[nr - 1].token + 1;
+	ALLOC_GROW(bundles, nr + 1, alloc);
+	bundles[nr].token = token;
+	bundles[nr].path = xstrfmt("%s/bundle-%"PRIu64".bundle", dir, token);
+	nr++;
+
+	cmd.git_cmd = 1;
+	strvec_pushl(&cmd.args, "bundle", "create", NULL);
+	if (quiet)
+		strvec_push(&cmd.args, "--quiet");
+	strvec_push(&cmd.args, bundles[nr - 1].path);
+	if (full) {
+		strvec_pushl(&cmd.args, "--branches", "--tags", NULL);
+		cmd.no_stdin = 1;
+	} else {
+		/*
+		 * Only the refs that changed go into an increment, with
+		 * everything reachable from earlier bundles excluded.
+		 */
+		strvec_push(&cmd.args, "--stdin");
+		cmd.in = -1;
+	}
+	if (start_command(&cmd)) {
+		ret = error(_("failed to start 'git bundle create'"));
+		goto out;
+	}
+	if (!full) {
+		struct strbuf revs = STRBUF_INIT;
+		struct string_list_item *item;
+		struct oidset_iter iter;
+		const struct object_id *oid;
+
+		for_each_string_list_item(item, &changed)
+			strbuf_addf(&revs, "%s\n", item->string);
+		oidset_iter_init(&bundled_tips, &iter);
+		while ((oid = oidset_iter_next(&iter)))
+			strbuf_addf(&revs, "^%s\n", oid_to_hex(oid));
+		write_in_full(cmd.in, revs.buf, revs.len);
+		close(cmd.in);
+		strbuf_release(&revs);
+	}
+	if (finish_command(&cmd)) {
+		ret = error(_("failed to write bundle '%s'"), bundles[nr - 1].path);
+		goto out;
+	}
+
+	if (full)
+		first_kept = nr - 1;
+	ret = write_generated_bundle_list(dir, bundles + first_kept,
+					  nr - first_kept);
+	if (!ret)
+		for (size_t i = 0; i < first_kept; i++)
+			unlink_or_warn(bundles[i].path);
+
+out:
+	for (size_t i = 0; i < nr; i++)
+		free(bundles[i].path);
+	free(bundles);
+	oidset_clear(&bundled_tips);
+	string_list_clear(&changed, 1);
+	free(list);
+	free(dir);
+	return ret;
+}
+
 /**
  * General API for {transport,connect}.c etc.
  */
@@ -153,6 +153,18 @@ int fetch_bundle_list(struct repository *r,
 int bundle_uri_advertise(struct repository *r, struct strbuf *value);
 int bundle_uri_command(struct repository *r, struct packet_reader *request);
 
+/**
+ * Write a bundle of the branches and tags of the repository that
+ * contains what changed since the bundles written by earlier calls, and
+ * a bundle list describing all of them using the "creationToken"
+ * heuristic. Once maintenance.bundle-uri.maxIncrementals increments have
+ * been written, the next call writes a new base bundle and removes the
+ * older bundles. Returns non-zero on error.
+ *
+ * This is the "bundle-uri" maintenance task; see git-maintenance(1).
+ */
+int generate_bundle_uri_list(struct repository *r, int quiet);
+
 /**
  * General API for {transport,connect}.c etc.
  */
@@ -1,15 +1,31 @@
+#define USE_THE_REPOSITORY_VARIABLE
+
 #include "git-compat-util.h"
+#include "abspath.h"
+#include "config.h"
 #include "dir.h"
 #include "fsmonitor-ll.h"
 #include "fsm-listen.h"
 #include "fsmonitor--daemon.h"
 #include "fsmonitor-path-utils.h"
 #include "gettext.h"
+#include "repository.h"
 #include "simple-ipc.h"
 #include "string-list.h"
 #include "trace.h"
 
 #include <sys/inotify.h>
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
+
+/*
+ * The fanotify listener needs directory file handles with names
+ * (FAN_REPORT_DFID_NAME, Linux 5.9+).  Without it in the headers we
+ * only build the inotify listener.
+ */
+#ifdef FAN_REPORT_DFID_NAME
+#define HAVE_FANOTIFY_DFID_NAME
+#endif
 
 /*
  * Safe value to bitwise OR with rest of mask for
@@ -40,12 +56,54 @@ struct rename_entry {
 	const char *dir;
 };
 
+enum listen_backend {
+	LISTEN_INOTIFY = 0,
+	LISTEN_FANOTIFY
+};
+
+#ifdef HAVE_FANOTIFY_DFID_NAME
+/*
+ * A filesystem we placed a fanotify mark on.  `fd_mount` is an open
+ * directory on that filesystem, used to turn file handles back into
+ * paths with open_by_handle_at().
+ */
+struct fanotify_root {
+	__kernel_fsid_t fsid;
+	int fd_mount;
+	struct strbuf path_watch;
+	struct strbuf path_real;
+};
+
+/*
+ * Cache of directory file handle -> absolute path, so that most
+ * events can be mapped to a path without any syscalls, and so that
+ * events for children of a since-deleted directory can still be
+ * resolved.  The handle bytes are used as the key.
+ */
+struct dir_handle_entry {
+	struct hashmap_entry ent;
+	char *path;
+	size_t key_len;
+	unsigned char key[FLEX_ARRAY];
+};
+
+#define FANOTIFY_MAX_ROOTS 2
+#define FANOTIFY_MAX_CACHED_DIRS (64 * 1024)
+#endif
+
 struct fsm_listen_data {
+	enum listen_backend backend;
 	int fd_inotify;
 	enum shutdown_reason shutdown;
 	struct hashmap watches;
 	struct hashmap renames;
 	struct hashmap revwatches;
+#ifdef HAVE_FANOTIFY_DFID_NAME
+	int fd_fanotify;
+	struct fanotify_root roots[FANOTIFY_MAX_ROOTS];
+	int nr_roots;
+	struct hashmap dir_handles;
+#endif
 };
 
 static int watch_entry_cmp(const void *cmp_data UNUSED,
@@ -399,10 +457,438 @@ static void log_mask_set(const char *path, uint32_t mask)
 	strbuf_release(&msg);
 }
 
+#ifdef HAVE_FANOTIFY_DFID_NAME
+static int dir_handle_entry_cmp(const void *cmp_data UNUSED,
+				const struct hashmap_entry *eptr,
+				const struct hashmap_entry *entry_or_key,
+				const void *keydata UNUSED)
+{
+	const struct dir_handle_entry *e1, *e2;
+
+	e1 = container_of(eptr, const struct dir_handle_entry, ent);
+	e2 = container_of(entry_or_key, const struct dir_handle_entry, ent);
+	return e1->key_len != e2->key_len ||
+		memcmp(e1->key, e2->key, e1->key_len);
+}
+
+static void clear_dir_handles(struct fsm_listen_data *data)
+{
+	struct hashmap_iter iter;
+	struct dir_handle_entry *e;
+
+	hashmap_for_each_entry(&data->dir_handles, &iter, e, ent)
+		free(e->path);
+	hashmap_clear_and_free(&data->dir_handles, struct dir_handle_entry, ent);
+	hashmap_init(&data->dir_handles, dir_handle_entry_cmp, NULL, 0);
+}
+
+static struct fanotify_root *find_fanotify_root(struct fsm_listen_data *data,
+						const __kernel_fsid_t *fsid)
+{
+	int i;
+
+	for (i = 0; i < data->nr_roots; i++)
+		if (!memcmp(&data->roots[i].fsid, fsid, sizeof(*fsid)))
+			return &data->roots[i];
+	return NULL;
+}
+
+/*
+ * The kernel hands us canonical paths.  If a watched directory was
+ * spelled through a symlink, map the canonical prefix back to the
+ * spelling used by the rest of the daemon.
+ */
+static void unalias_fanotify_path(struct fsm_listen_data *data,
+				  struct strbuf *path)
+{
+	int i;
+
+	for (i = 0; i < data->nr_roots; i++) {
+		struct fanotify_root *root = &data->roots[i];
+		const char *rest;
+
+		if (!strbuf_cmp(&root->path_real, &root->path_watch))
+			continue;
+		if (!skip_prefix(path->buf, root->path_real.buf, &rest) ||
+		    (*rest && *rest != '/'))
+			continue;
+		strbuf_splice(path, 0, root->path_real.len,
+			      root->path_watch.buf, root->path_watch.len);
+		return;
+	}
+}
+
+/*
+ * Map the directory file handle of an event to an absolute path.
+ *
+ * Returns 0 on success, 1 if the handle is on a filesystem we do not
+ * watch, and -1 if the directory no longer exists and was not in our
+ * cache, in which case the event cannot be attributed to a path.
+ */
+static int resolve_dir_handle(struct fsm_listen_data *data,
+			      const __kernel_fsid_t *fsid,
+			      struct file_handle *fh,
+			      struct strbuf *out)
+{
+	struct fanotify_root *root = find_fanotify_root(data, fsid);
+	size_t fh_len = sizeof(*fh) + fh->handle_bytes;
+	size_t key_len = sizeof(*fsid) + fh_len;
+	struct dir_handle_entry *k, *e;
+	struct strbuf proc = STRBUF_INIT;
+	int fd, ret = 0;
+
+	if (!root)
+		return 1;
+
+	k = xcalloc(1, st_add(sizeof(*k), key_len));
+	k->key_len = key_len;
+	memcpy(k->key, fsid, sizeof(*fsid));
+	memcpy(k->key + sizeof(*fsid), fh, fh_len);
+	hashmap_entry_init(&k->ent, memhash(k->key, key_len));
+
+	e = hashmap_get_entry(&data->dir_handles, k, ent, NULL);
+	if (e) {
+		strbuf_reset(out);
+		strbuf_addstr(out, e->path);
+		free(k);
+		return 0;
+	}
+
+	fd = open_by_handle_at(root->fd_mount, fh, O_PATH);
+	if (fd < 0) {
+		if (errno != ESTALE && errno != ENOENT)
+			error_errno(_("open_by_handle_at() failed"));
+		free(k);
+		return -1;
+	}
+
+	strbuf_addf(&proc, "/proc/self/fd/%d", fd);
+	if (strbuf_readlink(out, proc.buf, 0) < 0 ||
+	    strbuf_strip_suffix(out, " (deleted)")) {
+		ret = -1;
+		free(k);
+		goto done;
+	}
+	unalias_fanotify_path(data, out);
+
+	if (hashmap_get_size(&data->dir_handles) >= FANOTIFY_MAX_CACHED_DIRS)
+		clear_dir_handles(data);
+	k->path = xstrdup(out->buf);
+	hashmap_add(&data->dir_handles, &k->ent);
+
+done:
+	close(fd);
+	strbuf_release(&proc);
+	return ret;
+}
+
+/*
+ * Mark the whole filesystem containing `path` so that we see every
+ * change below it without registering per-directory watches.
+ *
+ * Returns -1 with errno set on failure; the caller decides whether
+ * that is worth complaining about.
+ */
+static int add_fanotify_root(const char *path, struct fsm_listen_data *data)
+{
+	struct fanotify_root *root;
+	struct statfs fs;
+	__kernel_fsid_t fsid;
+	int fd, saved_errno;
+	uint64_t mask = FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM |
+		FAN_MOVED_TO | FAN_MODIFY | FAN_ATTRIB | FAN_ONDIR;
+
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstatfs(fd, &fs) < 0)
+		goto failed;
+	memcpy(&fsid, &fs.f_fsid, sizeof(fsid));
+
+	if (find_fanotify_root(data, &fsid)) {
+		close(fd); /* filesystem already marked */
+		return 0;
+	}
+	if (data->nr_roots >= FANOTIFY_MAX_ROOTS)
+		BUG("too many fanotify roots");
+
+	if (fanotify_mark(data->fd_fanotify, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+			  mask, AT_FDCWD, path) < 0)
+		goto failed;
+
+	root = &data->roots[data->nr_roots++];
+	root->fsid = fsid;
+	root->fd_mount = fd;
+	strbuf_init(&root->path_watch, 0);
+	strbuf_addstr(&root->path_watch, path);
+	strbuf_init(&root->path_real, 0);
+	strbuf_realpath(&root->path_real, path, 1);
+	return 0;
+
+failed:
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	return -1;
+}
+
+static int fanotify_ctor(struct fsmonitor_daemon_state *state,
+			 struct fsm_listen_data *data)
+{
+	int fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME |
+			       FAN_NONBLOCK | FAN_CLOEXEC, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	data->fd_fanotify = fd;
+	hashmap_init(&data->dir_handles, dir_handle_entry_cmp, NULL, 0);
+
+	if (add_fanotify_root(state->path_worktree_watch.buf, data))
+		return -1;
+	if (state->nr_paths_watching > 1 &&
+	    add_fanotify_root(state->path_gitdir_watch.buf, data))
+		return -1;
+
+	data->backend = LISTEN_FANOTIFY;
+	return 0;
+}
+
+static void fanotify_dtor(struct fsm_listen_data *data)
+{
+	int i;
+
+	for (i = 0; i < data->nr_roots; i++) {
+		close(data->roots[i].fd_mount);
+		strbuf_release(&data->roots[i].path_watch);
+		strbuf_release(&data->roots[i].path_real);
+	}
+	data->nr_roots = 0;
+
+	if (data->fd_fanotify >= 0) {
+		clear_dir_handles(data);
+		hashmap_clear(&data->dir_handles);
+		if (close(data->fd_fanotify) < 0)
+			error_errno(_("closing fanotify file descriptor failed"));
+		data->fd_fanotify = -1;
+	}
+}
+
+static int fan_dir_moved(uint64_t mask)
+{
+	return (mask & FAN_ONDIR) && (mask & FAN_MOVE);
+}
+
+static int fan_dir_gone(uint64_t mask)
+{
+	return (mask & FAN_ONDIR) && (mask & (FAN_DELETE | FAN_MOVED_FROM));
+}
+
+/*
+ * Process a single fanotify event for `path` and queue for publication.
+ *
+ * Unlike inotify there are no watches to maintain: a new or renamed
+ * directory is reported with a trailing slash so that the client
+ * invalidates everything below it.
+ */
+static int process_fanotify_event(const char *path, uint64_t mask,
+				  struct fsmonitor_batch **batch,
+				  struct string_list *cookie_list,
+				  struct fsmonitor_daemon_state *state)
+{
+	struct strbuf rel = STRBUF_INIT;
+	const char *last_sep;
+
+	switch (fsmonitor_classify_path_absolute(state, path)) {
+	case IS_INSIDE_DOT_GIT_WITH_COOKIE_PREFIX:
+	case IS_INSIDE_GITDIR_WITH_COOKIE_PREFIX:
+		/* Use just the filename of the cookie file. */
+		last_sep = find_last_dir_sep(path);
+		string_list_append(cookie_list,
+				   last_sep ? last_sep + 1 : path);
+		break;
+	case IS_INSIDE_DOT_GIT:
+	case IS_INSIDE_GITDIR:
+		break;
+	case IS_DOT_GIT:
+	case IS_GITDIR:
+		/*
+		 * If .git directory is deleted or renamed away,
+		 * we have to quit.
+		 */
+		if (fan_dir_gone(mask)) {
+			trace_printf_key(&trace_fsmonitor,
+					 "event: gitdir removed or renamed");
+			state->listen_data->shutdown = SHUTDOWN_FORCE;
+			return -1;
+		}
+		break;
+	case IS_WORKDIR_PATH:
+		/* events on the root of the worktree itself carry no path */
+		if (!path[state->path_worktree_watch.len])
+			break;
+
+		trace_printf_key(&trace_fsmonitor,
+				 "fanotify_event: '%s', mask=%#16.16"PRIx64,
+				 path, mask);
+
+		if (!*batch)
+			*batch = fsmonitor_batch__new();
+
+		strbuf_addstr(&rel, path + state->path_worktree_watch.len + 1);
+		if (mask & FAN_ONDIR)
+			strbuf_addch(&rel, '/');
+		fsmonitor_batch__add_path(*batch, rel.buf);
+		strbuf_release(&rel);
+		break;
+	case IS_OUTSIDE_CONE:
+	default:
+		break;
+	}
+	return 0;
+}
+
+/*
+ * Read the fanotify event stream, map each (directory handle, name)
+ * pair to a path and queue it for publication.
+ */
+static void handle_fanotify_events(struct fsmonitor_daemon_state *state)
+{
+	char buf[8192]
+		__attribute__ ((aligned(__alignof__(struct fanotify_event_metadata))));
+
+	struct fsm_listen_data *data = state->listen_data;
+	struct fsmonitor_batch *batch = NULL;
+	struct string_list cookie_list = STRING_LIST_INIT_DUP;
+	struct strbuf path = STRBUF_INIT;
+	const struct fanotify_event_metadata *meta;
+	ssize_t len;
+
+	for (;;) {
+		len = read(data->fd_fanotify, buf, sizeof(buf));
+		if (len == -1) {
+			if (errno == EAGAIN || errno == EINTR)
+				goto done;
+			error_errno(_("reading fanotify message stream failed"));
+			data->shutdown = SHUTDOWN_ERROR;
+			goto done;
+		}
+
+		/* nothing to read */
+		if (len == 0)
+			goto done;
+
+		for (meta = (const struct fanotify_event_metadata *)buf;
+		     FAN_EVENT_OK(meta, len);
+		     meta = FAN_EVENT_NEXT(meta, len)) {
+			const struct fanotify_event_info_fid *fid;
+			struct file_handle *fh;
+			const char *name = NULL;
+			char *p;
+			int r;
+
+			if (meta->vers != FANOTIFY_METADATA_VERSION) {
+				error(_("unexpected fanotify metadata version %d"),
+				      meta->vers);
+				data->shutdown = SHUTDOWN_ERROR;
+				goto done;
+			}
+			if (meta->fd >= 0)
+				close(meta->fd);
+
+			/* Event queue overflowed, we lost track */
+			if (meta->mask & FAN_Q_OVERFLOW) {
+				trace_printf_key(&trace_fsmonitor,
+						 "fanotify queue overflow, forcing shutdown");
+				data->shutdown = SHUTDOWN_FORCE;
+				goto done;
+			}
+
+			if (meta->event_len < meta->metadata_len + sizeof(*fid))
+				continue;
+			fid = (const struct fanotify_event_info_fid *)
+				((const char *)meta + meta->metadata_len);
+			if (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME &&
+			    fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID)
+				continue;
+
+			fh = (struct file_handle *)fid->handle;
+			if (fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME)
+				name = (const char *)fh->f_handle + fh->handle_bytes;
+
+			r = resolve_dir_handle(data, &fid->fsid, fh, &path);
+			if (r > 0)
+				continue;
+			if (r < 0) {
+				/*
+				 * The parent directory vanished before we
+				 * could look it up; we cannot tell which
+				 * path changed, so make clients rescan.
+				 */
+				trace_printf_key(&trace_fsmonitor,
+						 "unresolvable fanotify event, forcing resync");
+				fsmonitor_force_resync(state);
+				continue;
+			}
+
+			if (name && strcmp(name, "."))
+				strbuf_addf(&path, "/%s", name);
+
+			/* directories below this one now have other names */
+			if (fan_dir_moved(meta->mask))
+				clear_dir_handles(data);
+
+			p = fsmonitor__resolve_alias(path.buf, &state->alias);
+			if (!p)
+				p = strbuf_detach(&path, NULL);
+
+			if (process_fanotify_event(p, meta->mask, &batch,
+						   &cookie_list, state)) {
+				free(p);
+				goto done;
+			}
+			free(p);
+		}
+		strbuf_reset(&path);
+		fsmonitor_publish(state, batch, &cookie_list);
+		string_list_clear(&cookie_list, 0);
+		batch = NULL;
+	}
+done:
+	strbuf_release(&path);
+	fsmonitor_batch__free_list(batch);
+	string_list_clear(&cookie_list, 0);
+}
+#endif /* HAVE_FANOTIFY_DFID_NAME */
+
+/*
+ * Pick the listener from `fsmonitor.linuxBackend`: "inotify" (the
+ * default), "fanotify" (fail if it cannot be set up) or "auto" (use
+ * fanotify when permitted, otherwise fall back to inotify).
+ */
+static int want_fanotify(int *required)
+{
+	const char *value = NULL;
+
+	*required = 0;
+	if (repo_config_get_string_tmp(the_repository,
+				       "fsmonitor.linuxbackend", &value) ||
+	    !strcmp(value, "inotify"))
+		return 0;
+	if (!strcmp(value, "auto"))
+		return 1;
+	if (!strcmp(value, "fanotify")) {
+		*required = 1;
+		return 1;
+	}
+	warning(_("unknown value for fsmonitor.linuxBackend: '%s'"), value);
+	return 0;
+}
+
 int fsm_listen__ctor(struct fsmonitor_daemon_state *state)
 {
 	int fd;
 	int ret = 0;
+	int required;
 	struct fsm_listen_data *data;
 
 	CALLOC_ARRAY(data, 1);
@@ -411,6 +897,33 @@ int fsm_listen__ctor(struct fsmonitor_daemon_state *state)
 	data->fd_inotify = -1;
 	data->shutdown = SHUTDOWN_ERROR;
 
+	if (want_fanotify(&required)) {
+#ifdef HAVE_FANOTIFY_DFID_NAME
+		int saved_errno;
+
+		data->fd_fanotify = -1;
+		if (!fanotify_ctor(state, data)) {
+			trace_printf_key(&trace_fsmonitor,
+					 "using fanotify listener");
+			state->listen_error_code = 0;
+			data->shutdown = SHUTDOWN_CONTINUE;
+			return 0;
+		}
+		saved_errno = errno;
+		fanotify_dtor(data);
+		errno = saved_errno;
+#else
+		errno = ENOSYS;
+#endif
+		if (required) {
+			FREE_AND_NULL(state->listen_data);
+			return error_errno(_("could not set up fanotify listener"));
+		}
+		trace_printf_key(&trace_fsmonitor,
+				 "fanotify unavailable (%s), falling back to inotify",
+				 strerror(errno));
+	}
+
 	fd = inotify_init1(O_NONBLOCK);
 	if (fd < 0) {
 		FREE_AND_NULL(state->listen_data);
@@ -458,6 +971,11 @@ void fsm_listen__dtor(struct fsmonitor_daemon_state *state)
 	data = state->listen_data;
 	fd = data->fd_inotify;
 
+#ifdef HAVE_FANOTIFY_DFID_NAME
+	if (data->backend == LISTEN_FANOTIFY)
+		fanotify_dtor(data);
+#endif
+
 	/*
 	 * Collect all entries first, then remove them.
 	 * We can't modify the hashmap while iterating over it.
@@ -693,6 +1211,10 @@ void fsm_listen__loop(struct fsmonitor_daemon_state *state)
 	struct pollfd fds[1];
 
 	fds[0].fd = state->listen_data->fd_inotify;
+#ifdef HAVE_FANOTIFY_DFID_NAME
+	if (state->listen_data->backend == LISTEN_FANOTIFY)
+		fds[0].fd = state->listen_data->fd_fanotify;
+#endif
 	fds[0].events = POLLIN;
 
 	/*
@@ -724,8 +1246,15 @@ void fsm_listen__loop(struct fsmonitor_daemon_state *state)
 				}
 			}
 
-			if (poll_num > 0 && (fds[0].revents & POLLIN))
+			if (poll_num > 0 && (fds[0].revents & POLLIN)) {
+#ifdef HAVE_FANOTIFY_DFID_NAME
+				if (state->listen_data->backend == LISTEN_FANOTIFY) {
+					handle_fanotify_events(state);
+					continue;
+				}
+#endif
 				handle_events(state);
+			}
 
 			continue;
 		case SHUTDOWN_ERROR:
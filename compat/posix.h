@@ -376,6 +376,17 @@ void *gitmemmem(const void *haystack, size_t haystacklen,
 		const void *needle, size_t needlelen);
 #endif
 
+#ifdef NO_WRITEV
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+#define writev gitwritev
+ssize_t gitwritev(int fd, const struct iovec *iov, int iovcnt);
+#else
+#include <sys/uio.h>
+#endif
+
 #ifdef OVERRIDE_STRDUP
 #ifdef strdup
 #undef strdup
@@ -0,0 +1,27 @@
+#include "../git-compat-util.h"
+
+/*
+ * Emulate writev() with a write() per buffer. Unlike the real thing this
+ * is not atomic, but the callers only rely on it writing the buffers in
+ * order. Stop at the first short write, as writev() would, so that the
+ * caller can resume from where we stopped.
+ */
+ssize_t gitwritev(int fd, const struct iovec *iov, int iovcnt)
+{
+	ssize_t total = 0;
+
+	for (int i = 0; i < iovcnt; i++) {
+		ssize_t written;
+
+		if (!iov[i].iov_len)
+			continue;
+		written = write(fd, iov[i].iov_base, iov[i].iov_len);
+		if (written < 0)
+			return total ? total : written;
+		total += written;
+		if ((size_t)written < iov[i].iov_len)
+			break;
+	}
+
+	return total;
+}
@@ -18,6 +18,16 @@
 #include "delta-islands.h"
 #include "oid-array.h"
 #include "config.h"
+#include "chunk-format.h"
+#include "commit-reach.h"
+#include "csum-file.h"
+#include "hashmap.h"
+#include "odb.h"
+#include "packfile.h"
+#include "path.h"
+#include "string-list.h"
+#include "strmap.h"
+#include "trace2.h"
 
 KHASH_INIT(str, const char *, void *, 1, kh_str_hash_func, kh_str_hash_equal)
 
@@ -25,11 +35,29 @@ static kh_oid_map_t *island_marks;
 static unsigned island_counter;
 static unsigned island_counter_core;
 
+/*
+ * The marks of the trees whose marks were taken from the ".islands" file
+ * of an earlier repack, see reuse_island_marks().
+ */
+static kh_oid_map_t *island_seeds;
+
+/* Whether to write and reuse ".islands" files; see "pack.islandCache". */
+static int island_cache = 1;
+
 struct remote_island {
 	uint64_t hash;
+	/* The names of this island and of those deduplicated into it. */
+	struct string_list names;
 	struct oid_array oids;
 };
 
+/* The names and ref tips of each island, indexed by its island bit. */
+struct island_info {
+	struct string_list names;
+	struct oid_array tips;
+};
+static struct island_info *islands;
+
 struct island_bitmap {
 	uint32_t refcount;
 	uint32_t bits[FLEX_ARRAY];
@@ -158,13 +186,14 @@ static struct island_bitmap *create_or_get_island_marks(struct object *obj)
 	return kh_value(island_marks, pos);
 }
 
-static void set_island_marks(struct object *obj, struct island_bitmap *marks)
+static void set_island_marks(const struct object_id *oid,
+			     struct island_bitmap *marks)
 {
 	struct island_bitmap *b;
 	khiter_t pos;
 	int hash_ret;
 
-	pos = kh_put_oid_map(island_marks, obj->oid, &hash_ret);
+	pos = kh_put_oid_map(island_marks, *oid, &hash_ret);
 	if (hash_ret) {
 		/*
 		 * We don't have one yet; make a copy-on-write of the
@@ -220,6 +249,14 @@ static void mark_remote_island_1(struct repository *r,
 	if (is_core_island)
 		island_counter_core = island_counter;
 
+	/* Keep the tips around, in case we write an ".islands" file. */
+	string_list_init_dup(&islands[island_counter].names);
+	for (i = 0; i < rl->names.nr; i++)
+		string_list_append(&islands[island_counter].names,
+				   rl->names.items[i].string);
+	islands[island_counter].tips = rl->oids;
+	memset(&rl->oids, 0, sizeof(rl->oids));
+
 	island_counter++;
 }
 
@@ -242,7 +279,7 @@ void resolve_tree_islands(struct repository *r,
 {
 	struct progress *progress_state = NULL;
 	struct tree_islands_todo *todo;
-	int nr = 0;
+	int nr = 0, nr_skipped = 0;
 	int i;
 
 	if (!island_marks)
@@ -282,6 +319,23 @@ void resolve_tree_islands(struct repository *r,
 
 		root_marks = kh_value(island_marks, pos);
 
+		/*
+		 * A tree that did not gain any marks since an earlier
+		 * repack has already passed them on to its entries, whose
+		 * marks we have taken from that repack as well.
+		 */
+		if (island_seeds) {
+			khiter_t seed = kh_get_oid_map(island_seeds, ent->idx.oid);
+
+			if (seed < kh_end(island_seeds) &&
+			    island_bitmap_is_subset(root_marks,
+						    kh_value(island_seeds, seed))) {
+				nr_skipped++;
+				display_progress(progress_state, i+1);
+				continue;
+			}
+		}
+
 		tree = lookup_tree(r, &ent->idx.oid);
 		if (!tree || repo_parse_tree(r, tree) < 0)
 			die(_("bad tree object %s"), oid_to_hex(&ent->idx.oid));
@@ -297,7 +351,7 @@ void resolve_tree_islands(struct repository *r,
 			if (!obj)
 				continue;
 
-			set_island_marks(obj, root_marks);
+			set_island_marks(&obj->oid, root_marks);
 		}
 
 		free_tree_buffer(tree);
@@ -307,6 +361,10 @@ void resolve_tree_islands(struct repository *r,
 
 	stop_progress(&progress_state);
 	free(todo);
+
+	if (island_seeds)
+		trace2_data_intmax("delta-islands", r, "skipped-trees",
+				   nr_skipped);
 }
 
 struct island_load_data {
@@ -331,6 +389,7 @@ static void free_remote_islands(kh_str_t *remote_islands)
 
 	kh_foreach(remote_islands, island_name, rl, {
 		free((void *)island_name);
+		string_list_clear(&rl->names, 0);
 		oid_array_clear(&rl->oids);
 		free(rl);
 	});
@@ -366,6 +425,11 @@ static int island_config_callback(const char *k, const char *v,
 	if (!strcmp(k, "pack.islandcore"))
 		return git_config_string(&core_island_name, k, v);
 
+	if (!strcmp(k, "pack.islandcache")) {
+		island_cache = git_config_bool(k, v);
+		return 0;
+	}
+
 	return 0;
 }
 
@@ -380,7 +444,10 @@ static void add_ref_to_island(kh_str_t *remote_islands, const char *island_name,
 
 	if (hash_ret) {
 		kh_key(remote_islands, pos) = xstrdup(island_name);
-		kh_value(remote_islands, pos) = xcalloc(1, sizeof(struct remote_island));
+		rl = xcalloc(1, sizeof(struct remote_island));
+		string_list_init_nodup(&rl->names);
+		string_list_append(&rl->names, kh_key(remote_islands, pos));
+		kh_value(remote_islands, pos) = rl;
 	}
 
 	rl = kh_value(remote_islands, pos);
@@ -460,8 +527,14 @@ static void deduplicate_islands(kh_str_t *remote_islands, struct repository *r)
 
 	for (ref = 0; ref + 1 < island_count; ref++) {
 		for (src = ref + 1, dst = src; src < island_count; src++) {
-			if (list[ref]->hash == list[src]->hash)
+			if (list[ref]->hash == list[src]->hash) {
+				struct string_list_item *item;
+
+				for_each_string_list_item(item, &list[src]->names)
+					string_list_append(&list[ref]->names,
+							   item->string);
 				continue;
+			}
 
 			if (src != dst)
 				list[dst] = list[src];
@@ -473,6 +546,7 @@ static void deduplicate_islands(kh_str_t *remote_islands, struct repository *r)
 
 	island_bitmap_size = (island_count / 32) + 1;
 	core = get_core_island(remote_islands);
+	CALLOC_ARRAY(islands, island_count);
 
 	for (i = 0; i < island_count; ++i) {
 		mark_remote_island_1(r, list[i], core && list[i]->hash == core->hash);
@@ -481,6 +555,408 @@ static void deduplicate_islands(kh_str_t *remote_islands, struct repository *r)
 	free(list);
 }
 
+/*
+ * When a bitmapped pack is written, the island marks of its trees and
+ * blobs are stored next to it in an ".islands" file. The next repack
+ * starts from these marks, and only has to propagate marks through the
+ * trees that gained new ones. See gitformat-pack(5) for the format.
+ */
+#define ISLANDS_SIGNATURE 0x49534c44 /* "ISLD" */
+#define ISLANDS_VERSION 1
+#define ISLANDS_HEADER_SIZE 20
+#define ISLANDS_OBJECT_IS_TREE (1U << 31)
+#define ISLANDS_OBJECT_NO_MARKS 0xffffffff
+
+struct island_bitmap_entry {
+	struct hashmap_entry ent;
+	const struct island_bitmap *bitmap;
+	uint32_t pos;
+};
+
+static int island_bitmap_entry_cmp(const void *cmp_data UNUSED,
+				   const struct hashmap_entry *eptr,
+				   const struct hashmap_entry *entry_or_key,
+				   const void *keydata UNUSED)
+{
+	const struct island_bitmap_entry *a, *b;
+
+	a = container_of(eptr, const struct island_bitmap_entry, ent);
+	b = container_of(entry_or_key, const struct island_bitmap_entry, ent);
+
+	return memcmp(a->bitmap->bits, b->bitmap->bits,
+		      island_bitmap_size * sizeof(uint32_t));
+}
+
+void write_island_marks(struct repository *r,
+			struct pack_idx_entry **objects,
+			uint32_t nr_objects,
+			const unsigned char *hash,
+			const char *filename)
+{
+	struct hashmap bitmaps;
+	const struct island_bitmap **bitmap_list = NULL;
+	size_t bitmaps_nr = 0, bitmaps_alloc = 0;
+	uint32_t *positions;
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct hashfile *f;
+	uint32_t i;
+	int fd;
+
+	if (!island_cache || !island_marks || !island_counter)
+		return;
+
+	/* Objects with the same marks share one copy of them in the file. */
+	hashmap_init(&bitmaps, island_bitmap_entry_cmp, NULL, 0);
+	ALLOC_ARRAY(positions, nr_objects);
+	for (i = 0; i < nr_objects; i++) {
+		struct object_entry *entry = (struct object_entry *)objects[i];
+		enum object_type type = oe_type(entry);
+		struct island_bitmap_entry key, *found;
+		khiter_t pos;
+
+		positions[i] = ISLANDS_OBJECT_NO_MARKS;
+
+		/* Commits and tags are marked during the traversal anyway. */
+		if (type != OBJ_TREE && type != OBJ_BLOB)
+			continue;
+
+		pos = kh_get_oid_map(island_marks, entry->idx.oid);
+		if (pos >= kh_end(island_marks))
+			continue;
+
+		key.bitmap = kh_value(island_marks, pos);
+		hashmap_entry_init(&key.ent,
+				   memhash(key.bitmap->bits,
+					   island_bitmap_size * sizeof(uint32_t)));
+		found = hashmap_get_entry(&bitmaps, &key, ent, NULL);
+		if (!found) {
+			found = xmalloc(sizeof(*found));
+			*found = key;
+			found->pos = bitmaps_nr;
+			hashmap_add(&bitmaps, &found->ent);
+
+			ALLOC_GROW(bitmap_list, bitmaps_nr + 1, bitmaps_alloc);
+			bitmap_list[bitmaps_nr++] = found->bitmap;
+		}
+
+		positions[i] = found->pos;
+		if (type == OBJ_TREE)
+			positions[i] |= ISLANDS_OBJECT_IS_TREE;
+	}
+
+	fd = odb_mkstemp(r->objects, &tmp_file, "pack/tmp_islands_XXXXXX");
+	f = hashfd(r->hash_algo, fd, tmp_file.buf);
+
+	hashwrite_be32(f, ISLANDS_SIGNATURE);
+	hashwrite_be32(f, ISLANDS_VERSION);
+	hashwrite_be32(f, oid_version(r->hash_algo));
+	hashwrite_be32(f, island_counter);
+	hashwrite_be32(f, bitmaps_nr);
+
+	for (i = 0; i < island_counter; i++) {
+		struct island_info *island = &islands[i];
+
+		struct string_list_item *item;
+
+		hashwrite_be32(f, island->tips.nr);
+		for (size_t j = 0; j < island->tips.nr; j++)
+			hashwrite(f, island->tips.oid[j].hash,
+				  r->hash_algo->rawsz);
+		hashwrite_be32(f, island->names.nr);
+		for_each_string_list_item(item, &island->names)
+			hashwrite(f, item->string, strlen(item->string) + 1);
+	}
+
+	for (size_t j = 0; j < bitmaps_nr; j++)
+		for (i = 0; i < island_bitmap_size; i++)
+			hashwrite_be32(f, bitmap_list[j]->bits[i]);
+
+	for (i = 0; i < nr_objects; i++)
+		hashwrite_be32(f, positions[i]);
+
+	hashwrite(f, hash, r->hash_algo->rawsz);
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_PACK_METADATA,
+			  CSUM_HASH_IN_STREAM | CSUM_FSYNC | CSUM_CLOSE);
+
+	if (adjust_shared_perm(r, tmp_file.buf))
+		die_errno("unable to make temporary islands file readable");
+
+	if (rename(tmp_file.buf, filename))
+		die_errno("unable to rename temporary islands file to '%s'",
+			  filename);
+
+	hashmap_clear_and_free(&bitmaps, struct island_bitmap_entry, ent);
+	strbuf_release(&tmp_file);
+	free(bitmap_list);
+	free(positions);
+}
+
+/*
+ * Whether everything that could be reached from the tips an island had
+ * when an ".islands" file was written can still be reached from the
+ * tips it has now, so that the marks of that island in the file are
+ * still correct.
+ */
+static int island_tips_reachable(struct repository *r,
+				 const unsigned char *old_tips,
+				 uint32_t nr_old_tips,
+				 struct island_info *island)
+{
+	struct commit **tips = NULL;
+	size_t tips_nr = 0, tips_alloc = 0;
+	int ret = 1;
+
+	for (uint32_t i = 0; ret && i < nr_old_tips; i++) {
+		struct object_id oid;
+		struct commit *commit;
+
+		oidread(&oid, old_tips + st_mult(i, r->hash_algo->rawsz),
+			r->hash_algo);
+		if (oid_array_lookup(&island->tips, &oid) >= 0)
+			continue;
+
+		if (!tips) {
+			for (size_t j = 0; j < island->tips.nr; j++) {
+				commit = lookup_commit_reference_gently(r,
+						&island->tips.oid[j], 1);
+				if (!commit)
+					continue;
+				ALLOC_GROW(tips, tips_nr + 1, tips_alloc);
+				tips[tips_nr++] = commit;
+			}
+		}
+
+		commit = lookup_commit_reference_gently(r, &oid, 1);
+		if (!commit || !tips_nr ||
+		    repo_in_merge_bases_many(r, commit, tips_nr, tips, 1) <= 0)
+			ret = 0;
+	}
+
+	free(tips);
+	return ret;
+}
+
+static char *pack_islands_filename(struct packed_git *p)
+{
+	size_t len;
+	if (!strip_suffix(p->pack_name, ".pack", &len))
+		BUG("pack_name does not end in .pack");
+	return xstrfmt("%.*s.islands", (int)len, p->pack_name);
+}
+
+static int reuse_island_marks_from(struct repository *r,
+				   struct packed_git *p,
+				   const char *islands_file)
+{
+	const size_t rawsz = r->hash_algo->rawsz;
+	const unsigned char *data = NULL, *cur, *end;
+	struct island_bitmap **translated = NULL;
+	struct strintmap names;
+	uint32_t *island_map = NULL, *island_map_end = NULL;
+	size_t island_map_nr = 0, island_map_alloc = 0;
+	uint32_t nr_islands, nr_bitmaps, words, i;
+	size_t size = 0, nr_reused_islands = 0, nr_reused_objects = 0;
+	struct stat st;
+	int fd, ret = 0;
+
+	fd = git_open(islands_file);
+	if (fd < 0)
+		return -1;
+	strintmap_init(&names, -1);
+	if (fstat(fd, &st)) {
+		ret = error_errno(_("failed to read %s"), islands_file);
+		goto cleanup;
+	}
+	size = xsize_t(st.st_size);
+	if (size < ISLANDS_HEADER_SIZE + 2 * rawsz) {
+		ret = error(_("islands file %s is too small"), islands_file);
+		goto cleanup;
+	}
+	data = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (get_be32(data) != ISLANDS_SIGNATURE) {
+		ret = error(_("islands file %s has unknown signature"),
+			    islands_file);
+		goto cleanup;
+	}
+	if (get_be32(data + 4) != ISLANDS_VERSION) {
+		ret = error(_("islands file %s has unsupported version %"PRIu32),
+			    islands_file, get_be32(data + 4));
+		goto cleanup;
+	}
+	if (get_be32(data + 8) != oid_version(r->hash_algo) ||
+	    !hasheq(data + size - 2 * rawsz, p->hash, r->hash_algo)) {
+		ret = error(_("islands file %s does not match its pack"),
+			    islands_file);
+		goto cleanup;
+	}
+	nr_islands = get_be32(data + 12);
+	nr_bitmaps = get_be32(data + 16);
+	cur = data + ISLANDS_HEADER_SIZE;
+	end = data + size - 2 * rawsz;
+
+	/*
+	 * Find out which of our islands each island of back then carries
+	 * over to: those with one of its names whose tips still reach
+	 * everything it did. The bits old island "i" maps to are stored in
+	 * "island_map", ending at island_map_end[i].
+	 */
+	for (i = 0; i < island_counter; i++) {
+		struct string_list_item *item;
+
+		for_each_string_list_item(item, &islands[i].names)
+			strintmap_set(&names, item->string, i);
+	}
+	ALLOC_ARRAY(island_map_end, nr_islands);
+	for (i = 0; i < nr_islands; i++) {
+		const unsigned char *tips;
+		uint32_t nr_tips, nr_names;
+		size_t start = island_map_nr;
+
+		if (end - cur < 4)
+			goto corrupt;
+		nr_tips = get_be32(cur);
+		cur += 4;
+		if ((end - cur) / rawsz < nr_tips)
+			goto corrupt;
+		tips = cur;
+		cur += st_mult(nr_tips, rawsz);
+
+		if (end - cur < 4)
+			goto corrupt;
+		nr_names = get_be32(cur);
+		cur += 4;
+		while (nr_names--) {
+			const unsigned char *name_end = memchr(cur, '\0', end - cur);
+			int bit;
+
+			if (!name_end)
+				goto corrupt;
+			bit = strintmap_get(&names, (const char *)cur);
+			cur = name_end + 1;
+
+			if (bit < 0 ||
+			    !island_tips_reachable(r, tips, nr_tips, &islands[bit]))
+				continue;
+			ALLOC_GROW(island_map, island_map_nr + 1, island_map_alloc);
+			island_map[island_map_nr++] = bit;
+		}
+
+		island_map_end[i] = island_map_nr;
+		if (island_map_nr > start)
+			nr_reused_islands++;
+	}
+
+	words = nr_islands / 32 + 1;
+	if ((size_t)(end - cur) != st_mult(4, st_add(st_mult(nr_bitmaps, words),
+						     p->num_objects)))
+		goto corrupt;
+	if (!nr_reused_islands)
+		goto cleanup;
+
+	/* Translate the marks of the intact islands to our island bits. */
+	CALLOC_ARRAY(translated, nr_bitmaps);
+	for (uint32_t b = 0; b < nr_bitmaps; b++) {
+		const unsigned char *bits = cur + st_mult(4, st_mult(b, words));
+
+		for (i = 0; i < nr_islands; i++) {
+			size_t j = i ? island_map_end[i - 1] : 0;
+
+			if (j == island_map_end[i] ||
+			    !(get_be32(bits + 4 * ISLAND_BITMAP_BLOCK(i)) &
+			      ISLAND_BITMAP_MASK(i)))
+				continue;
+			if (!translated[b])
+				translated[b] = island_bitmap_new(NULL);
+			for (; j < island_map_end[i]; j++)
+				island_bitmap_set(translated[b], island_map[j]);
+		}
+	}
+	cur += st_mult(4, st_mult(nr_bitmaps, words));
+
+	island_seeds = kh_init_oid_map();
+	for (i = 0; i < p->num_objects; i++) {
+		uint32_t value = get_be32(cur + st_mult(4, i));
+		uint32_t pos = value & ~ISLANDS_OBJECT_IS_TREE;
+		struct object_id oid;
+
+		if (value == ISLANDS_OBJECT_NO_MARKS)
+			continue;
+		if (pos >= nr_bitmaps)
+			goto corrupt;
+		if (!translated[pos])
+			continue;
+		if (nth_packed_object_id(&oid, p, i) < 0)
+			goto corrupt;
+
+		set_island_marks(&oid, translated[pos]);
+		if (value & ISLANDS_OBJECT_IS_TREE) {
+			int hash_ret;
+			khiter_t seed = kh_put_oid_map(island_seeds, oid,
+						       &hash_ret);
+			if (hash_ret) {
+				translated[pos]->refcount++;
+				kh_value(island_seeds, seed) = translated[pos];
+			}
+		}
+		nr_reused_objects++;
+	}
+
+	goto cleanup;
+
+corrupt:
+	ret = error(_("islands file %s is corrupt"), islands_file);
+
+cleanup:
+	trace2_data_intmax("delta-islands", r, "reused-islands",
+			   nr_reused_islands);
+	trace2_data_intmax("delta-islands", r, "reused-objects",
+			   nr_reused_objects);
+
+	if (translated) {
+		for (i = 0; i < nr_bitmaps; i++)
+			if (translated[i] && !--translated[i]->refcount)
+				free(translated[i]);
+		free(translated);
+	}
+	free(island_map);
+	free(island_map_end);
+	strintmap_clear(&names);
+	if (data)
+		munmap((void *)data, size);
+	close(fd);
+	return ret;
+}
+
+/*
+ * Start from the island marks stored with the most recent pack that has
+ * an ".islands" file, as far as they are still correct.
+ */
+static void reuse_island_marks(struct repository *r)
+{
+	struct packed_git *p;
+
+	if (!island_cache || !island_counter)
+		return;
+
+	repo_for_each_pack(r, p) {
+		char *islands_file;
+		int found = 0;
+
+		if (!p->pack_local || open_pack_index(p))
+			continue;
+
+		islands_file = pack_islands_filename(p);
+		if (!access(islands_file, F_OK)) {
+			reuse_island_marks_from(r, p, islands_file);
+			found = 1;
+		}
+		free(islands_file);
+		if (found)
+			break;
+	}
+}
+
 void load_delta_islands(struct repository *r, int progress)
 {
 	struct island_load_data ild = { 0 };
@@ -494,6 +970,7 @@ void load_delta_islands(struct repository *r, int progress)
 	free_config_regexes(&ild);
 	deduplicate_islands(ild.remote_islands, r);
 	free_remote_islands(ild.remote_islands);
+	reuse_island_marks(r);
 
 	if (progress)
 		fprintf(stderr, _("Marked %d islands, done.\n"), island_counter);
@@ -508,10 +985,10 @@ void propagate_island_marks(struct repository *r, struct commit *commit)
 		struct island_bitmap *root_marks = kh_value(island_marks, pos);
 
 		repo_parse_commit(r, commit);
-		set_island_marks(&repo_get_commit_tree(r, commit)->object,
+		set_island_marks(&repo_get_commit_tree(r, commit)->object.oid,
 				 root_marks);
 		for (p = commit->parents; p; p = p->next)
-			set_island_marks(&p->item->object, root_marks);
+			set_island_marks(&p->item->object.oid, root_marks);
 	}
 }
 
@@ -527,6 +1004,21 @@ void free_island_marks(void)
 		kh_destroy_oid_map(island_marks);
 	}
 
+	if (island_seeds) {
+		kh_foreach_value(island_seeds, bitmap, {
+			if (!--bitmap->refcount)
+				free(bitmap);
+		});
+		kh_destroy_oid_map(island_seeds);
+		island_seeds = NULL;
+	}
+
+	for (unsigned i = 0; i < island_counter; i++) {
+		string_list_clear(&islands[i].names, 0);
+		oid_array_clear(&islands[i].tips);
+	}
+	FREE_AND_NULL(islands);
+
 	/* detect use-after-free with an address which is never valid: */
 	island_marks = (void *)-1;
 }
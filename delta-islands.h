@@ -3,6 +3,7 @@
 
 struct commit;
 struct object_id;
+struct pack_idx_entry;
 struct packing_data;
 struct repository;
 
@@ -14,6 +15,18 @@ void resolve_tree_islands(struct repository *r,
 void load_delta_islands(struct repository *r, int progress);
 void propagate_island_marks(struct repository *r, struct commit *commit);
 int compute_pack_layers(struct packing_data *to_pack);
+
+/*
+ * Write the island marks of "objects", which must be sorted in index
+ * order, to the ".islands" file "filename" of the pack with checksum
+ * "hash", for later repacks to start from.
+ */
+void write_island_marks(struct repository *r,
+			struct pack_idx_entry **objects,
+			uint32_t nr_objects,
+			const unsigned char *hash,
+			const char *filename);
+
 void free_island_marks(void);
 
 #endif /* DELTA_ISLANDS_H */
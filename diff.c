@@ -45,6 +45,8 @@
 #include "read-cache-ll.h"
 #include "setup.h"
 #include "strmap.h"
+#include "thread-utils.h"
+#include "trace2.h"
 #include "ws.h"
 
 #ifdef NO_FAST_WORKING_DIRECTORY
@@ -56,6 +58,8 @@
 static int diff_detect_rename_default;
 static int diff_indent_heuristic = 1;
 static int diff_rename_limit_default = 1000;
+static int diff_rename_threads_default;
+static int diff_approximate_renames_default;
 static int diff_suppress_blank_empty;
 static enum git_colorbool diff_use_color_default = GIT_COLOR_UNKNOWN;
 static int diff_color_moved_default;
@@ -76,6 +80,9 @@ static int diff_stat_graph_width;
 static int diff_dirstat_permille_default = 30;
 static struct diff_options default_diff_options;
 static long diff_algorithm;
+static long diff_split_lines;
+static long diff_max_cost;
+static int diff_threads = 1;
 static unsigned ws_error_highlight_default = WSEH_NEW;
 
 static char diff_colors[][COLOR_MAXLEN] = {
@@ -217,6 +224,17 @@ int git_config_rename(const char *var, const char *value)
 	return git_config_bool(var,value) ? DIFF_DETECT_RENAME : 0;
 }
 
+static int parse_rename_candidates(const char *value)
+{
+	if (!value)
+		return -1;
+	if (!strcmp(value, "exhaustive"))
+		return 0;
+	if (!strcmp(value, "approximate"))
+		return 1;
+	return -1;
+}
+
 long parse_algorithm_value(const char *value)
 {
 	if (!value)
@@ -399,6 +417,21 @@ int git_diff_ui_config(const char *var, const char *value,
 		diff_detect_rename_default = git_config_rename(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "diff.renamecandidates")) {
+		int val = parse_rename_candidates(value);
+		if (val < 0)
+			return error(_("unknown value for config '%s': %s"),
+				     var, value);
+		diff_approximate_renames_default = val;
+		return 0;
+	}
+	if (!strcmp(var, "diff.renamethreads")) {
+		int val = git_config_int(var, value, ctx->kvi);
+		if (val < 0)
+			return error(_("'%s' must be at least 0"), var);
+		diff_rename_threads_default = val;
+		return 0;
+	}
 	if (!strcmp(var, "diff.autorefreshindex")) {
 		diff_auto_refresh_index = git_config_bool(var, value);
 		return 0;
@@ -469,6 +502,16 @@ int git_diff_ui_config(const char *var, const char *value,
 		return 0;
 	}
 
+	if (!strcmp(var, "diff.splitlines")) {
+		diff_split_lines = git_config_ulong(var, value, ctx->kvi);
+		return 0;
+	}
+
+	if (!strcmp(var, "diff.maxcost")) {
+		diff_max_cost = git_config_ulong(var, value, ctx->kvi);
+		return 0;
+	}
+
 	if (git_color_config(var, value, cb) < 0)
 		return -1;
 
@@ -485,6 +528,14 @@ int git_diff_basic_config(const char *var, const char *value,
 		return 0;
 	}
 
+	if (!strcmp(var, "diff.threads")) {
+		diff_threads = git_config_int(var, value, ctx->kvi);
+		if (diff_threads < 0)
+			return error(_("invalid number of threads specified (%d) for %s"),
+				     diff_threads, var);
+		return 0;
+	}
+
 	if (userdiff_config(var, value) < 0)
 		return -1;
 
@@ -3837,6 +3888,82 @@ static int set_diff_algorithm(struct diff_options *opts,
 	return 0;
 }
 
+/*
+ * With diff.threads, the xdiff part of each patch is computed by a pool
+ * of worker threads. The main thread still visits the file pairs in
+ * order and does everything else (reading blobs, running textconv,
+ * looking up attributes), but emits into a buffer of symbols per file
+ * pair, and builtin_diff() hands the pair over as a patch job instead
+ * of running xdiff itself. The buffers are then replayed in order, just
+ * like --color-moved replays its own, so that the output does not
+ * depend on the number of threads.
+ */
+struct diff_patch_job {
+	struct emitted_diff_symbols symbols;
+
+	/* set by builtin_diff() if the pair still needs to be diffed */
+	int deferred;
+	struct diff_options opt;
+	struct emit_callback ecbdata;
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+	mmfile_t mf1, mf2;
+	char *labels[2];
+	/* what fn_out_consume() uses, and clears, out of "labels" */
+	const char *label_path[2];
+	struct strbuf header;
+	char *path;
+
+	/* protected by the mutex of the pool */
+	int done;
+	int failed;
+};
+
+static char *copy_mmfile_data(const mmfile_t *mf)
+{
+	return mf->size ? xmemdupz(mf->ptr, mf->size) : xstrdup("");
+}
+
+static void defer_patch_job(struct diff_options *o,
+			    mmfile_t *mf1, int own_mf1,
+			    mmfile_t *mf2, int own_mf2,
+			    const struct emit_callback *ecbdata,
+			    const xpparam_t *xpp, const xdemitconf_t *xecfg,
+			    const char *path)
+{
+	struct diff_patch_job *job = o->patch_job;
+	int i;
+
+	job->opt = *o;
+	job->opt.emitted_symbols = &job->symbols;
+	job->opt.patch_job = NULL;
+	job->opt.found_changes = 0;
+
+	/* the pair's filespecs are freed long before a worker is done */
+	job->mf1.ptr = own_mf1 ? mf1->ptr : copy_mmfile_data(mf1);
+	job->mf1.size = mf1->size;
+	job->mf2.ptr = own_mf2 ? mf2->ptr : copy_mmfile_data(mf2);
+	job->mf2.size = mf2->size;
+
+	job->ecbdata = *ecbdata;
+	job->ecbdata.opt = &job->opt;
+	for (i = 0; i < 2; i++) {
+		job->labels[i] = xstrdup_or_null(ecbdata->label_path[i]);
+		job->label_path[i] = job->labels[i];
+	}
+	job->ecbdata.label_path = job->label_path;
+	strbuf_init(&job->header, 0);
+	if (ecbdata->header) {
+		strbuf_addbuf(&job->header, ecbdata->header);
+		job->ecbdata.header = &job->header;
+	}
+
+	job->xpp = *xpp;
+	job->xecfg = *xecfg;
+	job->path = xstrdup(path);
+	job->deferred = 1;
+}
+
 static void builtin_diff(const char *name_a,
 			 const char *name_b,
 			 struct diff_filespec *one,
@@ -4055,6 +4182,8 @@ static void builtin_diff(const char *name_a,
 		xpp.ignore_regex_nr = o->ignore_regex_nr;
 		xpp.anchors = o->anchors;
 		xpp.anchors_nr = o->anchors_nr;
+		xpp.split_lines = o->xdl_split_lines;
+		xpp.max_cost = o->xdl_max_cost;
 		xecfg.ctxlen = o->context;
 		xecfg.interhunkctxlen = o->interhunkcontext;
 		xecfg.flags = XDL_EMIT_FUNCNAMES;
@@ -4132,16 +4261,22 @@ static void builtin_diff(const char *name_a,
 				    one->path);
 			strbuf_release(&lr_state.rhunk);
 			strbuf_release(&lr_state.pending_rm);
+		} else if (o->patch_job) {
+			defer_patch_job(o, &mf1, !!textconv_one,
+					&mf2, !!textconv_two,
+					&ecbdata, &xpp, &xecfg, one->path);
 		} else if (xdi_diff_outf(&mf1, &mf2, NULL, fn_out_consume,
 					 &ecbdata, &xpp, &xecfg))
 			die("unable to generate diff for %s", one->path);
 		if (o->word_diff)
 			free_diff_words_data(&ecbdata);
-		if (textconv_one)
-			free(mf1.ptr);
-		if (textconv_two)
-			free(mf2.ptr);
-		xdiff_clear_find_func(&xecfg);
+		if (!o->patch_job || !o->patch_job->deferred) {
+			if (textconv_one)
+				free(mf1.ptr);
+			if (textconv_two)
+				free(mf2.ptr);
+			xdiff_clear_find_func(&xecfg);
+		}
 	}
 
  free_ab_and_return:
@@ -4245,6 +4380,8 @@ static void builtin_diffstat(const char *name_a, const char *name_b,
 		xpp.ignore_regex_nr = o->ignore_regex_nr;
 		xpp.anchors = o->anchors;
 		xpp.anchors_nr = o->anchors_nr;
+		xpp.split_lines = o->xdl_split_lines;
+		xpp.max_cost = o->xdl_max_cost;
 		xecfg.ctxlen = o->context;
 		xecfg.interhunkctxlen = o->interhunkcontext;
 		xecfg.flags = XDL_EMIT_NO_HUNK_HDR;
@@ -5157,7 +5294,11 @@ void repo_diff_setup(struct repository *r, struct diff_options *options)
 	options->add_remove = diff_addremove;
 	options->use_color = diff_use_color_default;
 	options->detect_rename = diff_detect_rename_default;
+	options->rename_threads = diff_rename_threads_default;
+	options->approximate_renames = diff_approximate_renames_default;
 	options->xdl_opts |= diff_algorithm;
+	options->xdl_split_lines = diff_split_lines;
+	options->xdl_max_cost = diff_max_cost;
 	if (diff_indent_heuristic)
 		DIFF_XDL_SET(options, INDENT_HEURISTIC);
 
@@ -5667,6 +5808,40 @@ static int diff_opt_compact_summary(const struct option *opt,
 	return 0;
 }
 
+static int diff_opt_rename_candidates(const struct option *opt,
+				     const char *arg, int unset)
+{
+	struct diff_options *options = opt->value;
+	int val;
+
+	BUG_ON_OPT_NEG(unset);
+
+	val = parse_rename_candidates(arg);
+	if (val < 0)
+		return error(_("option rename-candidates accepts \"exhaustive\" "
+			       "and \"approximate\""));
+	options->approximate_renames = val;
+	return 0;
+}
+
+static int diff_opt_xdl_limit(const struct option *opt,
+			     const char *arg, int unset)
+{
+	long *limit = opt->value;
+	char *s;
+	long val;
+
+	BUG_ON_OPT_NEG(unset);
+
+	val = strtol(arg, &s, 10);
+	if (!*arg || *s)
+		return error(_("--%s expects a numerical value"), opt->long_name);
+	if (val < 0)
+		return error(_("--%s expects a non-negative integer"), opt->long_name);
+	*limit = val;
+	return 0;
+}
+
 static int diff_opt_diff_algorithm(const struct option *opt,
 				   const char *arg, int unset)
 {
@@ -6184,6 +6359,9 @@ struct option *add_diff_options(const struct option *opts,
 			       PARSE_OPT_NOARG, diff_opt_follow),
 		OPT_INTEGER('l', NULL, &options->rename_limit,
 			    N_("prevent rename/copy detection if the number of rename/copy targets exceeds given limit")),
+		OPT_CALLBACK_F(0, "rename-candidates", options, N_("<mode>"),
+			       N_("how to pick rename/copy candidates beyond the limit"),
+			       PARSE_OPT_NONEG, diff_opt_rename_candidates),
 
 		OPT_GROUP(N_("Diff algorithm options")),
 		OPT_CALLBACK_F(0, "minimal", options, NULL,
@@ -6225,6 +6403,12 @@ struct option *add_diff_options(const struct option *opts,
 		OPT_CALLBACK_F(0, "anchored", options, N_("<text>"),
 			       N_("generate diff using the \"anchored diff\" algorithm"),
 			       PARSE_OPT_NONEG, diff_opt_anchored),
+		OPT_CALLBACK_F(0, "split-lines", &options->xdl_split_lines, N_("<n>"),
+			       N_("diff files longer than <n> lines piecewise between unique lines"),
+			       PARSE_OPT_NONEG, diff_opt_xdl_limit),
+		OPT_CALLBACK_F(0, "max-cost", &options->xdl_max_cost, N_("<n>"),
+			       N_("limit the edits the myers algorithm considers before it settles"),
+			       PARSE_OPT_NONEG, diff_opt_xdl_limit),
 		OPT_CALLBACK_F(0, "word-diff", options, N_("<mode>"),
 			       N_("show word diff, using <mode> to delimit changed words"),
 			       PARSE_OPT_NONEG | PARSE_OPT_OPTARG, diff_opt_word_diff),
@@ -7093,9 +7277,237 @@ static void create_filepairs_for_header_only_notifications(struct diff_options *
 	strset_clear(&present);
 }
 
-static void diff_flush_patch_all_file_pairs(struct diff_options *o)
+struct patch_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	int stop;
+
+	/* FIFO of deferred jobs not yet picked up by a worker */
+	struct diff_patch_job **todo;
+	size_t todo_nr, todo_alloc, todo_pos;
+
+	pthread_t *threads;
+	int nr_threads;
+};
+
+static void *patch_worker(void *data)
 {
+	struct patch_pool *pool = data;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		struct diff_patch_job *job;
+		int failed;
+
+		while (!pool->stop && pool->todo_pos == pool->todo_nr)
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+		if (pool->todo_pos == pool->todo_nr)
+			break;
+		job = pool->todo[pool->todo_pos++];
+		pthread_mutex_unlock(&pool->mutex);
+
+		failed = !!xdi_diff_outf(&job->mf1, &job->mf2, NULL,
+					 fn_out_consume, &job->ecbdata,
+					 &job->xpp, &job->xecfg);
+
+		pthread_mutex_lock(&pool->mutex);
+		job->failed = failed;
+		job->done = 1;
+		pthread_cond_broadcast(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+static void patch_pool_start(struct patch_pool *pool, int nr_threads)
+{
+	int i, err;
+
+	memset(pool, 0, sizeof(*pool));
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	CALLOC_ARRAY(pool->threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		err = pthread_create(&pool->threads[i], NULL, patch_worker, pool);
+		if (err)
+			die(_("unable to create diff thread: %s"), strerror(err));
+		pool->nr_threads++;
+	}
+}
+
+static void patch_pool_stop(struct patch_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->nr_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+	free(pool->threads);
+	free(pool->todo);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_mutex_destroy(&pool->mutex);
+}
+
+static void patch_pool_add(struct patch_pool *pool, struct diff_patch_job *job)
+{
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->todo_pos == pool->todo_nr)
+		pool->todo_pos = pool->todo_nr = 0;
+	ALLOC_GROW(pool->todo, pool->todo_nr + 1, pool->todo_alloc);
+	pool->todo[pool->todo_nr++] = job;
+	pthread_cond_signal(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+/* Wait for "job" if needed, write out its symbols and free it. */
+static void patch_pool_flush(struct patch_pool *pool,
+			     struct diff_options *o,
+			     struct diff_patch_job *job)
+{
+	int i;
+
+	if (job->deferred) {
+		pthread_mutex_lock(&pool->mutex);
+		while (!job->done)
+			pthread_cond_wait(&pool->done_cond, &pool->mutex);
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (job->failed)
+			die("unable to generate diff for %s", job->path);
+		if (job->opt.found_changes)
+			o->found_changes = 1;
+	}
+
+	for (i = 0; i < job->symbols.nr; i++) {
+		emit_diff_symbol_from_struct(o, &job->symbols.buf[i]);
+		free((void *)job->symbols.buf[i].line);
+	}
+	free(job->symbols.buf);
+
+	if (job->deferred) {
+		free(job->mf1.ptr);
+		free(job->mf2.ptr);
+		free(job->labels[0]);
+		free(job->labels[1]);
+		strbuf_release(&job->header);
+		xdiff_clear_find_func(&job->xecfg);
+		free(job->path);
+	}
+	free(job);
+}
+
+/*
+ * Pairs whose output does not go through emit_diff_symbol() have to be
+ * shown after everything before them has been flushed.
+ */
+static int diff_pair_writes_directly(struct diff_options *o,
+				     struct diff_filepair *p)
+{
+	struct userdiff_driver *drv;
+
+	if (DIFF_PAIR_UNMERGED(p))
+		return 1;
+	if (o->submodule_format != DIFF_SUBMODULE_SHORT &&
+	    (S_ISGITLINK(p->one->mode) || S_ISGITLINK(p->two->mode)))
+		return 1;
+	if (!o->flags.allow_external)
+		return 0;
+	if (external_diff())
+		return 1;
+	drv = userdiff_find_by_path(o->repo->index, p->one->path);
+	return drv && drv->external.cmd;
+}
+
+static int diff_patch_threads(struct diff_options *o,
+			      struct diff_queue_struct *q)
+{
+	int nr_threads = diff_threads ? diff_threads : online_cpus();
+
+	if (!HAVE_THREADS || nr_threads < 2 || q->nr < 2)
+		return 1;
+
+	/* these all emit outside of builtin_diff() or from shared state */
+	if (!o->file || o->emitted_symbols || o->word_diff ||
+	    o->output_prefix || o->ignore_regex_nr)
+		return 1;
+
+	return nr_threads;
+}
+
+static void diff_flush_patch_threaded(struct diff_options *o,
+				      struct diff_queue_struct *q,
+				      int nr_threads)
+{
+	struct patch_pool pool;
+	struct diff_patch_job **window;
+	int window_size = 4 * nr_threads, first = 0, nr = 0;
 	int i;
+
+	trace2_region_enter("diff", "flush_patch_threaded", o->repo);
+	trace2_data_intmax("diff", o->repo, "patch_threads", nr_threads);
+
+	patch_pool_start(&pool, nr_threads);
+	ALLOC_ARRAY(window, window_size);
+
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+		struct diff_patch_job *job;
+
+		if (!check_pair_status(p))
+			continue;
+
+		if (diff_pair_writes_directly(o, p)) {
+			for (; nr; nr--, first = (first + 1) % window_size)
+				patch_pool_flush(&pool, o, window[first]);
+			diff_flush_patch(p, o);
+			continue;
+		}
+
+		if (nr == window_size) {
+			patch_pool_flush(&pool, o, window[first]);
+			first = (first + 1) % window_size;
+			nr--;
+		}
+
+		CALLOC_ARRAY(job, 1);
+		o->emitted_symbols = &job->symbols;
+		/*
+		 * A pair that changes type is shown as a deletion and a
+		 * creation, which are too many diffs for one job; diff
+		 * those here, but still into the buffer.
+		 */
+		if (!DIFF_FILE_VALID(p->one) || !DIFF_FILE_VALID(p->two) ||
+		    !((p->one->mode ^ p->two->mode) & S_IFMT))
+			o->patch_job = job;
+		diff_flush_patch(p, o);
+		o->emitted_symbols = NULL;
+		o->patch_job = NULL;
+
+		if (job->deferred)
+			patch_pool_add(&pool, job);
+		window[(first + nr++) % window_size] = job;
+	}
+
+	for (; nr; nr--, first = (first + 1) % window_size)
+		patch_pool_flush(&pool, o, window[first]);
+
+	free(window);
+	patch_pool_stop(&pool);
+	trace2_region_leave("diff", "flush_patch_threaded", o->repo);
+}
+
+static void diff_flush_patch_all_file_pairs(struct diff_options *o)
+{
+	int i, nr_threads;
 	static struct emitted_diff_symbols esm = EMITTED_DIFF_SYMBOLS_INIT;
 	struct diff_queue_struct *q = &diff_queued_diff;
 
@@ -7108,6 +7520,12 @@ static void diff_flush_patch_all_file_pairs(struct diff_options *o)
 	if (o->additional_path_headers)
 		create_filepairs_for_header_only_notifications(o);
 
+	nr_threads = diff_patch_threads(o, q);
+	if (nr_threads > 1) {
+		diff_flush_patch_threaded(o, q, nr_threads);
+		return;
+	}
+
 	for (i = 0; i < q->nr; i++) {
 		struct diff_filepair *p = q->queue[i];
 		if (check_pair_status(p))
@@ -317,6 +317,15 @@ struct diff_options {
 	int rename_score;
 	int rename_limit;
 
+	/*
+	 * Beyond rename_limit, only score the pairs that a locality
+	 * sensitive hash picks, instead of skipping inexact detection.
+	 */
+	int approximate_renames;
+
+	/* Threads for inexact rename detection, or 0 to choose automatically. */
+	int rename_threads;
+
 	int needed_rename_limit;
 	int degraded_cc_to_c;
 	int show_rename_progress;
@@ -345,6 +354,10 @@ struct diff_options {
 	char **anchors;
 	size_t anchors_nr, anchors_alloc;
 
+	/* see diff.splitLines and diff.maxCost */
+	long xdl_split_lines;
+	long xdl_max_cost;
+
 	int stat_width;
 	int stat_name_width;
 	int stat_graph_width;
@@ -393,6 +406,8 @@ struct diff_options {
 	int diff_path_counter;
 
 	struct emitted_diff_symbols *emitted_symbols;
+	/* see diff_flush_patch_all_file_pairs() */
+	struct diff_patch_job *patch_job;
 	enum {
 		COLOR_MOVED_NO = 0,
 		COLOR_MOVED_PLAIN = 1,
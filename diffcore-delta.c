@@ -166,6 +166,43 @@ static struct spanhash_top *hash_chars(struct repository *r,
 	return hash;
 }
 
+void diffcore_fill_count_data(struct repository *r,
+			      struct diff_filespec *one)
+{
+	if (!one->cnt_data)
+		one->cnt_data = hash_chars(r, one);
+}
+
+/*
+ * MinHash of the set of spans in a signature: for each of "nr" hash
+ * functions, the smallest value it takes over the set.  Two signatures
+ * agree on any one of these with a probability equal to the Jaccard
+ * similarity of their sets of spans.
+ */
+void diffcore_minhash(const void *cnt_data, uint32_t *minhash, int nr)
+{
+	const struct spanhash_top *top = cnt_data;
+	const struct spanhash *s;
+	int i;
+
+	for (i = 0; i < nr; i++)
+		minhash[i] = UINT32_MAX;
+
+	/* the data is sorted by hashval, with unused slots at the end */
+	for (s = top->data; s->cnt; s++) {
+		for (i = 0; i < nr; i++) {
+			uint32_t h = (s->hashval + 1) * 0x9e3779b1u;
+
+			h ^= (uint32_t)i * 0x85ebca6bu + 0x7f4a7c15u;
+			h ^= h >> 15;
+			h *= 0x2c1b3c6du;
+			h ^= h >> 12;
+			if (h < minhash[i])
+				minhash[i] = h;
+		}
+	}
+}
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
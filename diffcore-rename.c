@@ -6,8 +6,10 @@
 #define USE_THE_REPOSITORY_VARIABLE
 
 #include "git-compat-util.h"
+#include "config.h"
 #include "diff.h"
 #include "diffcore.h"
+#include "gettext.h"
 #include "object-file.h"
 #include "hashmap.h"
 #include "mem-pool.h"
@@ -16,6 +18,7 @@
 #include "promisor-remote.h"
 #include "string-list.h"
 #include "strmap.h"
+#include "thread-utils.h"
 #include "trace2.h"
 
 /* Table of rename/copy destinations */
@@ -1156,6 +1159,485 @@ static int find_renames(struct diff_score *mx,
 	return count;
 }
 
+/*
+ * Inexact rename detection can be split across threads. It is done in
+ * two passes so that the result does not depend on the number of
+ * threads:
+ *
+ *  1. Read every file that can be part of a pair that passes the size
+ *     check and compute its signature (cnt_data). Reading objects and
+ *     looking up attributes is not thread-safe, so that part is done
+ *     under "mutex"; only the hashing runs in parallel.
+ *
+ *  2. Score the matrix one destination row at a time. A row only
+ *     reads the signatures and is scored in the same order as by the
+ *     single-threaded loop, so it picks the same candidates.
+ */
+#define RENAME_THREAD_MIN_PAIRS (10000)
+
+struct rename_matrix {
+	struct repository *repo;
+	struct diff_populate_filespec_options *dpf_opt;
+	int minimum_score;
+	int skip_unmodified;
+
+	/* pass 1: the files to hash */
+	struct diff_filespec **specs;
+	int specs_nr;
+
+	/* pass 2: rename_dst index of each row, and the matrix */
+	int *rows;
+	int rows_nr;
+	struct diff_score *mx;
+
+	/* if not NULL, the only rename_src indices to score for each row */
+	struct lsh_candidates *candidates;
+
+	pthread_mutex_t mutex;
+	int next; /* next spec or row to take, under mutex */
+	struct progress *progress;
+	uint64_t progress_unit;
+	int rows_done;
+};
+
+/*
+ * Instead of scoring every pair, approximate mode only scores the pairs
+ * proposed by a locality-sensitive hash of the signatures: LSH_BANDS
+ * groups of LSH_ROWS MinHash values each. A source is a candidate for a
+ * destination if all values of at least one band agree, which is likely
+ * for files that share most of their spans and unlikely otherwise.
+ *
+ * Bands shared by more than LSH_MAX_BUCKET sources carry little
+ * information (e.g. very short or boilerplate files) and are ignored to
+ * keep the work linear.
+ */
+#define LSH_BANDS 16
+#define LSH_ROWS 2
+#define LSH_MAX_BUCKET 64
+
+struct lsh_candidates {
+	int *src;
+	int nr, alloc;
+};
+
+struct lsh_entry {
+	uint64_t key;
+	int src;
+};
+
+static uint64_t lsh_band_key(const uint32_t *minhash, int band)
+{
+	uint64_t key = band;
+	int i;
+
+	for (i = 0; i < LSH_ROWS; i++)
+		key = (key ^ minhash[band * LSH_ROWS + i]) * 0x100000001b3ull;
+	return key;
+}
+
+static int lsh_entry_compare(const void *a_, const void *b_)
+{
+	const struct lsh_entry *a = a_, *b = b_;
+
+	if (a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+	return a->src < b->src ? -1 : a->src > b->src;
+}
+
+static int int_compare(const void *a_, const void *b_)
+{
+	int a = *(const int *)a_, b = *(const int *)b_;
+	return a < b ? -1 : a > b;
+}
+
+static void find_lsh_candidates(struct rename_matrix *rm)
+{
+	struct lsh_entry *entries;
+	size_t entries_nr = 0, total = 0;
+	uint32_t minhash[LSH_BANDS * LSH_ROWS];
+	int i, band;
+
+	ALLOC_ARRAY(entries, st_mult(rename_src_nr, LSH_BANDS));
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+
+		if (!one->cnt_data ||
+		    (rm->skip_unmodified && diff_unmodified_pair(rename_src[i].p)))
+			continue;
+		diffcore_minhash(one->cnt_data, minhash, ARRAY_SIZE(minhash));
+		for (band = 0; band < LSH_BANDS; band++) {
+			entries[entries_nr].key = lsh_band_key(minhash, band);
+			entries[entries_nr].src = i;
+			entries_nr++;
+		}
+	}
+	QSORT(entries, entries_nr, lsh_entry_compare);
+
+	CALLOC_ARRAY(rm->candidates, rm->rows_nr);
+	for (i = 0; i < rm->rows_nr; i++) {
+		struct diff_filespec *two = rename_dst[rm->rows[i]].p->two;
+		struct lsh_candidates *c = &rm->candidates[i];
+		int j, k;
+
+		if (!two->cnt_data)
+			continue;
+		diffcore_minhash(two->cnt_data, minhash, ARRAY_SIZE(minhash));
+		for (band = 0; band < LSH_BANDS; band++) {
+			uint64_t key = lsh_band_key(minhash, band);
+			size_t lo = 0, hi = entries_nr, end;
+
+			while (lo < hi) {
+				size_t mid = lo + (hi - lo) / 2;
+				if (entries[mid].key < key)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			for (end = lo; end < entries_nr && entries[end].key == key; end++)
+				; /* find the end of the bucket */
+			if (end - lo > LSH_MAX_BUCKET)
+				continue;
+			ALLOC_GROW(c->src, c->nr + (int)(end - lo), c->alloc);
+			for (; lo < end; lo++)
+				c->src[c->nr++] = entries[lo].src;
+		}
+
+		/* score in the same order as the exhaustive loop */
+		QSORT(c->src, c->nr, int_compare);
+		for (j = k = 0; j < c->nr; j++)
+			if (!k || c->src[k - 1] != c->src[j])
+				c->src[k++] = c->src[j];
+		c->nr = k;
+		total += k;
+	}
+	free(entries);
+
+	trace2_data_intmax("diff", rm->repo, "rename/lsh_candidates", total);
+}
+
+static int rename_threads(struct diff_options *options,
+			  int num_destinations, int num_sources)
+{
+	if (!HAVE_THREADS)
+		return 1;
+	if (options->rename_threads > 0)
+		return options->rename_threads;
+
+	if (st_mult(num_destinations, num_sources) < RENAME_THREAD_MIN_PAIRS)
+		return 1;
+	return online_cpus();
+}
+
+static int sizes_compatible(unsigned long a, unsigned long b,
+			    int minimum_score)
+{
+	unsigned long max_size = a > b ? a : b;
+	unsigned long delta_size = max_size - (a < b ? a : b);
+
+	/* the same test as in estimate_similarity() */
+	return !(max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE);
+}
+
+/*
+ * Is there a size in the sorted array "sizes" that passes the size
+ * check against "size"? The sizes that pass form an interval around
+ * "size", so checking the closest one on either side is enough.
+ */
+static int has_compatible_size(unsigned long *sizes, int nr,
+			       unsigned long size, int minimum_score)
+{
+	int lo = 0, hi = nr;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (sizes[mid] < size)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo < nr && sizes_compatible(size, sizes[lo], minimum_score)) ||
+	       (lo > 0 && sizes_compatible(size, sizes[lo - 1], minimum_score));
+}
+
+static int ulong_compare(const void *a_, const void *b_)
+{
+	unsigned long a = *(const unsigned long *)a_;
+	unsigned long b = *(const unsigned long *)b_;
+	return a < b ? -1 : a > b;
+}
+
+static int spec_ptr_compare(const void *a_, const void *b_)
+{
+	const struct diff_filespec *a = *(const struct diff_filespec **)a_;
+	const struct diff_filespec *b = *(const struct diff_filespec **)b_;
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * A regular file whose size could be read, or NULL. Like in
+ * estimate_similarity(), a file that already has a signature also has
+ * its size.
+ */
+static struct diff_filespec *sized_regular_file(struct rename_matrix *rm,
+						struct diff_filespec *spec)
+{
+	if (!S_ISREG(spec->mode))
+		return NULL;
+	if (spec->cnt_data)
+		return spec;
+	rm->dpf_opt->check_size_only = 1;
+	if (diff_populate_filespec(rm->repo, spec, rm->dpf_opt))
+		return NULL;
+	return spec;
+}
+
+static void collect_specs_to_hash(struct rename_matrix *rm)
+{
+	struct diff_filespec **srcs, **dsts;
+	unsigned long *src_sizes, *dst_sizes;
+	int srcs_nr = 0, dsts_nr = 0, i, j;
+
+	ALLOC_ARRAY(srcs, rename_src_nr);
+	ALLOC_ARRAY(dsts, rm->rows_nr);
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+
+		if (rm->skip_unmodified &&
+		    diff_unmodified_pair(rename_src[i].p))
+			continue;
+		if ((one = sized_regular_file(rm, one)))
+			srcs[srcs_nr++] = one;
+	}
+	for (i = 0; i < rm->rows_nr; i++) {
+		struct diff_filespec *two = rename_dst[rm->rows[i]].p->two;
+
+		if ((two = sized_regular_file(rm, two)))
+			dsts[dsts_nr++] = two;
+	}
+
+	ALLOC_ARRAY(src_sizes, srcs_nr);
+	for (i = 0; i < srcs_nr; i++)
+		src_sizes[i] = srcs[i]->size;
+	QSORT(src_sizes, srcs_nr, ulong_compare);
+	ALLOC_ARRAY(dst_sizes, dsts_nr);
+	for (i = 0; i < dsts_nr; i++)
+		dst_sizes[i] = dsts[i]->size;
+	QSORT(dst_sizes, dsts_nr, ulong_compare);
+
+	ALLOC_ARRAY(rm->specs, st_add(srcs_nr, dsts_nr));
+	for (i = 0; i < srcs_nr; i++)
+		if (!srcs[i]->cnt_data &&
+		    has_compatible_size(dst_sizes, dsts_nr, srcs[i]->size,
+					rm->minimum_score))
+			rm->specs[rm->specs_nr++] = srcs[i];
+	for (i = 0; i < dsts_nr; i++)
+		if (!dsts[i]->cnt_data &&
+		    has_compatible_size(src_sizes, srcs_nr, dsts[i]->size,
+					rm->minimum_score))
+			rm->specs[rm->specs_nr++] = dsts[i];
+
+	/* the same filespec may be used by more than one pair */
+	QSORT(rm->specs, rm->specs_nr, spec_ptr_compare);
+	for (i = j = 0; i < rm->specs_nr; i++)
+		if (!j || rm->specs[j - 1] != rm->specs[i])
+			rm->specs[j++] = rm->specs[i];
+	rm->specs_nr = j;
+
+	free(srcs);
+	free(dsts);
+	free(src_sizes);
+	free(dst_sizes);
+}
+
+static void *hash_specs_thread(void *data)
+{
+	struct rename_matrix *rm = data;
+
+	pthread_mutex_lock(&rm->mutex);
+	while (rm->next < rm->specs_nr) {
+		struct diff_filespec *spec = rm->specs[rm->next++];
+
+		rm->dpf_opt->check_size_only = 0;
+		if (diff_populate_filespec(rm->repo, spec, rm->dpf_opt))
+			continue;
+		/* cache it, hashing needs to know */
+		diff_filespec_is_binary(rm->repo, spec);
+		pthread_mutex_unlock(&rm->mutex);
+
+		diffcore_fill_count_data(rm->repo, spec);
+
+		pthread_mutex_lock(&rm->mutex);
+		diff_free_filespec_blob(spec);
+	}
+	pthread_mutex_unlock(&rm->mutex);
+
+	return NULL;
+}
+
+/*
+ * estimate_similarity() for two files whose signatures have been
+ * computed by hash_specs_thread(), if they are needed.
+ */
+static int estimate_similarity_hashed(struct repository *r,
+				      struct diff_filespec *src,
+				      struct diff_filespec *dst,
+				      int minimum_score)
+{
+	unsigned long max_size, src_copied, literal_added;
+
+	if (!S_ISREG(src->mode) || !S_ISREG(dst->mode))
+		return 0;
+	if (!src->cnt_data || !dst->cnt_data)
+		return 0; /* failed to read, or failed the size check */
+	if (!sizes_compatible(src->size, dst->size, minimum_score))
+		return 0;
+
+	max_size = ((src->size > dst->size) ? src->size : dst->size);
+	if (diffcore_count_changes(r, src, dst,
+				   &src->cnt_data, &dst->cnt_data,
+				   &src_copied, &literal_added))
+		return 0;
+
+	if (!dst->size)
+		return 0; /* should not happen */
+	return (int)(src_copied * MAX_SCORE / max_size);
+}
+
+static void *score_rows_thread(void *data)
+{
+	struct rename_matrix *rm = data;
+	int row, j, nr;
+
+	for (;;) {
+		struct diff_filespec *two;
+		struct diff_score *m;
+
+		pthread_mutex_lock(&rm->mutex);
+		row = rm->next++;
+		pthread_mutex_unlock(&rm->mutex);
+		if (row >= rm->rows_nr)
+			break;
+
+		two = rename_dst[rm->rows[row]].p->two;
+		m = &rm->mx[row * NUM_CANDIDATE_PER_DST];
+		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+			m[j].dst = -1;
+
+		nr = rm->candidates ? rm->candidates[row].nr : rename_src_nr;
+		for (j = 0; j < nr; j++) {
+			int src = rm->candidates ? rm->candidates[row].src[j] : j;
+			struct diff_filespec *one = rename_src[src].p->one;
+			struct diff_score this_src;
+
+			if (rm->skip_unmodified &&
+			    diff_unmodified_pair(rename_src[src].p))
+				continue;
+
+			this_src.score = estimate_similarity_hashed(rm->repo,
+								    one, two,
+								    rm->minimum_score);
+			this_src.name_score = basename_same(one, two);
+			this_src.dst = rm->rows[row];
+			this_src.src = src;
+			record_if_better(m, &this_src);
+		}
+
+		pthread_mutex_lock(&rm->mutex);
+		rm->rows_done++;
+		display_progress(rm->progress,
+				 (uint64_t)rm->rows_done * rm->progress_unit);
+		pthread_mutex_unlock(&rm->mutex);
+	}
+
+	return NULL;
+}
+
+static void run_rename_threads(struct rename_matrix *rm, int nr_threads,
+			       void *(*fn)(void *))
+{
+	pthread_t *threads;
+	int t, err;
+
+	rm->next = 0;
+	if (nr_threads <= 1) {
+		fn(rm);
+		return;
+	}
+	ALLOC_ARRAY(threads, nr_threads);
+	for (t = 0; t < nr_threads; t++) {
+		err = pthread_create(&threads[t], NULL, fn, rm);
+		if (err)
+			die(_("unable to create rename thread: %s"),
+			    strerror(err));
+	}
+	for (t = 0; t < nr_threads; t++)
+		pthread_join(threads[t], NULL);
+	free(threads);
+}
+
+/*
+ * Fill "mx" like the loop in diffcore_rename_extended() does, using
+ * "nr_threads" threads. With "approximate", only the pairs proposed by
+ * find_lsh_candidates() are scored. Returns the number of rows.
+ */
+static int score_renames_threaded(struct repository *r,
+				  struct diff_score *mx,
+				  int minimum_score,
+				  int skip_unmodified,
+				  struct diff_populate_filespec_options *dpf_opt,
+				  struct progress *progress,
+				  int num_sources,
+				  int nr_threads,
+				  int approximate)
+{
+	struct rename_matrix rm = {
+		.repo = r,
+		.dpf_opt = dpf_opt,
+		.minimum_score = minimum_score,
+		.skip_unmodified = skip_unmodified,
+		.mx = mx,
+		.progress = progress,
+		.progress_unit = num_sources,
+	};
+	int i;
+
+	ALLOC_ARRAY(rm.rows, rename_dst_nr);
+	for (i = 0; i < rename_dst_nr; i++)
+		if (!rename_dst[i].is_rename)
+			rm.rows[rm.rows_nr++] = i;
+
+	pthread_mutex_init(&rm.mutex, NULL);
+
+	trace2_region_enter("diff", "inexact renames: hash", r);
+	collect_specs_to_hash(&rm);
+	run_rename_threads(&rm, nr_threads, hash_specs_thread);
+	trace2_region_leave("diff", "inexact renames: hash", r);
+
+	if (approximate)
+		find_lsh_candidates(&rm);
+
+	trace2_region_enter("diff", "inexact renames: score", r);
+	run_rename_threads(&rm, nr_threads, score_rows_thread);
+	trace2_region_leave("diff", "inexact renames: score", r);
+
+	/* We do not need the text anymore; see the single-threaded loop. */
+	for (i = 0; i < rename_src_nr; i++)
+		if (!skip_unmodified || !diff_unmodified_pair(rename_src[i].p))
+			diff_free_filespec_blob(rename_src[i].p->one);
+	for (i = 0; i < rm.rows_nr; i++)
+		diff_free_filespec_blob(rename_dst[rm.rows[i]].p->two);
+
+	pthread_mutex_destroy(&rm.mutex);
+	if (rm.candidates) {
+		for (i = 0; i < rm.rows_nr; i++)
+			free(rm.candidates[i].src);
+		free(rm.candidates);
+	}
+	free(rm.specs);
+	free(rm.rows);
+	return rm.rows_nr;
+}
+
 static void remove_unneeded_paths_from_src(int detecting_copies,
 					   struct strintmap *interesting)
 {
@@ -1392,6 +1874,7 @@ void diffcore_rename_extended(struct diff_options *options,
 	int i, j, rename_count, skip_unmodified = 0;
 	int num_destinations, dst_cnt;
 	int num_sources, want_copies;
+	int nr_threads, approximate = 0;
 	struct progress *progress = NULL;
 	struct mem_pool local_pool;
 	struct dir_rename_info info;
@@ -1555,7 +2038,12 @@ void diffcore_rename_extended(struct diff_options *options,
 	switch (too_many_rename_candidates(num_destinations, num_sources,
 					   options)) {
 	case 1:
-		goto cleanup;
+		if (!options->approximate_renames)
+			goto cleanup;
+		/* not skipped, so there is nothing to warn about */
+		options->needed_rename_limit = 0;
+		approximate = 1;
+		break;
 	case 2:
 		options->degraded_cc_to_c = 1;
 		skip_unmodified = 1;
@@ -1580,45 +2068,53 @@ void diffcore_rename_extended(struct diff_options *options,
 	}
 
 	CALLOC_ARRAY(mx, st_mult(NUM_CANDIDATE_PER_DST, num_destinations));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].p->two;
-		struct diff_score *m;
-
-		if (rename_dst[i].is_rename)
-			continue; /* exact or basename match already handled */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			assert(!one->rename_used || want_copies || break_idx);
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(options->repo,
-							     one, two,
-							     minimum_score,
-							     &dpf_options);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
+	nr_threads = rename_threads(options, num_destinations, num_sources);
+	if (nr_threads > 1 || approximate) {
+		dst_cnt = score_renames_threaded(options->repo, mx, minimum_score,
+						 skip_unmodified, &dpf_options,
+						 progress, num_sources,
+						 nr_threads, approximate);
+	} else {
+		for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
+			struct diff_filespec *two = rename_dst[i].p->two;
+			struct diff_score *m;
+
+			if (rename_dst[i].is_rename)
+				continue; /* exact or basename match already handled */
+
+			m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
+			for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+				m[j].dst = -1;
+
+			for (j = 0; j < rename_src_nr; j++) {
+				struct diff_filespec *one = rename_src[j].p->one;
+				struct diff_score this_src;
+
+				assert(!one->rename_used || want_copies || break_idx);
+
+				if (skip_unmodified &&
+				    diff_unmodified_pair(rename_src[j].p))
+					continue;
+
+				this_src.score = estimate_similarity(options->repo,
+								     one, two,
+								     minimum_score,
+								     &dpf_options);
+				this_src.name_score = basename_same(one, two);
+				this_src.dst = i;
+				this_src.src = j;
+				record_if_better(m, &this_src);
+				/*
+				 * Once we run estimate_similarity,
+				 * We do not need the text anymore.
+				 */
+				diff_free_filespec_blob(one);
+				diff_free_filespec_blob(two);
+			}
+			dst_cnt++;
+			display_progress(progress,
+					 (uint64_t)dst_cnt * (uint64_t)num_sources);
 		}
-		dst_cnt++;
-		display_progress(progress,
-				 (uint64_t)dst_cnt * (uint64_t)num_sources);
 	}
 	stop_progress(&progress);
 
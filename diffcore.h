@@ -233,6 +233,22 @@ void diff_debug_queue(const char *, struct diff_queue_struct *);
 #define diff_debug_queue(a,b) do { /* nothing */ } while (0)
 #endif
 
+/*
+ * Compute the signature diffcore_count_changes() uses for "one" and
+ * keep it in "one->cnt_data". The data of "one" must be populated and
+ * diff_filespec_is_binary() must have been called on it, so that this
+ * can be called from several threads for different filespecs.
+ */
+void diffcore_fill_count_data(struct repository *r,
+			      struct diff_filespec *one);
+
+/*
+ * Compute "nr" MinHash values of the signature "cnt_data" computed by
+ * diffcore_fill_count_data(), to find similar files without comparing
+ * every pair.
+ */
+void diffcore_minhash(const void *cnt_data, uint32_t *minhash, int nr);
+
 int diffcore_count_changes(struct repository *r,
 			   struct diff_filespec *src,
 			   struct diff_filespec *dst,
@@ -0,0 +1,208 @@
+#include "git-compat-util.h"
+#include "dir.h"
+#include "dir-prefetch.h"
+#include "gettext.h"
+#include "statinfo.h"
+#include "strmap.h"
+#include "thread-utils.h"
+
+enum prefetch_state {
+	PREFETCH_QUEUED,
+	PREFETCH_RUNNING,
+	PREFETCH_DONE,
+	/* taken over by dir_prefetch_get() before a worker started it */
+	PREFETCH_CANCELLED,
+};
+
+struct prefetch_job {
+	enum prefetch_state state;
+	struct dir_prefetch_listing *listing;
+	char path[FLEX_ARRAY];
+};
+
+struct dir_prefetch {
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	int stop;
+
+	/* queued or finished jobs that have not been consumed, by path */
+	struct strmap pending;
+
+	/* LIFO of jobs for the workers; may contain cancelled jobs */
+	struct prefetch_job **stack;
+	size_t stack_nr, stack_alloc;
+
+	/* every job ever created, freed by dir_prefetch_stop() */
+	struct prefetch_job **jobs;
+	size_t jobs_nr, jobs_alloc;
+
+	pthread_t *threads;
+	int nr_threads;
+};
+
+static struct dir_prefetch_listing *read_listing(const char *path)
+{
+	struct dir_prefetch_listing *l;
+	struct dirent *de;
+	DIR *fdir;
+
+	CALLOC_ARRAY(l, 1);
+	strbuf_init(&l->names, 0);
+
+	fdir = opendir(path);
+	if (!fdir) {
+		l->err = errno;
+		return l;
+	}
+	while ((de = readdir_skip_dot_and_dotdot(fdir))) {
+		ALLOC_GROW(l->entries, l->nr + 1, l->alloc);
+		l->entries[l->nr].name_offset = l->names.len;
+		l->entries[l->nr].d_type = DTYPE(de);
+		l->nr++;
+		strbuf_add(&l->names, de->d_name, strlen(de->d_name) + 1);
+	}
+	closedir(fdir);
+	return l;
+}
+
+void dir_prefetch_listing_free(struct dir_prefetch_listing *l)
+{
+	if (!l)
+		return;
+	strbuf_release(&l->names);
+	free(l->entries);
+	free(l);
+}
+
+static void *prefetch_worker(void *data)
+{
+	struct dir_prefetch *p = data;
+
+	pthread_mutex_lock(&p->mutex);
+	for (;;) {
+		struct prefetch_job *job;
+
+		while (!p->stop && !p->stack_nr)
+			pthread_cond_wait(&p->work_cond, &p->mutex);
+		if (p->stop)
+			break;
+
+		job = p->stack[--p->stack_nr];
+		if (job->state != PREFETCH_QUEUED)
+			continue;
+		job->state = PREFETCH_RUNNING;
+		pthread_mutex_unlock(&p->mutex);
+
+		job->listing = read_listing(job->path);
+
+		pthread_mutex_lock(&p->mutex);
+		job->state = PREFETCH_DONE;
+		pthread_cond_broadcast(&p->done_cond);
+	}
+	pthread_mutex_unlock(&p->mutex);
+
+	return NULL;
+}
+
+struct dir_prefetch *dir_prefetch_start(int nr_threads)
+{
+	struct dir_prefetch *p;
+	int i, err;
+
+	if (!HAVE_THREADS || nr_threads < 2)
+		return NULL;
+
+	CALLOC_ARRAY(p, 1);
+	pthread_mutex_init(&p->mutex, NULL);
+	pthread_cond_init(&p->work_cond, NULL);
+	pthread_cond_init(&p->done_cond, NULL);
+	strmap_init(&p->pending);
+
+	CALLOC_ARRAY(p->threads, nr_threads);
+	for (i = 0; i < nr_threads; i++) {
+		err = pthread_create(&p->threads[i], NULL, prefetch_worker, p);
+		if (err)
+			die(_("unable to create dir prefetch thread: %s"),
+			    strerror(err));
+		p->nr_threads++;
+	}
+
+	return p;
+}
+
+void dir_prefetch_queue(struct dir_prefetch *p, const char *path)
+{
+	struct prefetch_job *job;
+
+	pthread_mutex_lock(&p->mutex);
+	if (!strmap_contains(&p->pending, path)) {
+		FLEX_ALLOC_STR(job, path, path);
+		job->state = PREFETCH_QUEUED;
+		strmap_put(&p->pending, path, job);
+
+		ALLOC_GROW(p->jobs, p->jobs_nr + 1, p->jobs_alloc);
+		p->jobs[p->jobs_nr++] = job;
+		ALLOC_GROW(p->stack, p->stack_nr + 1, p->stack_alloc);
+		p->stack[p->stack_nr++] = job;
+		pthread_cond_signal(&p->work_cond);
+	}
+	pthread_mutex_unlock(&p->mutex);
+}
+
+struct dir_prefetch_listing *dir_prefetch_get(struct dir_prefetch *p,
+					      const char *path)
+{
+	struct dir_prefetch_listing *listing = NULL;
+	struct prefetch_job *job;
+
+	pthread_mutex_lock(&p->mutex);
+	job = strmap_get(&p->pending, path);
+	if (job) {
+		strmap_remove(&p->pending, path, 0);
+		if (job->state == PREFETCH_QUEUED) {
+			/* It is faster to read it ourselves than to wait. */
+			job->state = PREFETCH_CANCELLED;
+		} else {
+			while (job->state != PREFETCH_DONE)
+				pthread_cond_wait(&p->done_cond, &p->mutex);
+			listing = job->listing;
+			job->listing = NULL;
+		}
+	}
+	pthread_mutex_unlock(&p->mutex);
+
+	if (!listing)
+		listing = read_listing(path);
+	return listing;
+}
+
+void dir_prefetch_stop(struct dir_prefetch *p)
+{
+	size_t i;
+	int t;
+
+	if (!p)
+		return;
+
+	pthread_mutex_lock(&p->mutex);
+	p->stop = 1;
+	pthread_cond_broadcast(&p->work_cond);
+	pthread_mutex_unlock(&p->mutex);
+
+	for (t = 0; t < p->nr_threads; t++)
+		pthread_join(p->threads[t], NULL);
+
+	for (i = 0; i < p->jobs_nr; i++) {
+		dir_prefetch_listing_free(p->jobs[i]->listing);
+		free(p->jobs[i]);
+	}
+	free(p->jobs);
+	free(p->stack);
+	free(p->threads);
+	strmap_clear(&p->pending, 0);
+	pthread_cond_destroy(&p->work_cond);
+	pthread_cond_destroy(&p->done_cond);
+	pthread_mutex_destroy(&p->mutex);
+	free(p);
+}
@@ -0,0 +1,74 @@
+#ifndef DIR_PREFETCH_H
+#define DIR_PREFETCH_H
+
+#include "strbuf.h"
+
+/*
+ * Read directories ahead of a (single-threaded) walk of the working
+ * tree using a pool of worker threads.
+ *
+ * The walker asks for the listing of a directory with
+ * dir_prefetch_get() and then tells the pool which of its
+ * subdirectories it is likely to visit next with dir_prefetch_queue().
+ * The workers read the queued directories in the background, most
+ * recently queued first, so that they stay just ahead of a depth-first
+ * walk.  The walker itself decides what to do with each entry, in the
+ * same order as it would with readdir(), so the results of the walk do
+ * not depend on whether a directory was prefetched or not.
+ */
+
+struct dir_prefetch;
+
+struct dir_prefetch_entry {
+	size_t name_offset;
+	unsigned char d_type;
+};
+
+struct dir_prefetch_listing {
+	/* errno of a failed opendir(), or 0 */
+	int err;
+
+	/* NUL-separated names of the entries, without "." and ".." */
+	struct strbuf names;
+	struct dir_prefetch_entry *entries;
+	size_t nr, alloc;
+};
+
+static inline const char *dir_prefetch_name(const struct dir_prefetch_listing *l,
+					    size_t i)
+{
+	return l->names.buf + l->entries[i].name_offset;
+}
+
+/*
+ * Start a pool of "nr_threads" workers. Returns NULL if threads are not
+ * available or "nr_threads" is less than 2, in which case the caller
+ * should read directories by itself.
+ */
+struct dir_prefetch *dir_prefetch_start(int nr_threads);
+
+/*
+ * Ask for "path" to be read in the background, unless it has already
+ * been queued. "path" is given in the same form that will later be
+ * passed to dir_prefetch_get().
+ */
+void dir_prefetch_queue(struct dir_prefetch *p, const char *path);
+
+/*
+ * Return the listing of "path", waiting for a worker that is reading it
+ * or reading it in the calling thread if no worker got to it yet. The
+ * caller owns the result and must free it with
+ * dir_prefetch_listing_free().
+ */
+struct dir_prefetch_listing *dir_prefetch_get(struct dir_prefetch *p,
+					      const char *path);
+
+void dir_prefetch_listing_free(struct dir_prefetch_listing *listing);
+
+/*
+ * Stop the workers and release all listings that have not been
+ * consumed.
+ */
+void dir_prefetch_stop(struct dir_prefetch *p);
+
+#endif /* DIR_PREFETCH_H */
@@ -14,6 +14,7 @@
 #include "config.h"
 #include "convert.h"
 #include "dir.h"
+#include "dir-prefetch.h"
 #include "environment.h"
 #include "gettext.h"
 #include "name-hash.h"
@@ -33,6 +34,7 @@
 #include "strbuf.h"
 #include "submodule-config.h"
 #include "symlinks.h"
+#include "thread-utils.h"
 #include "trace2.h"
 #include "tree.h"
 #include "hex.h"
@@ -61,6 +63,8 @@ enum path_treatment {
  */
 struct cached_dir {
 	DIR *fdir;
+	struct dir_prefetch_listing *listing;
+	size_t listing_pos;
 	struct untracked_cache_dir *untracked;
 	int nr_files;
 	int nr_dirs;
@@ -2616,6 +2620,31 @@ static int valid_cached_dir(struct dir_struct *dir,
 	return untracked->valid;
 }
 
+/*
+ * Ask the prefetch threads to read the subdirectories of "path" while we
+ * are busy with its entries; we are likely to descend into them next.
+ */
+static void queue_subdirs(struct dir_prefetch *prefetch,
+			  const struct dir_prefetch_listing *listing,
+			  struct strbuf *path)
+{
+	size_t baselen = path->len;
+	size_t i;
+
+	/* queue in reverse, so that the first one is read first */
+	for (i = listing->nr; i > 0; i--) {
+		const char *name = dir_prefetch_name(listing, i - 1);
+
+		if (listing->entries[i - 1].d_type != DT_DIR ||
+		    !fspathcmp(name, ".git"))
+			continue;
+		strbuf_addstr(path, name);
+		strbuf_addch(path, '/');
+		dir_prefetch_queue(prefetch, path->buf);
+		strbuf_setlen(path, baselen);
+	}
+}
+
 static int open_cached_dir(struct cached_dir *cdir,
 			   struct dir_struct *dir,
 			   struct untracked_cache_dir *untracked,
@@ -2630,14 +2659,25 @@ static int open_cached_dir(struct cached_dir *cdir,
 	if (valid_cached_dir(dir, untracked, istate, path, check_only))
 		return 0;
 	c_path = path->len ? path->buf : ".";
-	cdir->fdir = opendir(c_path);
-	if (!cdir->fdir)
+	if (dir->internal.prefetch) {
+		cdir->listing = dir_prefetch_get(dir->internal.prefetch, c_path);
+		if (cdir->listing->err) {
+			errno = cdir->listing->err;
+			dir_prefetch_listing_free(cdir->listing);
+			cdir->listing = NULL;
+		} else {
+			queue_subdirs(dir->internal.prefetch, cdir->listing, path);
+		}
+	} else {
+		cdir->fdir = opendir(c_path);
+	}
+	if (!cdir->fdir && !cdir->listing)
 		warning_errno(_("could not open directory '%s'"), c_path);
 	if (dir->untracked) {
 		invalidate_directory(dir->untracked, untracked);
 		dir->untracked->dir_opened++;
 	}
-	if (!cdir->fdir)
+	if (!cdir->fdir && !cdir->listing)
 		return -1;
 	return 0;
 }
@@ -2657,6 +2697,17 @@ static int read_cached_dir(struct cached_dir *cdir)
 		cdir->d_type = DTYPE(de);
 		return 0;
 	}
+	if (cdir->listing) {
+		if (cdir->listing_pos >= cdir->listing->nr) {
+			cdir->d_name = NULL;
+			cdir->d_type = DT_UNKNOWN;
+			return -1;
+		}
+		cdir->d_name = dir_prefetch_name(cdir->listing, cdir->listing_pos);
+		cdir->d_type = cdir->listing->entries[cdir->listing_pos].d_type;
+		cdir->listing_pos++;
+		return 0;
+	}
 	while (cdir->nr_dirs < cdir->untracked->dirs_nr) {
 		struct untracked_cache_dir *d = cdir->untracked->dirs[cdir->nr_dirs];
 		if (!d->recurse) {
@@ -2680,6 +2731,7 @@ static void close_cached_dir(struct cached_dir *cdir)
 {
 	if (cdir->fdir)
 		closedir(cdir->fdir);
+	dir_prefetch_listing_free(cdir->listing);
 	/*
 	 * We have gone through this directory and found no untracked
 	 * entries. Mark it valid.
@@ -2715,7 +2767,7 @@ static void add_path_to_appropriate_result_list(struct dir_struct *dir,
 		if (dir->flags & DIR_SHOW_IGNORED)
 			break;
 		dir_add_name(dir, istate, path->buf, path->len);
-		if (cdir->fdir)
+		if (cdir->fdir || cdir->listing)
 			add_untracked(untracked, path->buf + baselen);
 		break;
 
@@ -2821,7 +2873,7 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 
 			/* abort early if maximum state has been reached */
 			if (dir_state == path_untracked) {
-				if (cdir.fdir)
+				if (cdir.fdir || cdir.listing)
 					add_untracked(untracked, path.buf + baselen);
 				break;
 			}
@@ -3180,6 +3232,17 @@ static void emit_traversal_statistics(struct dir_struct *dir,
 			   "opendir", dir->untracked->dir_opened);
 }
 
+static int untracked_walk_threads(struct repository *r)
+{
+	int nr_threads;
+
+	if (!r || repo_config_get_int(r, "core.untrackedwalkthreads", &nr_threads))
+		return 1;
+	if (!nr_threads)
+		nr_threads = online_cpus();
+	return nr_threads;
+}
+
 int read_directory(struct dir_struct *dir, struct index_state *istate,
 		   const char *path, int len, const struct pathspec *pathspec)
 {
@@ -3201,8 +3264,28 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		 * e.g. prep_exclude()
 		 */
 		dir->untracked = NULL;
+
+	/*
+	 * Reading directories ahead only pays off when we are going to
+	 * read them all; with the untracked cache most of them are not
+	 * opened at all.
+	 */
+	if (!dir->untracked) {
+		int nr_threads = untracked_walk_threads(istate->repo);
+
+		dir->internal.prefetch = dir_prefetch_start(nr_threads);
+		if (dir->internal.prefetch)
+			trace2_data_intmax("dir", istate->repo,
+					   "read_directory/prefetch_threads",
+					   nr_threads);
+	}
+
 	if (!len || treat_leading_path(dir, istate, path, len, pathspec))
 		read_directory_recursive(dir, istate, path, len, untracked, 0, 0, pathspec);
+
+	dir_prefetch_stop(dir->internal.prefetch);
+	dir->internal.prefetch = NULL;
+
 	QSORT(dir->entries, dir->nr, cmp_dir_entry);
 	QSORT(dir->ignored, dir->ignored_nr, cmp_dir_entry);
 
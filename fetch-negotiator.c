@@ -9,11 +9,16 @@ void fetch_negotiator_init(struct repository *r,
 			   struct fetch_negotiator *negotiator)
 {
 	prepare_repo_settings(r);
+	negotiator->initial_haves = 0;
 	switch(r->settings.fetch_negotiation_algorithm) {
 	case FETCH_NEGOTIATION_SKIPPING:
 		skipping_negotiator_init(negotiator);
 		return;
 
+	case FETCH_NEGOTIATION_GENERATION:
+		generation_negotiator_init(negotiator);
+		return;
+
 	case FETCH_NEGOTIATION_NOOP:
 		noop_negotiator_init(negotiator);
 		return;
@@ -26,5 +31,6 @@ void fetch_negotiator_init(struct repository *r,
 
 void fetch_negotiator_init_noop(struct fetch_negotiator *negotiator)
 {
+	negotiator->initial_haves = 0;
 	noop_negotiator_init(negotiator);
 }
@@ -58,6 +58,13 @@ struct fetch_negotiator {
 
 	void (*release)(struct fetch_negotiator *);
 
+	/*
+	 * The number of "have" lines to send before the first flush, or 0
+	 * for the default. Set by negotiators whose haves each cover more
+	 * history than usual.
+	 */
+	int initial_haves;
+
 	/* internal use */
 	void *data;
 };
@@ -37,6 +37,7 @@
 #include "mergesort.h"
 #include "prio-queue.h"
 #include "promisor-remote.h"
+#include "thread-utils.h"
 
 static int transfer_unpack_limit = -1;
 static int fetch_unpack_limit = -1;
@@ -50,6 +51,7 @@ static int transfer_fsck_objects = -1;
 static int agent_supported;
 static int server_supports_filtering;
 static int advertise_sid;
+static int packfile_uri_jobs = 4;
 static struct shallow_lock shallow_lock;
 static const char *alternate_shallow_file;
 static struct strbuf fsck_msg_types = STRBUF_INIT;
@@ -290,6 +292,13 @@ static int next_flush(int stateless_rpc, int count)
 	return count;
 }
 
+static int initial_flush(struct fetch_negotiator *negotiator)
+{
+	if (negotiator->initial_haves)
+		return negotiator->initial_haves;
+	return INITIAL_FLUSH;
+}
+
 static void mark_tips(struct fetch_negotiator *negotiator,
 		      const struct oid_array *negotiation_restrict_tips)
 {
@@ -353,7 +362,8 @@ static int find_common(struct fetch_negotiator *negotiator,
 		       struct ref *refs)
 {
 	int fetching;
-	int count = 0, flushes = 0, flush_at = INITIAL_FLUSH, retval;
+	int count = 0, flushes = 0, retval;
+	int first_flush = initial_flush(negotiator), flush_at = first_flush;
 	int negotiation_round = 0, haves = 0;
 	const struct object_id *oid;
 	unsigned in_vain = 0;
@@ -538,7 +548,7 @@ static int find_common(struct fetch_negotiator *negotiator,
 			 * We keep one window "ahead" of the other side, and
 			 * will wait for an ACK only on the next one
 			 */
-			if (!args->stateless_rpc && count == INITIAL_FLUSH)
+			if (!args->stateless_rpc && count == first_flush)
 				continue;
 
 			consume_shallow_list(args, &reader);
@@ -922,24 +932,33 @@ static void create_promisor_file(const char *keep_name,
 	strbuf_release(&promisor_name);
 }
 
-static void parse_gitmodules_oids(int fd, struct oidset *gitmodules_oids)
+static void parse_gitmodules_oids_buf(const char *buf, size_t buf_len,
+				      struct oidset *gitmodules_oids)
 {
-	int len = the_hash_algo->hexsz + 1; /* hash + NL */
+	size_t len = the_hash_algo->hexsz + 1; /* hash + NL */
 
-	do {
-		char hex_hash[GIT_MAX_HEXSZ + 1];
-		int read_len = read_in_full(fd, hex_hash, len);
+	while (buf_len) {
 		struct object_id oid;
 		const char *end;
 
-		if (!read_len)
-			return;
-		if (read_len != len)
-			die("invalid length read %d", read_len);
-		if (parse_oid_hex(hex_hash, &oid, &end) || *end != '\n')
+		if (buf_len < len)
+			die("invalid length read %d", (int)buf_len);
+		if (parse_oid_hex(buf, &oid, &end) || *end != '\n')
 			die("invalid hash");
 		oidset_insert(gitmodules_oids, &oid);
-	} while (1);
+		buf += len;
+		buf_len -= len;
+	}
+}
+
+static void parse_gitmodules_oids(int fd, struct oidset *gitmodules_oids)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	if (strbuf_read(&buf, fd, 0) < 0)
+		die_errno("unable to read index-pack output");
+	parse_gitmodules_oids_buf(buf.buf, buf.len, gitmodules_oids);
+	strbuf_release(&buf);
 }
 
 static void add_index_pack_keep_option(struct strvec *args)
@@ -953,13 +972,217 @@ static void add_index_pack_keep_option(struct strvec *args)
 }
 
 /*
- * If packfile URIs were provided, pass a non-NULL pointer to index_pack_args.
- * The strings to pass as the --index-pack-arg arguments to http-fetch will be
- * stored there. (It must be freed by the caller.)
+ * The packs listed in the "packfile-uris" section are downloaded by
+ * "git http-fetch" children. Up to fetch.packfileUriJobs of them run at
+ * the same time, and the first ones are started as soon as the
+ * arguments for index-pack are known, so that they download while the
+ * inline pack is still being received and indexed.
+ *
+ * While we wait for one child, we keep reading from all the others that
+ * are running, so that none of them blocks on a full pipe. The stderr
+ * of the child we are waiting for is copied to ours as it arrives; that
+ * of the others is buffered and replayed when it is their turn. The
+ * children are finished in the order the server listed the URIs, so
+ * progress output does not interleave and the resulting .keep files are
+ * recorded in a stable order.
+ */
+struct packfile_uri_fetch {
+	struct child_process cmd;
+	struct strbuf out;
+	struct strbuf err;
+};
+
+struct packfile_uri_fetches {
+	struct string_list uris;
+	struct strvec index_pack_args;
+	struct packfile_uri_fetch *fetches;
+	size_t nr_started, nr_finished;
+};
+
+#define PACKFILE_URI_FETCHES_INIT { \
+	.uris = STRING_LIST_INIT_DUP, \
+	.index_pack_args = STRVEC_INIT, \
+}
+
+static void start_packfile_uri_fetch(struct packfile_uri_fetches *fetches)
+{
+	const char *hash_and_uri = fetches->uris.items[fetches->nr_started].string;
+	struct packfile_uri_fetch *fetch = &fetches->fetches[fetches->nr_started];
+	struct child_process *cmd = &fetch->cmd;
+
+	child_process_init(cmd);
+	strbuf_init(&fetch->out, 0);
+	strbuf_init(&fetch->err, 0);
+	strvec_push(&cmd->args, "http-fetch");
+	strvec_pushf(&cmd->args, "--packfile=%.*s",
+		     (int) the_hash_algo->hexsz, hash_and_uri);
+	for (size_t i = 0; i < fetches->index_pack_args.nr; i++)
+		strvec_pushf(&cmd->args, "--index-pack-arg=%s",
+			     fetches->index_pack_args.v[i]);
+	strvec_push(&cmd->args, hash_and_uri + the_hash_algo->hexsz + 1);
+	cmd->git_cmd = 1;
+	cmd->no_stdin = 1;
+	cmd->out = -1;
+	cmd->err = -1;
+	cmd->clean_on_exit = 1;
+	if (start_command(cmd))
+		die("fetch-pack: unable to spawn http-fetch");
+	fetches->nr_started++;
+}
+
+static void start_packfile_uri_fetches(struct packfile_uri_fetches *fetches)
+{
+	if (!fetches->fetches)
+		CALLOC_ARRAY(fetches->fetches, fetches->uris.nr);
+	while (fetches->nr_started < fetches->uris.nr &&
+	       fetches->nr_started - fetches->nr_finished < (size_t)packfile_uri_jobs)
+		start_packfile_uri_fetch(fetches);
+}
+
+/*
+ * Read from "*fd" into "buf", closing it and setting it to -1 at EOF.
+ */
+static void read_packfile_uri_pipe(int *fd, struct strbuf *buf)
+{
+	ssize_t len = strbuf_read_once(buf, *fd, 0);
+
+	if (len < 0)
+		die_errno("unable to read http-fetch output");
+	if (!len) {
+		close(*fd);
+		*fd = -1;
+	}
+}
+
+/*
+ * Read the output of all running children until the next one to be
+ * finished has closed both its stdout and its stderr. The stdout of
+ * each child is collected in its "out"; stderr is copied to ours for
+ * the next child and collected in "err" for the others.
+ */
+static void collect_packfile_uri_output(struct packfile_uri_fetches *fetches)
+{
+	struct packfile_uri_fetch *next = &fetches->fetches[fetches->nr_finished];
+	size_t alloc = 2 * (fetches->nr_started - fetches->nr_finished);
+	struct pollfd *pfd;
+	int **fds;
+	struct strbuf **bufs;
+
+	ALLOC_ARRAY(pfd, alloc);
+	ALLOC_ARRAY(fds, alloc);
+	ALLOC_ARRAY(bufs, alloc);
+
+	write_in_full(2, next->err.buf, next->err.len);
+	strbuf_reset(&next->err);
+
+	while (next->cmd.out >= 0 || next->cmd.err >= 0) {
+		size_t nr = 0;
+
+		for (size_t i = fetches->nr_finished; i < fetches->nr_started; i++) {
+			struct packfile_uri_fetch *fetch = &fetches->fetches[i];
+
+			if (fetch->cmd.out >= 0) {
+				fds[nr] = &fetch->cmd.out;
+				bufs[nr++] = &fetch->out;
+			}
+			if (fetch->cmd.err >= 0) {
+				fds[nr] = &fetch->cmd.err;
+				bufs[nr++] = &fetch->err;
+			}
+		}
+		for (size_t i = 0; i < nr; i++) {
+			pfd[i].fd = *fds[i];
+			pfd[i].events = POLLIN;
+		}
+
+		if (poll(pfd, nr, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die_errno("poll failed");
+		}
+		for (size_t i = 0; i < nr; i++) {
+			if (!(pfd[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			read_packfile_uri_pipe(fds[i], bufs[i]);
+		}
+
+		write_in_full(2, next->err.buf, next->err.len);
+		strbuf_reset(&next->err);
+	}
+
+	free(pfd);
+	free(fds);
+	free(bufs);
+}
+
+static void finish_packfile_uri_fetch(struct packfile_uri_fetches *fetches,
+				      struct string_list *pack_lockfiles,
+				      struct oidset *gitmodules_oids)
+{
+	const char *hash_and_uri = fetches->uris.items[fetches->nr_finished].string;
+	struct packfile_uri_fetch *fetch = &fetches->fetches[fetches->nr_finished];
+	struct strbuf *out = &fetch->out;
+	size_t hexsz = the_hash_algo->hexsz;
+	const char *packname;
+
+	collect_packfile_uri_output(fetches);
+	if (finish_command(&fetch->cmd))
+		die("fetch-pack: unable to finish http-fetch");
+	fetches->nr_finished++;
+
+	if (!skip_prefix(out->buf, "keep\t", &packname))
+		die("fetch-pack: expected keep then TAB at start of http-fetch output");
+	if (out->len - (packname - out->buf) < hexsz + 1 ||
+	    packname[hexsz] != '\n')
+		die("fetch-pack: expected hash then LF at end of http-fetch output");
+
+	parse_gitmodules_oids_buf(packname + hexsz + 1,
+				  out->len - (packname - out->buf) - hexsz - 1,
+				  gitmodules_oids);
+
+	if (memcmp(hash_and_uri, packname, hexsz))
+		die("fetch-pack: pack downloaded from %s does not match expected hash %.*s",
+		    hash_and_uri + hexsz + 1, (int) hexsz, hash_and_uri);
+
+	string_list_append_nodup(pack_lockfiles,
+				 xstrfmt("%s/pack/pack-%.*s.keep",
+					 repo_get_object_directory(the_repository),
+					 (int) hexsz, packname));
+	strbuf_release(&fetch->out);
+	strbuf_release(&fetch->err);
+}
+
+static void finish_packfile_uri_fetches(struct packfile_uri_fetches *fetches,
+					struct string_list *pack_lockfiles,
+					struct oidset *gitmodules_oids)
+{
+	start_packfile_uri_fetches(fetches);
+	while (fetches->nr_finished < fetches->uris.nr) {
+		finish_packfile_uri_fetch(fetches, pack_lockfiles,
+					  gitmodules_oids);
+		start_packfile_uri_fetches(fetches);
+	}
+}
+
+static void packfile_uri_fetches_clear(struct packfile_uri_fetches *fetches)
+{
+	string_list_clear(&fetches->uris, 0);
+	strvec_clear(&fetches->index_pack_args);
+	for (size_t i = fetches->nr_finished; i < fetches->nr_started; i++) {
+		strbuf_release(&fetches->fetches[i].out);
+		strbuf_release(&fetches->fetches[i].err);
+	}
+	free(fetches->fetches);
+}
+
+/*
+ * If packfile URIs were provided, pass them in a non-NULL uri_fetches.
+ * Their downloads are started once the arguments for index-pack are
+ * known; the caller has to finish them with finish_packfile_uri_fetches().
  */
 static int get_pack(struct fetch_pack_args *args,
 		    int xd[2], struct string_list *pack_lockfiles,
-		    struct strvec *index_pack_args,
+		    struct packfile_uri_fetches *uri_fetches,
 		    struct ref **sought, int nr_sought,
 		    struct oidset *gitmodules_oids)
 {
@@ -988,7 +1211,7 @@ static int get_pack(struct fetch_pack_args *args,
 	else
 		demux.out = xd[0];
 
-	if (!args->keep_pack && unpack_limit && !index_pack_args) {
+	if (!args->keep_pack && unpack_limit && !uri_fetches) {
 
 		if (read_pack_header(demux.out, &header))
 			die(_("protocol error: bad pack header"));
@@ -1006,7 +1229,7 @@ static int get_pack(struct fetch_pack_args *args,
 
 	fsck_objects = fetch_pack_fsck_objects();
 
-	if (do_keep || args->from_promisor || index_pack_args || fsck_objects) {
+	if (do_keep || args->from_promisor || uri_fetches || fsck_objects) {
 		if (pack_lockfiles || fsck_objects)
 			cmd.out = -1;
 		cmd_name = "index-pack";
@@ -1016,9 +1239,9 @@ static int get_pack(struct fetch_pack_args *args,
 			strvec_push(&cmd.args, "-v");
 		if (args->use_thin_pack)
 			strvec_push(&cmd.args, "--fix-thin");
-		if ((do_keep || index_pack_args) && (args->lock_pack || unpack_limit))
+		if ((do_keep || uri_fetches) && (args->lock_pack || unpack_limit))
 			add_index_pack_keep_option(&cmd.args);
-		if (!index_pack_args && args->check_self_contained_and_connected)
+		if (!uri_fetches && args->check_self_contained_and_connected)
 			strvec_push(&cmd.args, "--check-self-contained-and-connected");
 		else
 			/*
@@ -1052,7 +1275,7 @@ static int get_pack(struct fetch_pack_args *args,
 			     ntohl(header.hdr_version),
 				 ntohl(header.hdr_entries));
 	if (fsck_objects) {
-		if (args->from_promisor || index_pack_args)
+		if (args->from_promisor || uri_fetches)
 			/*
 			 * We cannot use --strict in index-pack because it
 			 * checks both broken objects and links, but we only
@@ -1064,8 +1287,10 @@ static int get_pack(struct fetch_pack_args *args,
 				     fsck_msg_types.buf);
 	}
 
-	if (index_pack_args)
-		strvec_pushv(index_pack_args, cmd.args.v);
+	if (uri_fetches) {
+		strvec_pushv(&uri_fetches->index_pack_args, cmd.args.v);
+		start_packfile_uri_fetches(uri_fetches);
+	}
 
 	sigchain_push(SIGPIPE, SIG_IGN);
 
@@ -1720,15 +1945,13 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 	struct packet_reader reader;
 	int in_vain = 0, negotiation_started = 0;
 	int negotiation_round = 0;
-	int haves_to_send = INITIAL_FLUSH;
+	int haves_to_send;
 	struct fetch_negotiator negotiator_alloc;
 	struct fetch_negotiator *negotiator;
 	int seen_ack = 0;
 	struct object_id common_oid;
 	int received_ready = 0;
-	struct string_list packfile_uris = STRING_LIST_INIT_DUP;
-	int i;
-	struct strvec index_pack_args = STRVEC_INIT;
+	struct packfile_uri_fetches uri_fetches = PACKFILE_URI_FETCHES_INIT;
 	const char *promisor_remote_config;
 
 	fsck_options_init(&fsck_options, the_repository, FSCK_OPTIONS_MISSING_GITMODULES);
@@ -1760,6 +1983,7 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 		fetch_negotiator_init_noop(negotiator);
 	else
 		fetch_negotiator_init(r, negotiator);
+	haves_to_send = initial_flush(negotiator);
 
 	packet_reader_init(&reader, fd[0], NULL, 0,
 			   PACKET_READ_CHOMP_NEWLINE |
@@ -1861,7 +2085,7 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 			if (git_env_bool("GIT_TRACE_REDACT", 1))
 				reader.options |= PACKET_READ_REDACT_URI_PATH;
 			if (process_section_header(&reader, "packfile-uris", 1))
-				receive_packfile_uris(&reader, &packfile_uris);
+				receive_packfile_uris(&reader, &uri_fetches.uris);
 			/* We don't expect more URIs. Reset to avoid expensive URI check. */
 			reader.options &= ~PACKET_READ_REDACT_URI_PATH;
 
@@ -1876,7 +2100,7 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 			fd[1] = -1;
 
 			if (get_pack(args, fd, pack_lockfiles,
-				     packfile_uris.nr ? &index_pack_args : NULL,
+				     uri_fetches.uris.nr ? &uri_fetches : NULL,
 				     sought, nr_sought, &fsck_options.gitmodules_found))
 				die(_("git fetch-pack: fetch failed."));
 			do_check_stateless_delimiter(args->stateless_rpc, &reader);
@@ -1888,58 +2112,9 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 		}
 	}
 
-	for (i = 0; i < packfile_uris.nr; i++) {
-		int j;
-		struct child_process cmd = CHILD_PROCESS_INIT;
-		char packname[GIT_MAX_HEXSZ + 1];
-		const char *uri = packfile_uris.items[i].string +
-			the_hash_algo->hexsz + 1;
-
-		strvec_push(&cmd.args, "http-fetch");
-		strvec_pushf(&cmd.args, "--packfile=%.*s",
-			     (int) the_hash_algo->hexsz,
-			     packfile_uris.items[i].string);
-		for (j = 0; j < index_pack_args.nr; j++)
-			strvec_pushf(&cmd.args, "--index-pack-arg=%s",
-				     index_pack_args.v[j]);
-		strvec_push(&cmd.args, uri);
-		cmd.git_cmd = 1;
-		cmd.no_stdin = 1;
-		cmd.out = -1;
-		if (start_command(&cmd))
-			die("fetch-pack: unable to spawn http-fetch");
-
-		if (read_in_full(cmd.out, packname, 5) < 0 ||
-		    memcmp(packname, "keep\t", 5))
-			die("fetch-pack: expected keep then TAB at start of http-fetch output");
-
-		if (read_in_full(cmd.out, packname,
-				 the_hash_algo->hexsz + 1) < 0 ||
-		    packname[the_hash_algo->hexsz] != '\n')
-			die("fetch-pack: expected hash then LF at end of http-fetch output");
-
-		packname[the_hash_algo->hexsz] = '\0';
-
-		parse_gitmodules_oids(cmd.out, &fsck_options.gitmodules_found);
-
-		close(cmd.out);
-
-		if (finish_command(&cmd))
-			die("fetch-pack: unable to finish http-fetch");
-
-		if (memcmp(packfile_uris.items[i].string, packname,
-			   the_hash_algo->hexsz))
-			die("fetch-pack: pack downloaded from %s does not match expected hash %.*s",
-			    uri, (int) the_hash_algo->hexsz,
-			    packfile_uris.items[i].string);
-
-		string_list_append_nodup(pack_lockfiles,
-					 xstrfmt("%s/pack/pack-%s.keep",
-						 repo_get_object_directory(the_repository),
-						 packname));
-	}
-	string_list_clear(&packfile_uris, 0);
-	strvec_clear(&index_pack_args);
+	finish_packfile_uri_fetches(&uri_fetches, pack_lockfiles,
+				    &fsck_options.gitmodules_found);
+	packfile_uri_fetches_clear(&uri_fetches);
 
 	if (fsck_finish(&fsck_options))
 		die("fsck failed");
@@ -2002,6 +2177,13 @@ static void fetch_pack_config(void)
 	repo_config_get_bool(the_repository, "fetch.fsckobjects", &fetch_fsck_objects);
 	repo_config_get_bool(the_repository, "transfer.fsckobjects", &transfer_fsck_objects);
 	repo_config_get_bool(the_repository, "transfer.advertisesid", &advertise_sid);
+	if (!repo_config_get_int(the_repository, "fetch.packfileurijobs",
+				 &packfile_uri_jobs)) {
+		if (packfile_uri_jobs < 0)
+			die(_("fetch.packfileUriJobs cannot be negative"));
+		if (!packfile_uri_jobs)
+			packfile_uri_jobs = online_cpus();
+	}
 	if (!uri_protocols.nr) {
 		char *str;
 
@@ -2256,7 +2438,7 @@ void negotiate_using_fetch(const struct oid_array *negotiation_restrict_tips,
 	struct object_array nt_object_array = OBJECT_ARRAY_INIT;
 	struct strbuf req_buf = STRBUF_INIT;
 	struct oidset negotiation_include_oids = OIDSET_INIT;
-	int haves_to_send = INITIAL_FLUSH;
+	int haves_to_send;
 	int in_vain = 0;
 	int seen_ack = 0;
 	int last_iteration = 0;
@@ -2265,6 +2447,7 @@ void negotiate_using_fetch(const struct oid_array *negotiation_restrict_tips,
 
 	fetch_negotiator_init(the_repository, &negotiator);
 	mark_tips(&negotiator, negotiation_restrict_tips);
+	haves_to_send = initial_flush(&negotiator);
 
 	add_oids_to_set(negotiation_include_tips,
 			&negotiation_include_oids);
@@ -0,0 +1,675 @@
+#include "git-compat-util.h"
+#include "grep-index.h"
+#include "chunk-format.h"
+#include "csum-file.h"
+#include "gettext.h"
+#include "grep.h"
+#include "hash-lookup.h"
+#include "lockfile.h"
+#include "object.h"
+#include "odb.h"
+#include "odb/source.h"
+#include "oid-array.h"
+#include "path.h"
+#include "progress.h"
+#include "repo-settings.h"
+#include "repository.h"
+#include "strbuf.h"
+#include "trace2.h"
+#include "write-or-die.h"
+
+/*
+ * File layout (all integers in network byte order):
+ *
+ *   header:  signature, version, hash id, number of hashes per
+ *            trigram and number of blobs (5 x 32 bits)
+ *   fanout:  256 x 32 bits, as in pack .idx files
+ *   oids:    sorted object names of the indexed blobs
+ *   offsets: (nr + 1) x 64 bits; filter "i" is at [offsets[i],
+ *            offsets[i + 1]) in the filter data
+ *   filters: the Bloom filters themselves
+ *   trailer: checksum of the above
+ *
+ * An empty filter means that nothing is known about the blob.
+ */
+#define GREP_INDEX_HEADER_SIZE 20
+#define GREP_INDEX_FANOUT_SIZE (256 * 4)
+#define GREP_INDEX_NUM_HASHES 7
+#define GREP_INDEX_BITS_PER_TRIGRAM 10
+#define GREP_INDEX_MIN_FILTER 8
+
+#define TRIGRAM_SPACE (1 << 24)
+
+struct grep_index {
+	const unsigned char *map;
+	size_t map_size;
+	const struct git_hash_algo *algop;
+	uint32_t num_hashes;
+	uint32_t nr;
+	const uint32_t *fanout;
+	const unsigned char *oids;
+	const unsigned char *offsets;
+	const unsigned char *filters;
+	uint64_t filters_size;
+};
+
+struct grep_index_trigrams {
+	uint32_t *v;
+	size_t nr, alloc;
+};
+
+struct grep_index_query {
+	/* Do all patterns have to match (--all-match), or just one? */
+	int all_match;
+	struct grep_index_trigrams *pats;
+	size_t nr, alloc;
+};
+
+static char *grep_index_filename(struct repository *r)
+{
+	return xstrfmt("%s/info/grep-index", r->objects->sources->path);
+}
+
+static inline uint32_t trigram_at(const unsigned char *p)
+{
+	return ((uint32_t)tolower(p[0]) << 16) |
+	       ((uint32_t)tolower(p[1]) << 8) |
+	       (uint32_t)tolower(p[2]);
+}
+
+static inline uint32_t trigram_hash(uint32_t t, uint32_t seed)
+{
+	uint32_t h = (t ^ seed) * 0x9e3779b1;
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static void add_trigram_to_filter(unsigned char *filter, size_t len,
+				  uint32_t num_hashes, uint32_t t)
+{
+	uint64_t nbits = (uint64_t)len * 8;
+	uint32_t h1 = trigram_hash(t, 0x293ae76f);
+	uint32_t h2 = trigram_hash(t, 0x7e646e2c) | 1;
+
+	for (uint32_t i = 0; i < num_hashes; i++) {
+		uint64_t pos = ((uint64_t)h1 + (uint64_t)i * h2) % nbits;
+		filter[pos / 8] |= 1 << (pos % 8);
+	}
+}
+
+static int filter_has_trigram(const unsigned char *filter, size_t len,
+			      uint32_t num_hashes, uint32_t t)
+{
+	uint64_t nbits = (uint64_t)len * 8;
+	uint32_t h1 = trigram_hash(t, 0x293ae76f);
+	uint32_t h2 = trigram_hash(t, 0x7e646e2c) | 1;
+
+	for (uint32_t i = 0; i < num_hashes; i++) {
+		uint64_t pos = ((uint64_t)h1 + (uint64_t)i * h2) % nbits;
+		if (!(filter[pos / 8] & (1 << (pos % 8))))
+			return 0;
+	}
+	return 1;
+}
+
+struct grep_index *grep_index_load(struct repository *r)
+{
+	char *path = grep_index_filename(r);
+	struct grep_index *gi = NULL;
+	const unsigned char *map = NULL;
+	const struct git_hash_algo *algop;
+	uint32_t hash_id, nr;
+	size_t map_size = 0, hashsz, expected;
+	struct stat st;
+	int fd;
+
+	fd = git_open(path);
+	if (fd < 0)
+		goto out;
+	if (fstat(fd, &st)) {
+		error_errno(_("failed to read %s"), path);
+		goto out;
+	}
+	map_size = xsize_t(st.st_size);
+	if (map_size < GREP_INDEX_HEADER_SIZE + GREP_INDEX_FANOUT_SIZE) {
+		error(_("grep index %s is too small"), path);
+		goto out;
+	}
+	map = xmmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (get_be32(map) != GREP_INDEX_SIGNATURE) {
+		error(_("grep index %s has unknown signature"), path);
+		goto out;
+	}
+	if (get_be32(map + 4) != GREP_INDEX_VERSION) {
+		error(_("grep index %s has unsupported version %"PRIu32),
+		      path, get_be32(map + 4));
+		goto out;
+	}
+	hash_id = get_be32(map + 8);
+	if (hash_id != oid_version(r->hash_algo)) {
+		error(_("grep index %s has unsupported hash id %"PRIu32),
+		      path, hash_id);
+		goto out;
+	}
+	algop = r->hash_algo;
+	hashsz = algop->rawsz;
+	nr = get_be32(map + 16);
+
+	expected = GREP_INDEX_HEADER_SIZE + GREP_INDEX_FANOUT_SIZE;
+	expected = st_add(expected, st_mult(nr, hashsz));
+	expected = st_add(expected, st_mult(st_add(nr, 1), 8));
+	expected = st_add(expected, hashsz);
+	if (map_size < expected) {
+		error(_("grep index %s is corrupt"), path);
+		goto out;
+	}
+
+	CALLOC_ARRAY(gi, 1);
+	gi->map = map;
+	gi->map_size = map_size;
+	gi->algop = algop;
+	gi->num_hashes = get_be32(map + 12);
+	gi->nr = nr;
+	gi->fanout = (const uint32_t *)(map + GREP_INDEX_HEADER_SIZE);
+	gi->oids = map + GREP_INDEX_HEADER_SIZE + GREP_INDEX_FANOUT_SIZE;
+	gi->offsets = gi->oids + st_mult(nr, hashsz);
+	gi->filters = gi->offsets + st_mult(st_add(nr, 1), 8);
+	gi->filters_size = map_size - expected;
+
+	if (ntohl(gi->fanout[255]) != nr ||
+	    get_be64(gi->offsets + st_mult(nr, 8)) != gi->filters_size) {
+		error(_("grep index %s is corrupt"), path);
+		FREE_AND_NULL(gi);
+		goto out;
+	}
+	map = NULL;
+
+out:
+	if (map)
+		munmap((void *)map, map_size);
+	if (fd >= 0)
+		close(fd);
+	free(path);
+	return gi;
+}
+
+void grep_index_free(struct grep_index *gi)
+{
+	if (!gi)
+		return;
+	munmap((void *)gi->map, gi->map_size);
+	free(gi);
+}
+
+/*
+ * Look up the filter of "oid". Returns 0 and sets "filter" and "len"
+ * if the blob is indexed.
+ */
+static int grep_index_filter(struct grep_index *gi,
+			     const struct object_id *oid,
+			     const unsigned char **filter, size_t *len)
+{
+	uint32_t pos;
+	uint64_t start, end;
+
+	if (!bsearch_hash(oid->hash, gi->fanout, gi->oids,
+			  gi->algop->rawsz, &pos))
+		return -1;
+
+	start = get_be64(gi->offsets + st_mult(pos, 8));
+	end = get_be64(gi->offsets + st_mult(pos + 1, 8));
+	if (start > end || end > gi->filters_size)
+		return -1;
+
+	*filter = gi->filters + start;
+	*len = end - start;
+	return 0;
+}
+
+static void add_trigram(struct grep_index_trigrams *t, uint32_t v)
+{
+	ALLOC_GROW(t->v, t->nr + 1, t->alloc);
+	t->v[t->nr++] = v;
+}
+
+static void flush_literal_run(struct strbuf *run,
+			      struct grep_index_trigrams *out)
+{
+	for (size_t i = 0; i + 2 < run->len; i++)
+		add_trigram(out, trigram_at((const unsigned char *)run->buf + i));
+	strbuf_reset(run);
+}
+
+/*
+ * Return the position after the bracket expression starting at "i",
+ * or 0 if it is not terminated.
+ */
+static size_t skip_bracket(const char *p, size_t len, size_t i)
+{
+	size_t j = i + 1;
+
+	if (j < len && p[j] == '^')
+		j++;
+	if (j < len && p[j] == ']')
+		j++;
+	while (j < len) {
+		if (p[j] == '[' && j + 1 < len && strchr(":.=", p[j + 1])) {
+			char delim = p[j + 1];
+
+			for (j += 2; j + 1 < len; j++)
+				if (p[j] == delim && p[j + 1] == ']')
+					break;
+			if (j + 1 >= len)
+				return 0;
+			j += 2;
+			continue;
+		}
+		if (p[j] == ']')
+			return j + 1;
+		j++;
+	}
+	return 0;
+}
+
+/*
+ * Return the position after the interval expression whose opening
+ * brace ends just before "i", or 0 if it is not terminated.
+ */
+static size_t skip_interval(const char *p, size_t len, size_t i, int extended)
+{
+	for (; i < len; i++) {
+		if (extended && p[i] == '}')
+			return i + 1;
+		if (!extended && p[i] == '\\' && i + 1 < len && p[i + 1] == '}')
+			return i + 2;
+	}
+	return 0;
+}
+
+static int is_quantifier(const char *p, size_t len, size_t i, int extended)
+{
+	if (i >= len)
+		return 0;
+	if (p[i] == '*')
+		return 1;
+	if (extended)
+		return !!strchr("+?{", p[i]);
+	return p[i] == '\\' && i + 1 < len && strchr("+?{", p[i + 1]);
+}
+
+/*
+ * Collect the trigrams of the literal strings that every match of the
+ * POSIX regular expression "p" must contain. This only needs to be
+ * conservative: anything not obviously a required literal character,
+ * including the contents of groups, ends the current run. Returns -1
+ * if the expression has an alternation at its top level.
+ */
+static int regex_trigrams(const char *p, size_t len, int extended, int icase,
+			  struct grep_index_trigrams *out)
+{
+	struct strbuf run = STRBUF_INIT;
+	int depth = 0, ret = 0;
+	size_t i = 0;
+
+	while (i < len) {
+		unsigned char c = p[i];
+		int lit = -1;
+		size_t next = i + 1;
+
+		if (c == '[') {
+			next = skip_bracket(p, len, i);
+			if (!next) {
+				ret = -1;
+				break;
+			}
+		} else if (c == '\\') {
+			if (i + 1 == len) {
+				ret = -1;
+				break;
+			}
+			c = p[i + 1];
+			next = i + 2;
+			if (!extended && c == '(') {
+				depth++;
+			} else if (!extended && c == ')') {
+				if (depth)
+					depth--;
+			} else if (!extended && c == '|') {
+				if (!depth) {
+					ret = -1;
+					break;
+				}
+			} else if (!extended && c == '{') {
+				next = skip_interval(p, len, next, extended);
+				if (!next) {
+					ret = -1;
+					break;
+				}
+			} else if (strchr(extended ? ".[]*^$\\/(){}|+?" : ".[]*^$\\/", c)) {
+				lit = c;
+			}
+		} else if (extended && c == '(') {
+			depth++;
+		} else if (extended && c == ')') {
+			if (depth)
+				depth--;
+		} else if (extended && c == '|') {
+			if (!depth) {
+				ret = -1;
+				break;
+			}
+		} else if (extended && c == '{') {
+			size_t end = skip_interval(p, len, next, extended);
+			if (end)
+				next = end;
+		} else if (!strchr(extended ? ".*^$+?}" : ".*^$", c)) {
+			lit = c;
+		}
+
+		if (lit >= 0 && !depth && !(icase && lit >= 0x80) &&
+		    !is_quantifier(p, len, next, extended))
+			strbuf_addch(&run, lit);
+		else
+			flush_literal_run(&run, out);
+		i = next;
+	}
+
+	if (!ret)
+		flush_literal_run(&run, out);
+	strbuf_release(&run);
+	return ret;
+}
+
+static void fixed_trigrams(const char *p, size_t len, int icase,
+			   struct grep_index_trigrams *out)
+{
+	struct strbuf run = STRBUF_INIT;
+
+	for (size_t i = 0; i < len; i++) {
+		if (icase && (unsigned char)p[i] >= 0x80)
+			flush_literal_run(&run, out);
+		else
+			strbuf_addch(&run, p[i]);
+	}
+	flush_literal_run(&run, out);
+	strbuf_release(&run);
+}
+
+static int cmp_uint32(const void *va, const void *vb)
+{
+	uint32_t a = *(const uint32_t *)va, b = *(const uint32_t *)vb;
+	return a < b ? -1 : a > b;
+}
+
+struct grep_index_query *grep_index_query_new(struct grep_opt *opt)
+{
+	struct grep_index_query *q;
+	enum grep_pattern_type type = opt->pattern_type_option;
+	struct grep_pat *p;
+
+	if (opt->invert || opt->unmatch_name_only || opt->allow_textconv ||
+	    !opt->pattern_list)
+		return NULL;
+	if (type == GREP_PATTERN_TYPE_UNSPECIFIED)
+		type = opt->extended_regexp_option ? GREP_PATTERN_TYPE_ERE
+						   : GREP_PATTERN_TYPE_BRE;
+	if (type == GREP_PATTERN_TYPE_PCRE)
+		return NULL;
+
+	CALLOC_ARRAY(q, 1);
+	q->all_match = opt->all_match;
+
+	for (p = opt->pattern_list; p; p = p->next) {
+		struct grep_index_trigrams t = { 0 };
+		size_t nr = 0;
+
+		if (p->token != GREP_PATTERN ||
+		    memchr(p->pattern, 0, p->patternlen))
+			goto fail;
+
+		if (type == GREP_PATTERN_TYPE_FIXED)
+			fixed_trigrams(p->pattern, p->patternlen,
+				       opt->ignore_case, &t);
+		else if (regex_trigrams(p->pattern, p->patternlen,
+					type == GREP_PATTERN_TYPE_ERE,
+					opt->ignore_case, &t) < 0)
+			t.nr = 0;
+
+		if (!t.nr) {
+			free(t.v);
+			/*
+			 * A pattern without any trigram may match any blob,
+			 * which only matters if it alone is enough.
+			 */
+			if (q->all_match)
+				continue;
+			goto fail;
+		}
+
+		QSORT(t.v, t.nr, cmp_uint32);
+		for (size_t i = 0; i < t.nr; i++)
+			if (!nr || t.v[nr - 1] != t.v[i])
+				t.v[nr++] = t.v[i];
+		t.nr = nr;
+
+		ALLOC_GROW(q->pats, q->nr + 1, q->alloc);
+		q->pats[q->nr++] = t;
+	}
+
+	if (q->nr)
+		return q;
+
+fail:
+	grep_index_query_free(q);
+	return NULL;
+}
+
+void grep_index_query_free(struct grep_index_query *q)
+{
+	if (!q)
+		return;
+	for (size_t i = 0; i < q->nr; i++)
+		free(q->pats[i].v);
+	free(q->pats);
+	free(q);
+}
+
+int grep_index_may_match(struct grep_index *gi,
+			 struct grep_index_query *q,
+			 const struct object_id *oid)
+{
+	const unsigned char *filter;
+	size_t len;
+
+	if (grep_index_filter(gi, oid, &filter, &len) < 0 || !len)
+		return 1;
+
+	for (size_t i = 0; i < q->nr; i++) {
+		const struct grep_index_trigrams *t = &q->pats[i];
+		int found = 1;
+
+		for (size_t j = 0; found && j < t->nr; j++)
+			found = filter_has_trigram(filter, len,
+						   gi->num_hashes, t->v[j]);
+		if (found && !q->all_match)
+			return 1;
+		if (!found && q->all_match)
+			return 0;
+	}
+	return q->all_match;
+}
+
+struct blob_filter_builder {
+	/* One bit per trigram, set for those seen in the current blob. */
+	unsigned char *seen;
+	struct grep_index_trigrams trigrams;
+};
+
+static void compute_blob_filter(struct blob_filter_builder *b,
+				const unsigned char *buf, size_t size,
+				struct strbuf *out)
+{
+	size_t len, start = out->len;
+
+	b->trigrams.nr = 0;
+	for (size_t i = 0; i + 2 < size; i++) {
+		uint32_t t = trigram_at(buf + i);
+
+		if (b->seen[t / 8] & (1 << (t % 8)))
+			continue;
+		b->seen[t / 8] |= 1 << (t % 8);
+		add_trigram(&b->trigrams, t);
+	}
+
+	len = st_mult(b->trigrams.nr, GREP_INDEX_BITS_PER_TRIGRAM) / 8;
+	if (len < GREP_INDEX_MIN_FILTER)
+		len = GREP_INDEX_MIN_FILTER;
+	strbuf_addchars(out, 0, len);
+
+	for (size_t i = 0; i < b->trigrams.nr; i++) {
+		uint32_t t = b->trigrams.v[i];
+
+		add_trigram_to_filter((unsigned char *)out->buf + start, len,
+				      GREP_INDEX_NUM_HASHES, t);
+		b->seen[t / 8] &= ~(1 << (t % 8));
+	}
+}
+
+struct collect_blobs_data {
+	struct oid_array *oids;
+	unsigned long big_file_threshold;
+};
+
+static int collect_blob(const struct object_id *oid,
+			struct object_info *oi,
+			void *cb_data)
+{
+	struct collect_blobs_data *data = cb_data;
+
+	if (*oi->typep == OBJ_BLOB && *oi->sizep <= data->big_file_threshold)
+		oid_array_append(data->oids, oid);
+	return 0;
+}
+
+int write_grep_index(struct repository *r, enum grep_index_write_flags flags)
+{
+	struct oid_array blobs = OID_ARRAY_INIT;
+	struct collect_blobs_data data = {
+		.oids = &blobs,
+		.big_file_threshold = repo_settings_get_big_file_threshold(r),
+	};
+	enum object_type type;
+	size_t size;
+	struct object_info oi = {
+		.typep = &type,
+		.sizep = &size,
+	};
+	struct blob_filter_builder builder = { 0 };
+	struct strbuf filters = STRBUF_INIT;
+	struct lock_file lk = LOCK_INIT;
+	struct grep_index *old;
+	struct progress *progress = NULL;
+	struct hashfile *f;
+	uint32_t fanout[256] = { 0 };
+	uint64_t *offsets;
+	size_t nr = 0, reused = 0;
+	char *path = grep_index_filename(r);
+	int ret = 0;
+
+	if (odb_for_each_object(r->objects, &oi, collect_blob, &data,
+				ODB_FOR_EACH_OBJECT_LOCAL_ONLY)) {
+		ret = error(_("unable to enumerate blobs"));
+		goto out;
+	}
+	oid_array_sort(&blobs);
+
+	old = grep_index_load(r);
+	builder.seen = xcalloc(TRIGRAM_SPACE / 8, 1);
+	ALLOC_ARRAY(offsets, st_add(blobs.nr, 1));
+
+	if (flags & GREP_INDEX_WRITE_PROGRESS)
+		progress = start_delayed_progress(r, _("Indexing blobs for grep"),
+						  blobs.nr);
+	for (size_t i = 0; i < blobs.nr; i++) {
+		const struct object_id *oid = &blobs.oid[i];
+		const unsigned char *filter;
+		size_t len;
+		void *buf;
+
+		display_progress(progress, i + 1);
+		if (nr && oideq(oid, &blobs.oid[nr - 1]))
+			continue;
+
+		offsets[nr] = filters.len;
+		if (old && !grep_index_filter(old, oid, &filter, &len)) {
+			strbuf_add(&filters, filter, len);
+			reused++;
+		} else {
+			buf = odb_read_object(r->objects, oid, &type, &size);
+			if (!buf)
+				continue;
+			compute_blob_filter(&builder, buf, size, &filters);
+			free(buf);
+		}
+		oidcpy(&blobs.oid[nr++], oid);
+	}
+	offsets[nr] = filters.len;
+	stop_progress(&progress);
+
+	for (size_t i = 0; i < nr; i++)
+		fanout[blobs.oid[i].hash[0]]++;
+	for (size_t i = 1; i < ARRAY_SIZE(fanout); i++)
+		fanout[i] += fanout[i - 1];
+
+	if (safe_create_leading_directories(r, path)) {
+		ret = error(_("unable to create leading directories of %s"),
+			    path);
+		goto cleanup;
+	}
+	if (hold_lock_file_for_update_mode(&lk, path, 0, 0444) < 0) {
+		ret = error_errno(_("unable to create '%s.lock'"), path);
+		goto cleanup;
+	}
+	f = hashfd(r->hash_algo, get_lock_file_fd(&lk), get_lock_file_path(&lk));
+
+	hashwrite_be32(f, GREP_INDEX_SIGNATURE);
+	hashwrite_be32(f, GREP_INDEX_VERSION);
+	hashwrite_be32(f, oid_version(r->hash_algo));
+	hashwrite_be32(f, GREP_INDEX_NUM_HASHES);
+	hashwrite_be32(f, nr);
+	for (size_t i = 0; i < ARRAY_SIZE(fanout); i++)
+		hashwrite_be32(f, fanout[i]);
+	for (size_t i = 0; i < nr; i++)
+		hashwrite(f, blobs.oid[i].hash, r->hash_algo->rawsz);
+	for (size_t i = 0; i <= nr; i++)
+		hashwrite_be64(f, offsets[i]);
+	hashwrite(f, filters.buf, filters.len);
+	finalize_hashfile(f, NULL, FSYNC_COMPONENT_PACK_METADATA,
+			  CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+
+	/* The old index must not be mapped while we replace it. */
+	grep_index_free(old);
+	old = NULL;
+	if (commit_lock_file(&lk) < 0)
+		ret = error_errno(_("unable to write %s"), path);
+
+	trace2_data_intmax("grep-index", r, "blobs", nr);
+	trace2_data_intmax("grep-index", r, "reused", reused);
+
+cleanup:
+	grep_index_free(old);
+	free(offsets);
+	free(builder.seen);
+	free(builder.trigrams.v);
+out:
+	strbuf_release(&filters);
+	oid_array_clear(&blobs);
+	free(path);
+	return ret;
+}
@@ -0,0 +1,63 @@
+#ifndef GREP_INDEX_H
+#define GREP_INDEX_H
+
+#define GREP_INDEX_SIGNATURE 0x47524958 /* "GRIX" */
+#define GREP_INDEX_VERSION 1
+
+struct grep_opt;
+struct object_id;
+struct repository;
+
+/*
+ * The grep index stores, for each blob in the object database, a Bloom
+ * filter of the (ASCII-lowercased) three-byte sequences found in its
+ * contents. "git grep" consults it to skip blobs that cannot contain
+ * the literal strings a pattern requires. It lives in
+ * "$GIT_DIR/objects/info/grep-index" and is written by the "grep-index"
+ * maintenance task.
+ */
+struct grep_index;
+
+/*
+ * The trigrams required by the patterns of a grep, as computed by
+ * grep_index_query_new().
+ */
+struct grep_index_query;
+
+/*
+ * Load the grep index of "r", if there is one. Returns NULL if the
+ * repository has no usable grep index.
+ */
+struct grep_index *grep_index_load(struct repository *r);
+void grep_index_free(struct grep_index *gi);
+
+/*
+ * Compute the trigrams that every match of the patterns in "opt" must
+ * contain. Returns NULL if the index cannot help, e.g. because a
+ * pattern has no literal part of at least three bytes, because the
+ * patterns are combined with --not or because of -L.
+ */
+struct grep_index_query *grep_index_query_new(struct grep_opt *opt);
+void grep_index_query_free(struct grep_index_query *q);
+
+/*
+ * Returns 0 if the blob "oid" is known not to match "q", and 1 if it
+ * may match or is not indexed.
+ */
+int grep_index_may_match(struct grep_index *gi,
+			 struct grep_index_query *q,
+			 const struct object_id *oid);
+
+enum grep_index_write_flags {
+	GREP_INDEX_WRITE_PROGRESS = (1 << 0),
+};
+
+/*
+ * Write the grep index of "r", covering all local blobs no larger than
+ * core.bigFileThreshold. Filters of blobs that are already indexed are
+ * carried over without reading the blob again; entries of blobs that
+ * are gone are dropped. Returns 0 on success.
+ */
+int write_grep_index(struct repository *r, enum grep_index_write_flags flags);
+
+#endif /* GREP_INDEX_H */
@@ -2285,6 +2285,130 @@ static void http_opt_request_remainder(CURL *curl, off_t pos)
 #define HTTP_REQUEST_STRBUF	0
 #define HTTP_REQUEST_FILE	1
 
+/*
+ * A file being downloaded by http_request(), possibly appending to a
+ * partial download from an earlier attempt.
+ *
+ * The partial download is only resumed if "validator_path" names a
+ * file holding the ETag or Last-Modified value of the response it came
+ * from. It is sent as "If-Range", so that the server sends the whole
+ * file again if it has changed since.
+ */
+struct http_file_target {
+	FILE *file;
+	const char *validator_path;
+
+	/* Filled in by http_request(). */
+	CURL *curl;
+	off_t resume_from;
+	struct strbuf etag;
+	struct strbuf last_modified;
+	unsigned checked_response : 1,
+		 discard : 1;
+};
+
+#define HTTP_FILE_TARGET_INIT { \
+	.etag = STRBUF_INIT, \
+	.last_modified = STRBUF_INIT, \
+}
+
+static void http_file_target_release(struct http_file_target *target)
+{
+	strbuf_release(&target->etag);
+	strbuf_release(&target->last_modified);
+}
+
+static size_t fwrite_file_target_header(char *ptr, size_t eltsize,
+					size_t nmemb, void *data)
+{
+	struct http_file_target *target = data;
+	size_t size = eltsize * nmemb;
+	struct strbuf *dst = NULL;
+	const char *val;
+	size_t val_len;
+
+	if (size >= 5 && !memcmp(ptr, "HTTP/", 5)) {
+		/* The status line of a new response, e.g. after a redirect. */
+		strbuf_reset(&target->etag);
+		strbuf_reset(&target->last_modified);
+	} else if (skip_iprefix_mem(ptr, size, "etag:", &val, &val_len)) {
+		dst = &target->etag;
+	} else if (skip_iprefix_mem(ptr, size, "last-modified:", &val, &val_len)) {
+		dst = &target->last_modified;
+	}
+	if (dst) {
+		strbuf_reset(dst);
+		strbuf_add(dst, val, val_len);
+		strbuf_trim(dst);
+	}
+
+	return fwrite_wwwauth(ptr, eltsize, nmemb, NULL);
+}
+
+/*
+ * Remember what identifies the version of the file we are downloading.
+ * Weak ETags cannot be used with "If-Range".
+ */
+static void save_file_target_validator(struct http_file_target *target)
+{
+	const char *validator = NULL;
+	FILE *fp;
+
+	if (!target->validator_path)
+		return;
+	if (target->etag.len && !starts_with(target->etag.buf, "W/"))
+		validator = target->etag.buf;
+	else if (target->last_modified.len)
+		validator = target->last_modified.buf;
+
+	if (!validator || !(fp = fopen(target->validator_path, "w"))) {
+		unlink(target->validator_path);
+		return;
+	}
+	if (fprintf(fp, "%s\n", validator) < 0) {
+		fclose(fp);
+		unlink(target->validator_path);
+	} else if (fclose(fp)) {
+		unlink(target->validator_path);
+	}
+}
+
+/*
+ * Only write the body of a successful response to the file, so that
+ * an error page does not end up in the middle of a download we want
+ * to resume later. If we asked for the remainder of the file but the
+ * server sent all of it, start over from the beginning.
+ */
+static size_t fwrite_file_target(char *ptr, size_t eltsize, size_t nmemb,
+				 void *data)
+{
+	struct http_file_target *target = data;
+
+	if (!target->checked_response) {
+		long http_code = 0;
+
+		target->checked_response = 1;
+		curl_easy_getinfo(target->curl, CURLINFO_RESPONSE_CODE,
+				  &http_code);
+		if (http_code >= 300) {
+			target->discard = 1;
+		} else if (!target->resume_from || http_code != 206) {
+			if (target->resume_from &&
+			    (fflush(target->file) ||
+			     ftruncate(fileno(target->file), 0) < 0 ||
+			     fseeko(target->file, 0, SEEK_SET))) {
+				error_errno("unable to restart download");
+				return 0;
+			}
+			save_file_target_validator(target);
+		}
+	}
+
+	if (target->discard)
+		return eltsize * nmemb;
+	return fwrite(ptr, eltsize, nmemb, target->file);
+}
+
 static int http_request(const char *url,
 			void *result, int target,
 			struct http_get_options *options)
@@ -2303,20 +2427,60 @@ static int http_request(const char *url,
 		curl_easy_setopt(slot->curl, CURLOPT_NOBODY, 1L);
 	} else {
 		curl_easy_setopt(slot->curl, CURLOPT_NOBODY, 0L);
-		curl_easy_setopt(slot->curl, CURLOPT_WRITEDATA, result);
 
 		if (target == HTTP_REQUEST_FILE) {
-			off_t posn = ftello(result);
-			curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION,
-					 fwrite);
-			if (posn > 0)
+			struct http_file_target *file_target = result;
+			off_t posn = ftello(file_target->file);
+
+			file_target->curl = slot->curl;
+			file_target->resume_from = 0;
+			file_target->checked_response = 0;
+			file_target->discard = 0;
+			strbuf_reset(&file_target->etag);
+			strbuf_reset(&file_target->last_modified);
+
+			if (posn > 0 && file_target->validator_path &&
+			    strbuf_read_file(&buf, file_target->validator_path, 0) > 0) {
+				strbuf_trim(&buf);
+				strbuf_insertstr(&buf, 0, "If-Range: ");
+				headers = curl_slist_append(headers, buf.buf);
+				file_target->resume_from = posn;
 				http_opt_request_remainder(slot->curl, posn);
-		} else
+				trace2_data_intmax("http", the_repository,
+						   "http/resume-offset", posn);
+			} else if (posn > 0 &&
+				   (fflush(file_target->file) ||
+				    ftruncate(fileno(file_target->file), 0) < 0 ||
+				    fseeko(file_target->file, 0, SEEK_SET))) {
+				/*
+				 * Without a validator we cannot tell whether
+				 * the partial file still matches what the
+				 * server has, so we have to start over.
+				 */
+				strbuf_release(&buf);
+				curl_slist_free_all(headers);
+				error_errno("unable to restart download");
+				return HTTP_START_FAILED;
+			}
+			strbuf_reset(&buf);
+
+			curl_easy_setopt(slot->curl, CURLOPT_WRITEDATA,
+					 file_target);
+			curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION,
+					 fwrite_file_target);
+			curl_easy_setopt(slot->curl, CURLOPT_HEADERDATA,
+					 file_target);
+			curl_easy_setopt(slot->curl, CURLOPT_HEADERFUNCTION,
+					 fwrite_file_target_header);
+		} else {
+			curl_easy_setopt(slot->curl, CURLOPT_WRITEDATA, result);
 			curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION,
 					 fwrite_buffer);
+		}
 	}
 
-	curl_easy_setopt(slot->curl, CURLOPT_HEADERFUNCTION, fwrite_wwwauth);
+	if (target != HTTP_REQUEST_FILE || !result)
+		curl_easy_setopt(slot->curl, CURLOPT_HEADERFUNCTION, fwrite_wwwauth);
 
 	accept_language = http_get_accept_language_header();
 
@@ -2348,6 +2512,13 @@ static int http_request(const char *url,
 
 	ret = run_one_slot(slot, &results);
 
+	if (target == HTTP_REQUEST_FILE && result) {
+		/* Later requests on this handle must not see our target. */
+		curl_easy_setopt(slot->curl, CURLOPT_HEADERDATA, NULL);
+		curl_easy_setopt(slot->curl, CURLOPT_HEADERFUNCTION,
+				 fwrite_wwwauth);
+	}
+
 #ifdef GIT_CURL_HAVE_CURLINFO_RETRY_AFTER
 	if (ret == HTTP_RATE_LIMITED) {
 		curl_off_t retry_after;
@@ -2508,7 +2679,7 @@ static int http_request_recoverable(const char *url,
 			strbuf_reset(result);
 			break;
 		case HTTP_REQUEST_FILE: {
-			FILE *f = result;
+			FILE *f = ((struct http_file_target *)result)->file;
 			if (fflush(f)) {
 				error_errno("unable to flush a file");
 				return HTTP_START_FAILED;
@@ -2566,16 +2737,21 @@ int http_get_strbuf(const char *url,
  * Downloads a URL and stores the result in the given file.
  *
  * If a previous interrupted download is detected (i.e. a previous temporary
- * file is still around) the download is resumed.
+ * file is still around) the download is resumed, unless the server says
+ * that the file changed since. The ETag or Last-Modified value the
+ * partial download started with is kept in "<filename>.validator".
  */
 int http_get_file(const char *url, const char *filename,
 		  struct http_get_options *options)
 {
 	int ret;
 	struct strbuf tmpfile = STRBUF_INIT;
+	struct strbuf validator = STRBUF_INIT;
+	struct http_file_target target = HTTP_FILE_TARGET_INIT;
 	FILE *result;
 
 	strbuf_addf(&tmpfile, "%s.temp", filename);
+	strbuf_addf(&validator, "%s.validator", filename);
 	result = fopen(tmpfile.buf, "a");
 	if (!result) {
 		error("Unable to open local file %s", tmpfile.buf);
@@ -2583,13 +2759,20 @@ int http_get_file(const char *url, const char *filename,
 		goto cleanup;
 	}
 
-	ret = http_request_recoverable(url, result, HTTP_REQUEST_FILE, options);
+	target.file = result;
+	target.validator_path = validator.buf;
+	ret = http_request_recoverable(url, &target, HTTP_REQUEST_FILE, options);
 	fclose(result);
 
-	if (ret == HTTP_OK && finalize_object_file(the_repository, tmpfile.buf, filename))
-		ret = HTTP_ERROR;
+	if (ret == HTTP_OK) {
+		unlink(validator.buf);
+		if (finalize_object_file(the_repository, tmpfile.buf, filename))
+			ret = HTTP_ERROR;
+	}
 cleanup:
+	http_file_target_release(&target);
 	strbuf_release(&tmpfile);
+	strbuf_release(&validator);
 	return ret;
 }
 
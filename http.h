@@ -194,7 +194,9 @@ int http_get_strbuf(const char *url, struct strbuf *result, struct http_get_opti
  * Downloads a URL and stores the result in the given file.
  *
  * If a previous interrupted download is detected (i.e. a previous temporary
- * file is still around) the download is resumed.
+ * file is still around) the download is resumed, unless the server says
+ * that the file changed since. The ETag or Last-Modified value the
+ * partial download started with is kept in "<filename>.validator".
  */
 int http_get_file(const char *url, const char *filename,
 		  struct http_get_options *options);
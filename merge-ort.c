@@ -3441,6 +3441,8 @@ static int detect_regular_renames(struct merge_options *opt,
 	diff_opts.rename_limit = opt->rename_limit;
 	if (opt->rename_limit <= 0)
 		diff_opts.rename_limit = 7000;
+	/* merges must not depend on the diff.renameCandidates setting */
+	diff_opts.approximate_renames = 0;
 	diff_opts.rename_score = opt->rename_score;
 	diff_opts.show_rename_progress = opt->show_rename_progress;
 	diff_opts.output_format = DIFF_FORMAT_NO_OUTPUT;
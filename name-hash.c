@@ -23,6 +23,7 @@
 struct dir_entry {
 	struct hashmap_entry ent;
 	struct dir_entry *parent;
+	struct dir_entry *canonical;
 	int nr;
 	unsigned int namelen;
 	char name[FLEX_ARRAY];
@@ -161,26 +162,11 @@ static int lazy_nr_dir_threads;
  */
 #define LAZY_THREAD_COST (2000)
 
-/*
- * We use n mutexes to guard n partitions of the "istate->dir_hash"
- * hashtable.  Since "find" and "insert" operations will hash to a
- * particular bucket and modify/search a single chain, we can say
- * that "all chains mod n" are guarded by the same mutex -- rather
- * than having a single mutex to guard the entire table.  (This does
- * require that we disable "rehashing" on the hashtable.)
- *
- * So, a larger value here decreases the probability of a collision
- * and the time that each thread must wait for the mutex.
- */
-#define LAZY_MAX_MUTEX   (32)
-
-static pthread_mutex_t *lazy_dir_mutex_array;
-
 /*
  * An array of lazy_entry items is used by the n threads in
  * the directory parse (first) phase to (lock-free) store the
  * intermediate results.  These values are then referenced by
- * the 2 threads in the second phase.
+ * the threads in the later phases.
  */
 struct lazy_entry {
 	struct dir_entry *dir;
@@ -188,6 +174,27 @@ struct lazy_entry {
 	unsigned int hash_name;
 };
 
+/*
+ * Per-thread state of the directory parse phase.  Each "dir" thread
+ * only ever writes to its own "dirs" array and to the cells of
+ * "lazy_entries" in [k_start, k_end), so this phase needs no locks.
+ */
+struct lazy_dir_thread_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	struct lazy_entry *lazy_entries;
+	int k_start;
+	int k_end;
+
+	/*
+	 * Directories seen by this thread in index order.  The same
+	 * (case-insensitive) directory may also be in the arrays of
+	 * other threads; duplicates are resolved in the merge phase.
+	 */
+	struct dir_entry **dirs;
+	size_t dirs_nr, dirs_alloc;
+};
+
 /*
  * Decide if we want to use threads (if available) to load
  * the hash tables.  We set "lazy_nr_dir_threads" to zero when
@@ -223,63 +230,13 @@ static int lookup_lazy_params(struct index_state *istate)
 	return lazy_nr_dir_threads;
 }
 
-/*
- * Initialize n mutexes for use when searching and inserting
- * into "istate->dir_hash".  All "dir" threads are trying
- * to insert partial pathnames into the hash as they iterate
- * over their portions of the index, so lock contention is
- * high.
- *
- * However, the hashmap is going to put items into bucket
- * chains based on their hash values.  Use that to create n
- * mutexes and lock on mutex[bucket(hash) % n].  This will
- * decrease the collision rate by (hopefully) a factor of n.
- */
-static void init_dir_mutex(void)
-{
-	int j;
-
-	CALLOC_ARRAY(lazy_dir_mutex_array, LAZY_MAX_MUTEX);
-
-	for (j = 0; j < LAZY_MAX_MUTEX; j++)
-		init_recursive_mutex(&lazy_dir_mutex_array[j]);
-}
-
-static void cleanup_dir_mutex(void)
-{
-	int j;
-
-	for (j = 0; j < LAZY_MAX_MUTEX; j++)
-		pthread_mutex_destroy(&lazy_dir_mutex_array[j]);
-
-	free(lazy_dir_mutex_array);
-}
-
-static void lock_dir_mutex(int j)
-{
-	pthread_mutex_lock(&lazy_dir_mutex_array[j]);
-}
-
-static void unlock_dir_mutex(int j)
-{
-	pthread_mutex_unlock(&lazy_dir_mutex_array[j]);
-}
-
-static inline int compute_dir_lock_nr(
-	const struct hashmap *map,
-	unsigned int hash)
-{
-	return hashmap_bucket(map, hash) % LAZY_MAX_MUTEX;
-}
-
 static struct dir_entry *hash_dir_entry_with_parent_and_prefix(
-	struct index_state *istate,
+	struct lazy_dir_thread_data *d,
 	struct dir_entry *parent,
 	struct strbuf *prefix)
 {
 	struct dir_entry *dir;
 	unsigned int hash;
-	int lock_nr;
 
 	/*
 	 * Either we have a parent directory and path with slash(es)
@@ -294,28 +251,19 @@ static struct dir_entry *hash_dir_entry_with_parent_and_prefix(
 	else
 		hash = memihash(prefix->buf, prefix->len);
 
-	lock_nr = compute_dir_lock_nr(&istate->dir_hash, hash);
-	lock_dir_mutex(lock_nr);
-
-	dir = find_dir_entry__hash(istate, prefix->buf, prefix->len, hash);
-	if (!dir) {
-		FLEX_ALLOC_MEM(dir, name, prefix->buf, prefix->len);
-		hashmap_entry_init(&dir->ent, hash);
-		dir->namelen = prefix->len;
-		dir->parent = parent;
-		hashmap_add(&istate->dir_hash, &dir->ent);
-
-		if (parent) {
-			unlock_dir_mutex(lock_nr);
-
-			/* All I really need here is an InterlockedIncrement(&(parent->nr)) */
-			lock_nr = compute_dir_lock_nr(&istate->dir_hash, parent->ent.hash);
-			lock_dir_mutex(lock_nr);
-			parent->nr++;
-		}
-	}
+	/*
+	 * The index is sorted, so this thread sees each directory in
+	 * its range exactly once (modulo case) and there is no need to
+	 * look it up first.  The entry is not added to the shared
+	 * "istate->dir_hash" here; see lazy_merge_thread_proc().
+	 */
+	FLEX_ALLOC_MEM(dir, name, prefix->buf, prefix->len);
+	hashmap_entry_init(&dir->ent, hash);
+	dir->namelen = prefix->len;
+	dir->parent = parent;
 
-	unlock_dir_mutex(lock_nr);
+	ALLOC_GROW(d->dirs, d->dirs_nr + 1, d->dirs_alloc);
+	d->dirs[d->dirs_nr++] = dir;
 
 	return dir;
 }
@@ -328,27 +276,26 @@ static struct dir_entry *hash_dir_entry_with_parent_and_prefix(
  * directory.
  */
 static int handle_range_1(
-	struct index_state *istate,
+	struct lazy_dir_thread_data *d,
 	int k_start,
 	int k_end,
 	struct dir_entry *parent,
-	struct strbuf *prefix,
-	struct lazy_entry *lazy_entries);
+	struct strbuf *prefix);
 
 static int handle_range_dir(
-	struct index_state *istate,
+	struct lazy_dir_thread_data *d,
 	int k_start,
 	int k_end,
 	struct dir_entry *parent,
 	struct strbuf *prefix,
-	struct lazy_entry *lazy_entries,
 	struct dir_entry **dir_new_out)
 {
+	struct index_state *istate = d->istate;
 	int rc, k;
 	int input_prefix_len = prefix->len;
 	struct dir_entry *dir_new;
 
-	dir_new = hash_dir_entry_with_parent_and_prefix(istate, parent, prefix);
+	dir_new = hash_dir_entry_with_parent_and_prefix(d, parent, prefix);
 
 	strbuf_addch(prefix, '/');
 
@@ -382,7 +329,7 @@ static int handle_range_dir(
 	/*
 	 * Recurse and process what we can of this subset [k_start, k).
 	 */
-	rc = handle_range_1(istate, k_start, k, dir_new, prefix, lazy_entries);
+	rc = handle_range_1(d, k_start, k, dir_new, prefix);
 
 	strbuf_setlen(prefix, input_prefix_len);
 
@@ -391,13 +338,14 @@ static int handle_range_dir(
 }
 
 static int handle_range_1(
-	struct index_state *istate,
+	struct lazy_dir_thread_data *d,
 	int k_start,
 	int k_end,
 	struct dir_entry *parent,
-	struct strbuf *prefix,
-	struct lazy_entry *lazy_entries)
+	struct strbuf *prefix)
 {
+	struct index_state *istate = d->istate;
+	struct lazy_entry *lazy_entries = d->lazy_entries;
 	int input_prefix_len = prefix->len;
 	int k = k_start;
 
@@ -417,7 +365,7 @@ static int handle_range_1(
 			struct dir_entry *dir_new;
 
 			strbuf_add(prefix, name, len);
-			processed = handle_range_dir(istate, k, k_end, parent, prefix, lazy_entries, &dir_new);
+			processed = handle_range_dir(d, k, k_end, parent, prefix, &dir_new);
 			if (processed) {
 				k += processed;
 				strbuf_setlen(prefix, input_prefix_len);
@@ -425,20 +373,19 @@ static int handle_range_1(
 			}
 
 			strbuf_addch(prefix, '/');
-			processed = handle_range_1(istate, k, k_end, dir_new, prefix, lazy_entries);
+			processed = handle_range_1(d, k, k_end, dir_new, prefix);
 			k += processed;
 			strbuf_setlen(prefix, input_prefix_len);
 			continue;
 		}
 
 		/*
-		 * It is too expensive to take a lock to insert "ce_k"
-		 * into "istate->name_hash" and increment the ref-count
-		 * on the "parent" dir.  So we defer actually updating
-		 * permanent data structures until phase 2 (where we
-		 * can change the locking requirements) and simply
-		 * accumulate our current results into the lazy_entries
-		 * data array).
+		 * Do not insert "ce_k" into "istate->name_hash" or
+		 * increment the ref-count on the "parent" dir here;
+		 * other threads may be doing the same.  Defer updating
+		 * permanent data structures until the later phases and
+		 * simply accumulate our current results into the
+		 * lazy_entries data array.
 		 *
 		 * We do not need to lock the lazy_entries array because
 		 * we have exclusive access to the cells in the range
@@ -461,23 +408,72 @@ static int handle_range_1(
 	return k - k_start;
 }
 
-struct lazy_dir_thread_data {
-	pthread_t pthread;
-	struct index_state *istate;
-	struct lazy_entry *lazy_entries;
-	int k_start;
-	int k_end;
-};
-
 static void *lazy_dir_thread_proc(void *_data)
 {
 	struct lazy_dir_thread_data *d = _data;
 	struct strbuf prefix = STRBUF_INIT;
-	handle_range_1(d->istate, d->k_start, d->k_end, NULL, &prefix, d->lazy_entries);
+	handle_range_1(d, d->k_start, d->k_end, NULL, &prefix);
 	strbuf_release(&prefix);
 	return NULL;
 }
 
+/*
+ * The "merge" threads move the directories found by the "dir" threads
+ * into "istate->dir_hash".  Each thread owns the buckets whose number
+ * is congruent to "partition" modulo "nr_partitions".  A find or an
+ * insert only touches the chain of a single bucket, so the threads
+ * never access the same chain and need no locks.  (This does require
+ * that we disable rehashing on the hashtable.)
+ *
+ * A directory that is already in the hashtable, because another
+ * thread (or another spelling in the same thread) got there first,
+ * is marked as a duplicate of that entry.  Since the arrays are
+ * visited in index order, the spelling that wins is the same as
+ * the one chosen by the single-threaded code.
+ */
+struct lazy_merge_thread_data {
+	pthread_t pthread;
+	struct index_state *istate;
+	struct lazy_dir_thread_data *td_dir;
+	int partition;
+	int nr_partitions;
+};
+
+static void *lazy_merge_thread_proc(void *_data)
+{
+	struct lazy_merge_thread_data *d = _data;
+	struct hashmap *map = &d->istate->dir_hash;
+	int t;
+	size_t i;
+
+	for (t = 0; t < lazy_nr_dir_threads; t++) {
+		struct lazy_dir_thread_data *td_dir_t = d->td_dir + t;
+
+		for (i = 0; i < td_dir_t->dirs_nr; i++) {
+			struct dir_entry *dir = td_dir_t->dirs[i];
+			struct dir_entry *found;
+
+			if (hashmap_bucket(map, dir->ent.hash) % d->nr_partitions !=
+			    d->partition)
+				continue;
+
+			found = find_dir_entry__hash(d->istate, dir->name,
+						     dir->namelen, dir->ent.hash);
+			if (found)
+				dir->canonical = found;
+			else
+				hashmap_add(map, &dir->ent);
+		}
+	}
+
+	return NULL;
+}
+
+static inline struct dir_entry *canonical_dir(struct dir_entry *dir)
+{
+	return dir && dir->canonical ? dir->canonical : dir;
+}
+
 struct lazy_name_thread_data {
 	pthread_t pthread;
 	struct index_state *istate;
@@ -501,15 +497,41 @@ static void *lazy_name_thread_proc(void *_data)
 	return NULL;
 }
 
-static inline void lazy_update_dir_ref_counts(
+/*
+ * Point all directories at their canonical parent, compute the
+ * ref-counts from the surviving directories and the index entries,
+ * and free the duplicates.
+ */
+static void lazy_update_dir_ref_counts(
 	struct index_state *istate,
-	struct lazy_entry *lazy_entries)
+	struct lazy_entry *lazy_entries,
+	struct lazy_dir_thread_data *td_dir)
 {
-	int k;
+	int k, t;
+	size_t i;
+
+	for (t = 0; t < lazy_nr_dir_threads; t++) {
+		for (i = 0; i < td_dir[t].dirs_nr; i++) {
+			struct dir_entry *dir = td_dir[t].dirs[i];
+
+			if (dir->canonical)
+				continue;
+			dir->parent = canonical_dir(dir->parent);
+			if (dir->parent)
+				dir->parent->nr++;
+		}
+	}
 
 	for (k = 0; k < istate->cache_nr; k++) {
 		if (lazy_entries[k].dir)
-			lazy_entries[k].dir->nr++;
+			canonical_dir(lazy_entries[k].dir)->nr++;
+	}
+
+	for (t = 0; t < lazy_nr_dir_threads; t++) {
+		for (i = 0; i < td_dir[t].dirs_nr; i++)
+			if (td_dir[t].dirs[i]->canonical)
+				free(td_dir[t].dirs[i]);
+		free(td_dir[t].dirs);
 	}
 }
 
@@ -522,6 +544,7 @@ static void threaded_lazy_init_name_hash(
 	int t;
 	struct lazy_entry *lazy_entries;
 	struct lazy_dir_thread_data *td_dir;
+	struct lazy_merge_thread_data *td_merge;
 	struct lazy_name_thread_data *td_name;
 
 	if (!HAVE_THREADS)
@@ -532,13 +555,13 @@ static void threaded_lazy_init_name_hash(
 
 	CALLOC_ARRAY(lazy_entries, istate->cache_nr);
 	CALLOC_ARRAY(td_dir, lazy_nr_dir_threads);
+	CALLOC_ARRAY(td_merge, lazy_nr_dir_threads);
 	CALLOC_ARRAY(td_name, 1);
 
-	init_dir_mutex();
-
 	/*
 	 * Phase 1:
-	 * Build "istate->dir_hash" using n "dir" threads (and a read-only index).
+	 * Collect the directories using n "dir" threads (and a read-only
+	 * index) into per-thread arrays.
 	 */
 	for (t = 0; t < lazy_nr_dir_threads; t++) {
 		struct lazy_dir_thread_data *td_dir_t = td_dir + t;
@@ -565,9 +588,8 @@ static void threaded_lazy_init_name_hash(
 	 * using a single "name" background thread.
 	 * (Testing showed it wasn't worth running more than 1 thread for this.)
 	 *
-	 * Meanwhile, finish updating the parent directory ref-counts for each
-	 * index entry using the current thread.  (This step is very fast and
-	 * doesn't need threading.)
+	 * Meanwhile, build "istate->dir_hash" using n "merge" threads that
+	 * each own a disjoint set of buckets.
 	 */
 	td_name->istate = istate;
 	td_name->lazy_entries = lazy_entries;
@@ -575,15 +597,36 @@ static void threaded_lazy_init_name_hash(
 	if (err)
 		die(_("unable to create lazy_name thread: %s"), strerror(err));
 
-	lazy_update_dir_ref_counts(istate, lazy_entries);
+	for (t = 0; t < lazy_nr_dir_threads; t++) {
+		struct lazy_merge_thread_data *td_merge_t = td_merge + t;
+		td_merge_t->istate = istate;
+		td_merge_t->td_dir = td_dir;
+		td_merge_t->partition = t;
+		td_merge_t->nr_partitions = lazy_nr_dir_threads;
+		err = pthread_create(&td_merge_t->pthread, NULL, lazy_merge_thread_proc, td_merge_t);
+		if (err)
+			die(_("unable to create lazy_merge thread: %s"), strerror(err));
+	}
+	for (t = 0; t < lazy_nr_dir_threads; t++) {
+		struct lazy_merge_thread_data *td_merge_t = td_merge + t;
+		if (pthread_join(td_merge_t->pthread, NULL))
+			die("unable to join lazy_merge_thread");
+	}
+
+	/*
+	 * Phase 3:
+	 * Finish updating the parent directory ref-counts using the
+	 * current thread.  (This step is very fast and doesn't need
+	 * threading.)
+	 */
+	lazy_update_dir_ref_counts(istate, lazy_entries, td_dir);
 
 	err = pthread_join(td_name->pthread, NULL);
 	if (err)
 		die(_("unable to join lazy_name thread: %s"), strerror(err));
 
-	cleanup_dir_mutex();
-
 	free(td_name);
+	free(td_merge);
 	free(td_dir);
 	free(lazy_entries);
 }
@@ -601,9 +644,10 @@ static void lazy_init_name_hash(struct index_state *istate)
 	if (lookup_lazy_params(istate)) {
 		/*
 		 * Disable item counting and automatic rehashing because
-		 * we do per-chain (mod n) locking rather than whole hashmap
-		 * locking and we need to prevent the table-size from changing
-		 * and bucket items from being redistributed.
+		 * the merge threads each own a subset of the chains rather
+		 * than locking the whole hashmap and we need to prevent the
+		 * table-size from changing and bucket items from being
+		 * redistributed.
 		 */
 		hashmap_disable_item_counting(&istate->dir_hash);
 		threaded_lazy_init_name_hash(istate);
@@ -4,7 +4,12 @@
 struct cache_entry;
 struct index_state;
 
-
+/*
+ * The lookup functions below initialize the name hash on first use.
+ * Once it has been initialized (and as long as the index is not sparse
+ * and is not modified), they only read from it and may be called from
+ * several threads at the same time.
+ */
 int index_dir_find(struct index_state *istate, const char *name, int namelen,
 		   struct strbuf *canonical_path);
 
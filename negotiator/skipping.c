@@ -5,6 +5,7 @@
 #include "../commit.h"
 #include "../fetch-negotiator.h"
 #include "../hex.h"
+#include "../oidset.h"
 #include "../prio-queue.h"
 #include "../refs.h"
 #include "../repository.h"
@@ -30,6 +31,66 @@
  */
 #define POPPED		(1U << 5)
 
+/* Beyond this, the gap between two haves stops growing. */
+#define MAX_GAP (1U << 30)
+
+/*
+ * What sets the "skipping" negotiator and its "generation" variant
+ * apart.
+ */
+struct skipping_ops {
+	/* The order in which commits are visited. */
+	prio_queue_compare_fn compare_commits;
+
+	/* The gap to leave after sending a have that followed "gap". */
+	uint32_t (*next_gap)(uint32_t gap);
+
+	/* Visit the tips of remote-tracking refs before anything else. */
+	unsigned remote_tips_first : 1;
+
+	/* See "initial_haves" in struct fetch_negotiator. */
+	int initial_haves;
+};
+
+static uint32_t skipping_next_gap(uint32_t gap)
+{
+	return gap < MAX_GAP ? gap * 3 / 2 + 1 : gap;
+}
+
+static const struct skipping_ops skipping_ops = {
+	.compare_commits = compare_commits_by_commit_date,
+	.next_gap = skipping_next_gap,
+};
+
+static uint32_t generation_next_gap(uint32_t gap)
+{
+	return gap < MAX_GAP ? gap * 2 + 1 : gap;
+}
+
+/*
+ * Like "skipping", but:
+ *
+ *  - Commits are visited by generation number, so that (within the
+ *    commit-graph) no commit is visited before its descendants, whatever
+ *    their dates say, and the distances really are distances in the
+ *    history.
+ *
+ *  - The gap doubles with every commit sent, so that a history of n
+ *    commits below a tip takes about log2(n) haves to cover.
+ *
+ *  - Tips of remote-tracking refs are sent first, since they are the
+ *    commits most likely to be known to the server already.
+ *
+ *  - As each have covers more history, more of them go into the first
+ *    request.
+ */
+static const struct skipping_ops generation_ops = {
+	.compare_commits = compare_commits_by_gen_then_commit_date,
+	.next_gap = generation_next_gap,
+	.remote_tips_first = 1,
+	.initial_haves = 64,
+};
+
 static int marked;
 
 /*
@@ -39,35 +100,52 @@ struct entry {
 	struct commit *commit;
 
 	/*
-	 * Used only if commit is not COMMON.
+	 * Used only if commit is not COMMON: the number of commits
+	 * between the last commit sent and the next one, and how many
+	 * of them are left to be skipped.
 	 */
-	uint16_t original_ttl;
-	uint16_t ttl;
+	uint32_t gap;
+	uint32_t skip;
+
+	unsigned remote_tip : 1;
 };
 
 struct data {
+	const struct skipping_ops *ops;
+
 	struct prio_queue rev_list;
 
 	/*
 	 * The number of non-COMMON commits in rev_list.
 	 */
 	int non_common_revs;
+
+	/*
+	 * What the remote-tracking refs point to, if ops->remote_tips_first.
+	 */
+	struct oidset remote_tips;
 };
 
-static int compare(const void *a_, const void *b_, void *data UNUSED)
+static int compare(const void *a_, const void *b_, void *data_)
 {
 	const struct entry *a = a_;
 	const struct entry *b = b_;
-	return compare_commits_by_commit_date(a->commit, b->commit, NULL);
+	struct data *data = data_;
+
+	if (a->remote_tip != b->remote_tip)
+		return a->remote_tip ? -1 : 1;
+	return data->ops->compare_commits(a->commit, b->commit, NULL);
 }
 
-static struct entry *rev_list_push(struct data *data, struct commit *commit, int mark)
+static struct entry *rev_list_push(struct data *data, struct commit *commit,
+				   int mark, unsigned remote_tip)
 {
 	struct entry *entry;
 	commit->object.flags |= mark | SEEN;
 
 	CALLOC_ARRAY(entry, 1);
 	entry->commit = commit;
+	entry->remote_tip = remote_tip;
 	prio_queue_put(&data->rev_list, entry);
 
 	if (!(mark & COMMON))
@@ -86,6 +164,14 @@ static int clear_marks(const struct reference *ref, void *cb_data UNUSED)
 	return 0;
 }
 
+static int add_remote_tip(const struct reference *ref, void *cb_data)
+{
+	struct data *data = cb_data;
+
+	oidset_insert(&data->remote_tips, ref->oid);
+	return 0;
+}
+
 /*
  * Mark this SEEN commit and all its parsed SEEN ancestors as COMMON.
  */
@@ -122,7 +208,7 @@ static void mark_common(struct data *data, struct commit *seen_commit)
 
 /*
  * Ensure that the priority queue has an entry for to_push, and ensure that the
- * entry has the correct flags and ttl.
+ * entry has the correct flags and gap.
  *
  * This function returns 1 if an entry was found or created, and 0 otherwise
  * (because the entry for this commit had already been popped).
@@ -131,13 +217,15 @@ static int push_parent(struct data *data, struct entry *entry,
 		       struct commit *to_push)
 {
 	struct entry *parent_entry;
+	uint32_t gap, skip;
 
 	if (to_push->object.flags & SEEN) {
 		if (to_push->object.flags & POPPED)
 			/*
 			 * The entry for this commit has already been popped,
-			 * due to clock skew. Pretend that this parent does not
-			 * exist.
+			 * due to clock skew or because it is the tip of a
+			 * remote-tracking ref. Pretend that this parent does
+			 * not exist.
 			 */
 			return 0;
 		/*
@@ -152,20 +240,25 @@ static int push_parent(struct data *data, struct entry *entry,
 parent_found:
 		;
 	} else {
-		parent_entry = rev_list_push(data, to_push, 0);
+		parent_entry = rev_list_push(data, to_push, 0, 0);
 	}
 
 	if (entry->commit->object.flags & (COMMON | ADVERTISED)) {
 		mark_common(data, to_push);
+		return 1;
+	}
+
+	if (entry->skip) {
+		gap = entry->gap;
+		skip = entry->skip - 1;
 	} else {
-		uint16_t new_original_ttl = entry->ttl
-			? entry->original_ttl : entry->original_ttl * 3 / 2 + 1;
-		uint16_t new_ttl = entry->ttl
-			? entry->ttl - 1 : new_original_ttl;
-		if (parent_entry->original_ttl < new_original_ttl) {
-			parent_entry->original_ttl = new_original_ttl;
-			parent_entry->ttl = new_ttl;
-		}
+		/* entry->commit is being sent; leave a wider gap */
+		gap = data->ops->next_gap(entry->gap);
+		skip = gap;
+	}
+	if (parent_entry->gap < gap) {
+		parent_entry->gap = gap;
+		parent_entry->skip = skip;
 	}
 
 	return 1;
@@ -190,7 +283,7 @@ static const struct object_id *get_rev(struct data *data)
 		if (!(commit->object.flags & COMMON))
 			data->non_common_revs--;
 
-		if (!(commit->object.flags & COMMON) && !entry->ttl)
+		if (!(commit->object.flags & COMMON) && !entry->skip)
 			to_send = commit;
 
 		repo_parse_commit(the_repository, commit);
@@ -215,15 +308,18 @@ static void known_common(struct fetch_negotiator *n, struct commit *c)
 {
 	if (c->object.flags & SEEN)
 		return;
-	rev_list_push(n->data, c, ADVERTISED);
+	rev_list_push(n->data, c, ADVERTISED, 0);
 }
 
 static void add_tip(struct fetch_negotiator *n, struct commit *c)
 {
+	struct data *data = n->data;
+
 	n->known_common = NULL;
 	if (c->object.flags & SEEN)
 		return;
-	rev_list_push(n->data, c, 0);
+	rev_list_push(data, c, 0,
+		      oidset_contains(&data->remote_tips, &c->object.oid));
 }
 
 static const struct object_id *next(struct fetch_negotiator *n)
@@ -256,10 +352,12 @@ static void release(struct fetch_negotiator *n)
 	for (size_t i = 0; i < data->rev_list.nr; i++)
 		free(data->rev_list.array[i].data);
 	clear_prio_queue(&data->rev_list);
+	oidset_clear(&data->remote_tips);
 	FREE_AND_NULL(data);
 }
 
-void skipping_negotiator_init(struct fetch_negotiator *negotiator)
+static void init(struct fetch_negotiator *negotiator,
+		 const struct skipping_ops *ops)
 {
 	struct data *data;
 	negotiator->known_common = known_common;
@@ -268,11 +366,29 @@ void skipping_negotiator_init(struct fetch_negotiator *negotiator)
 	negotiator->ack = ack;
 	negotiator->have_sent = have_sent;
 	negotiator->release = release;
+	negotiator->initial_haves = ops->initial_haves;
 	negotiator->data = CALLOC_ARRAY(data, 1);
+	data->ops = ops;
 	data->rev_list.compare = compare;
+	data->rev_list.cb_data = data;
+	oidset_init(&data->remote_tips, 0);
 
 	if (marked)
 		refs_for_each_ref(get_main_ref_store(the_repository),
 				  clear_marks, NULL);
 	marked = 1;
+
+	if (ops->remote_tips_first)
+		refs_for_each_remote_ref(get_main_ref_store(the_repository),
+					 add_remote_tip, data);
+}
+
+void skipping_negotiator_init(struct fetch_negotiator *negotiator)
+{
+	init(negotiator, &skipping_ops);
+}
+
+void generation_negotiator_init(struct fetch_negotiator *negotiator)
+{
+	init(negotiator, &generation_ops);
 }
@@ -4,5 +4,6 @@
 struct fetch_negotiator;
 
 void skipping_negotiator_init(struct fetch_negotiator *negotiator);
+void generation_negotiator_init(struct fetch_negotiator *negotiator);
 
 #endif
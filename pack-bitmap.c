@@ -2298,24 +2298,33 @@ static int try_partial_reuse(struct bitmap_index *bitmap_git,
 		if (!base_offset)
 			return 0;
 
-		offset_to_pack_pos(pack->p, base_offset, &base_pos);
-
 		if (bitmap_is_midx(bitmap_git)) {
-			/*
-			 * Cross-pack deltas are rejected for now, but could
-			 * theoretically be supported in the future.
-			 *
-			 * We would need to ensure that we're sending both
-			 * halves of the delta/base pair, regardless of whether
-			 * or not the two cross a pack boundary. If they do,
-			 * then we must convert the delta to an REF_DELTA to
-			 * refer back to the base in the other pack.
-			 * */
 			if (midx_pair_to_pack_pos(bitmap_git->midx,
 						  pack->pack_int_id,
 						  base_offset,
 						  &base_bitmap_pos) < 0) {
-				return 0;
+				struct object_id base_oid;
+				int pos;
+
+				/*
+				 * The MIDX picked the base from a different
+				 * pack. We can still send the delta, as long
+				 * as that copy of the base is being reused,
+				 * too. Since packs are written in bitmap
+				 * order, it then comes before us in the
+				 * output, and write_reused_pack_one() turns
+				 * the delta into a REF_DELTA pointing at it.
+				 */
+				if (offset_to_pack_pos(pack->p, base_offset,
+						       &base_pos) < 0)
+					return 0;
+				nth_packed_object_id(&base_oid, pack->p,
+						     pack_pos_to_index(pack->p, base_pos));
+
+				pos = bitmap_position_midx(bitmap_git, &base_oid);
+				if (pos < 0)
+					return 0;
+				base_bitmap_pos = pos;
 			}
 		} else {
 			if (offset_to_pack_pos(pack->p, base_offset,
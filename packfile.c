@@ -451,7 +451,7 @@ void close_pack(struct packed_git *p)
 
 void unlink_pack_path(const char *pack_name, int force_delete)
 {
-	static const char *exts[] = {".idx", ".pack", ".rev", ".keep", ".bitmap", ".promisor", ".mtimes"};
+	static const char *exts[] = {".idx", ".pack", ".rev", ".keep", ".bitmap", ".promisor", ".mtimes", ".islands"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -1019,7 +1019,8 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	    ends_with(file_name, ".bitmap") ||
 	    ends_with(file_name, ".keep") ||
 	    ends_with(file_name, ".promisor") ||
-	    ends_with(file_name, ".mtimes"))
+	    ends_with(file_name, ".mtimes") ||
+	    ends_with(file_name, ".islands"))
 		string_list_append(data->garbage, full_name);
 	else
 		report_garbage(PACKDIR_FILE_GARBAGE, full_name);
@@ -1952,8 +1953,16 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
 		} else {
+			/*
+			 * Both "base" (which was detached from the delta
+			 * base cache, if it came from there) and
+			 * "delta_data" are ours alone, so let other threads
+			 * read objects while we apply the delta.
+			 */
+			obj_read_unlock();
 			data = patch_delta(base, base_size, delta_data,
 					   delta_size, &size);
+			obj_read_lock();
 
 			/*
 			 * We could not apply the delta; warn the user, but
@@ -204,6 +204,7 @@ static int do_packet_write(const int fd_out, const char *buf, size_t size,
 {
 	char header[4];
 	size_t packet_size;
+	struct iovec iov[2];
 
 	if (size > LARGE_PACKET_DATA_MAX) {
 		strbuf_addstr(err, _("packet write failed - data exceeds max packet size"));
@@ -219,11 +220,15 @@ static int do_packet_write(const int fd_out, const char *buf, size_t size,
 	 * Write the header and the buffer in 2 parts so that we do
 	 * not need to allocate a buffer or rely on a static buffer.
 	 * This also avoids putting a large buffer on the stack which
-	 * might have multi-threading issues.
+	 * might have multi-threading issues. Both parts still go out
+	 * with a single writev() call.
 	 */
+	iov[0].iov_base = header;
+	iov[0].iov_len = 4;
+	iov[1].iov_base = (char *)buf;
+	iov[1].iov_len = size;
 
-	if (write_in_full(fd_out, header, 4) < 0 ||
-	    write_in_full(fd_out, buf, size) < 0) {
+	if (writev_in_full(fd_out, iov, 2) < 0) {
 		strbuf_addf(err, _("packet write failed: %s"), strerror(errno));
 		return -1;
 	}
@@ -20,6 +20,10 @@
 #include "trace2.h"
 #include "config.h"
 
+#ifdef HAVE_STATX
+#include <sys/sysmacros.h>
+#endif
+
 static struct fscache *fscache;
 
 /*
@@ -43,9 +47,86 @@ struct thread_data {
 	struct pathspec pathspec;
 	struct progress_data *progress;
 	int offset, nr;
+	int stat_dont_sync;
 	int t2_nr_lstat;
+	int t2_nr_opendir;
+};
+
+#ifdef HAVE_STATX
+/*
+ * The index is sorted, so a thread walking its slice sees the entries
+ * of each directory back to back.  Keep the directory open and stat
+ * the entries relative to it, so the kernel does not have to walk the
+ * whole leading path again for every file.
+ */
+struct stat_dir {
+	int fd;
+	struct strbuf path;
 };
 
+#define STAT_DIR_INIT { .fd = AT_FDCWD, .path = STRBUF_INIT }
+
+static void stat_dir_release(struct stat_dir *dir)
+{
+	if (dir->fd >= 0)
+		close(dir->fd);
+	dir->fd = AT_FDCWD;
+	strbuf_release(&dir->path);
+}
+
+/*
+ * lstat() the entry `name` using statx() relative to its (cached)
+ * leading directory.  With `dont_sync`, let network filesystems answer
+ * from their attribute cache instead of revalidating with the server.
+ */
+static int preload_lstat(struct thread_data *p, struct stat_dir *dir,
+			 const char *name, struct stat *st)
+{
+	const char *slash = strrchr(name, '/');
+	size_t dirlen = slash ? slash - name : 0;
+	struct statx stx;
+	int flags = AT_SYMLINK_NOFOLLOW;
+
+	if (dirlen != dir->path.len || memcmp(name, dir->path.buf, dirlen)) {
+		if (dir->fd >= 0)
+			close(dir->fd);
+		dir->fd = AT_FDCWD;
+		strbuf_reset(&dir->path);
+		strbuf_add(&dir->path, name, dirlen);
+		if (dirlen) {
+#ifdef O_PATH
+			dir->fd = open(dir->path.buf, O_PATH | O_DIRECTORY | O_CLOEXEC);
+#else
+			dir->fd = open(dir->path.buf, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+#endif
+			p->t2_nr_opendir++;
+		}
+	}
+	if (dir->fd < 0 && dir->fd != AT_FDCWD)
+		return lstat(name, st); /* let lstat() report the error */
+
+	if (p->stat_dont_sync)
+		flags |= AT_STATX_DONT_SYNC;
+	if (statx(dir->fd, slash ? slash + 1 : name, flags,
+		  STATX_BASIC_STATS, &stx))
+		return -1;
+
+	memset(st, 0, sizeof(*st));
+	st->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+	st->st_ino = stx.stx_ino;
+	st->st_mode = stx.stx_mode;
+	st->st_nlink = stx.stx_nlink;
+	st->st_uid = stx.stx_uid;
+	st->st_gid = stx.stx_gid;
+	st->st_size = stx.stx_size;
+	st->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+	st->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+	st->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+	st->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+	return 0;
+}
+#endif
+
 static void *preload_thread(void *_data)
 {
 	int nr, last_nr;
@@ -53,6 +134,9 @@ static void *preload_thread(void *_data)
 	struct index_state *index = p->index;
 	struct cache_entry **cep = index->cache + p->offset;
 	struct cache_def cache = CACHE_DEF_INIT;
+#ifdef HAVE_STATX
+	struct stat_dir dir = STAT_DIR_INIT;
+#endif
 
 	nr = p->nr;
 	if (nr + p->offset > index->cache_nr)
@@ -88,8 +172,13 @@ static void *preload_thread(void *_data)
 		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
 			continue;
 		p->t2_nr_lstat++;
+#ifdef HAVE_STATX
+		if (preload_lstat(p, &dir, ce->name, &st))
+			continue;
+#else
 		if (lstat(ce->name, &st))
 			continue;
+#endif
 		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR))
 			continue;
 		ce_mark_uptodate(ce);
@@ -103,6 +192,9 @@ static void *preload_thread(void *_data)
 		pthread_mutex_unlock(&pd->mutex);
 	}
 	cache_def_clear(&cache);
+#ifdef HAVE_STATX
+	stat_dir_release(&dir);
+#endif
 	merge_fscache(fscache);
 	return NULL;
 }
@@ -115,9 +207,12 @@ void preload_index(struct index_state *index,
 	struct thread_data data[MAX_PARALLEL];
 	struct progress_data pd;
 	int t2_sum_lstat = 0;
+	int t2_sum_opendir = 0;
 	int core_preload_index = 1;
+	int stat_dont_sync = 0;
 
 	repo_config_get_bool(index->repo, "core.preloadindex", &core_preload_index);
+	repo_config_get_bool(index->repo, "core.statdontsync", &stat_dont_sync);
 
 	if (!HAVE_THREADS || !core_preload_index)
 		return;
@@ -155,6 +250,7 @@ void preload_index(struct index_state *index,
 			copy_pathspec(&p->pathspec, pathspec);
 		p->offset = offset;
 		p->nr = work;
+		p->stat_dont_sync = stat_dont_sync;
 		if (pd.progress)
 			p->progress = &pd;
 		offset += work;
@@ -168,6 +264,7 @@ void preload_index(struct index_state *index,
 		if (pthread_join(p->pthread, NULL))
 			die("unable to join threaded lstat");
 		t2_sum_lstat += p->t2_nr_lstat;
+		t2_sum_opendir += p->t2_nr_opendir;
 	}
 	stop_progress(&pd.progress);
 
@@ -180,6 +277,7 @@ void preload_index(struct index_state *index,
 	trace_performance_leave("preload index");
 
 	trace2_data_intmax("index", NULL, "preload/sum_lstat", t2_sum_lstat);
+	trace2_data_intmax("index", NULL, "preload/sum_opendir", t2_sum_opendir);
 	trace2_region_leave("index", "preload", NULL);
 }
 
@@ -329,6 +329,7 @@ static struct {
 	{".rev", 1},
 	{".mtimes", 1},
 	{".bitmap", 1},
+	{".islands", 1},
 	{".promisor", 1},
 	{".idx"},
 };
@@ -14,6 +14,7 @@ enum fetch_negotiation_setting {
 	FETCH_NEGOTIATION_CONSECUTIVE,
 	FETCH_NEGOTIATION_SKIPPING,
 	FETCH_NEGOTIATION_NOOP,
+	FETCH_NEGOTIATION_GENERATION,
 };
 
 enum log_refs_config {
@@ -33,6 +34,7 @@ struct repo_settings {
 	int fetch_write_commit_graph;
 	int command_requires_full_index;
 	int sparse_index;
+	int forbid_sparse_index_expansion;
 	int pack_read_reverse_index;
 	int pack_use_bitmap_boundary_traversal;
 	int pack_use_multi_pack_reuse;
@@ -436,27 +436,46 @@ int demultiplex_sideband(const char *me, int status,
  * fd is connected to the remote side; send the sideband data
  * over multiplexed packet stream.
  */
+/*
+ * The number of packets send_sideband() hands to a single writev() call.
+ * Each packet takes two buffers, its header and its payload, and writev()
+ * is guaranteed to accept at least 16 of them.
+ */
+#define SIDEBAND_PACKETS_PER_WRITE 8
+
 void send_sideband(int fd, int band, const char *data, ssize_t sz, int packet_max)
 {
 	const char *p = data;
 
 	while (sz) {
-		unsigned n;
-		char hdr[5];
-
-		n = sz;
-		if (packet_max - 5 < n)
-			n = packet_max - 5;
-		if (0 <= band) {
-			xsnprintf(hdr, sizeof(hdr), "%04x", n + 5);
-			hdr[4] = band;
-			write_or_die(fd, hdr, 5);
-		} else {
-			xsnprintf(hdr, sizeof(hdr), "%04x", n + 4);
-			write_or_die(fd, hdr, 4);
+		char hdr[SIDEBAND_PACKETS_PER_WRITE][5];
+		struct iovec iov[2 * SIDEBAND_PACKETS_PER_WRITE];
+		int nr = 0;
+
+		/*
+		 * Point the iovecs at the headers and directly at the
+		 * payload, so that the data is framed without copying it.
+		 */
+		for (int i = 0; sz && i < SIDEBAND_PACKETS_PER_WRITE; i++) {
+			unsigned n;
+
+			n = sz;
+			if (packet_max - 5 < n)
+				n = packet_max - 5;
+			if (0 <= band) {
+				xsnprintf(hdr[i], sizeof(hdr[i]), "%04x", n + 5);
+				hdr[i][4] = band;
+				iov[nr].iov_len = 5;
+			} else {
+				xsnprintf(hdr[i], sizeof(hdr[i]), "%04x", n + 4);
+				iov[nr].iov_len = 4;
+			}
+			iov[nr++].iov_base = hdr[i];
+			iov[nr].iov_base = (char *)p;
+			iov[nr++].iov_len = n;
+			p += n;
+			sz -= n;
 		}
-		write_or_die(fd, p, n);
-		p += n;
-		sz -= n;
+		writev_or_die(fd, iov, nr);
 	}
 }
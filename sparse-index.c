@@ -360,6 +360,13 @@ void expand_index(struct index_state *istate, struct pattern_list *pl)
 			pl = NULL;
 	}
 
+	if (!pl) {
+		prepare_repo_settings(istate->repo);
+		if (istate->repo->settings.forbid_sparse_index_expansion)
+			die(_("refusing to expand the sparse index "
+			      "(index.forbidSparseExpansion is set)"));
+	}
+
 	if (!pl && give_advice_on_expansion) {
 		give_advice_on_expansion = 0;
 		advise_if_enabled(ADVICE_SPARSE_INDEX_EXPANDED,
@@ -436,6 +443,12 @@ void expand_index(struct index_state *istate, struct pattern_list *pl)
 		discard_cache_entry(ce);
 	}
 
+	if (!pl) {
+		trace2_counter_add(TRACE2_COUNTER_ID_SPARSE_INDEX_EXPANSIONS, 1);
+		trace2_counter_add(TRACE2_COUNTER_ID_SPARSE_INDEX_EXPANDED_ENTRIES,
+				   full->cache_nr - istate->cache_nr);
+	}
+
 	/* Copy back into original index. */
 	memcpy(&istate->name_hash, &full->name_hash, sizeof(full->name_hash));
 	memcpy(&istate->dir_hash, &full->dir_hash, sizeof(full->dir_hash));
@@ -31,6 +31,7 @@ static void dump_run(void)
 	struct dir_entry {
 		struct hashmap_entry ent;
 		struct dir_entry *parent;
+		struct dir_entry *canonical;
 		int nr;
 		unsigned int namelen;
 		char name[FLEX_ARRAY];
@@ -26,4 +26,27 @@ test_perf 'log -p -3000 --patience' '
 	git log -p -3000 --patience >/dev/null
 '
 
+test_expect_success 'setup large generated files' '
+	cat >generate.awk <<-\EOF &&
+	BEGIN {
+		for (i = 0; i < 500000; i++)
+			printf "  \"pkg-%d\": { \"version\": \"1.%d.%d\" },\n", i, i % 97, i % 13
+	}
+	EOF
+	cat >modify.awk <<-\EOF &&
+	NR % 1000 == 1 { sub(/"1\./, "\"2.") }
+	{ print }
+	EOF
+	awk -f generate.awk </dev/null >large.json &&
+	awk -f modify.awk <large.json >large-changed.json
+'
+
+for algo in myers histogram patience
+do
+	test_perf "diff --no-index --diff-algorithm=$algo (large file)" "
+		test_expect_code 1 git diff --no-index --diff-algorithm=$algo \
+			large.json large-changed.json >/dev/null
+	"
+done
+
 test_done
@@ -0,0 +1,51 @@
+#!/bin/sh
+
+test_description='fetch negotiation with many local-only branches'
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_expect_success 'setup' '
+	git clone --bare --shared . server.git &&
+	git remote add origin server.git &&
+	git fetch origin &&
+
+	# Local-only work, branched off at points spread over history.
+	spacing=$(($(git rev-list --first-parent --count HEAD) / 51)) &&
+	for i in $(test_seq 50)
+	do
+		base=$(git rev-list --first-parent --skip=$((i * spacing)) -1 HEAD) &&
+		commit=$(git commit-tree -p $base -m "local $i" $base^{tree}) &&
+		echo "create refs/heads/local$i $commit" || return 1
+	done >input &&
+	git update-ref --stdin <input &&
+
+	# Something new to fetch.
+	commit=$(git -C server.git commit-tree -p HEAD -m new HEAD^{tree}) &&
+	git -C server.git update-ref refs/heads/new $commit
+'
+
+for algorithm in consecutive skipping generation
+do
+	test_expect_success "negotiate ($algorithm)" "
+		rm -f trace trace2 &&
+		GIT_TRACE_PACKET=\"\$(pwd)/trace\" \
+		GIT_TRACE2_EVENT=\"\$(pwd)/trace2\" \
+			git -c fetch.negotiationAlgorithm=$algorithm \
+			    -c protocol.version=2 \
+			    fetch --negotiate-only --negotiation-restrict='refs/*' \
+			    origin >/dev/null
+	"
+
+	test_size "rounds ($algorithm)" '
+		sed -n "s/.*\"key\":\"total_rounds\",\"value\":\"\([0-9]*\)\".*/\1/p" trace2
+	'
+
+	test_size "request bytes ($algorithm)" '
+		sed -n "s/.* fetch> //p" trace |
+		awk "{ bytes += length(\$0) + 5 } END { print bytes }"
+	'
+done
+
+test_done
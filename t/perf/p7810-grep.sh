@@ -20,4 +20,15 @@ test_perf 'grep --cached, expensive regex' '
 	git grep --cached "^.* *some_nonexistent_string$" || :
 '
 
+test_expect_success 'pick revisions to grep' '
+	git rev-list -20 HEAD >revs
+'
+
+for threads in 1 4
+do
+	test_perf "grep 20 revisions, $threads threads" "
+		git grep --threads=$threads some_nonexistent_string \$(cat revs) || :
+	"
+done
+
 test_done
@@ -0,0 +1,33 @@
+#!/bin/sh
+
+test_description='blame perf tests'
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+# Pick the file with the most commits among the first few hundred
+# commits, so that the test digs through a long history.
+test_expect_success 'select a file' '
+	git log --format= --name-only --no-merges -300 |
+	sort | uniq -c | sort -rn | awk "{ print \$2; exit }" >filelist
+'
+
+file=$(cat filelist)
+export file
+
+test_perf 'blame' '
+	git blame HEAD -- "$file" >/dev/null
+'
+
+for threads in 1 0
+do
+	test_perf "blame -M (blame.threads=$threads)" "
+		git -c blame.threads=$threads blame -M HEAD -- \"\$file\" >/dev/null
+	"
+
+	test_perf "blame -C -C (blame.threads=$threads)" "
+		git -c blame.threads=$threads blame -C -C HEAD -- \"\$file\" >/dev/null
+	"
+done
+
+test_done
@@ -2623,4 +2623,79 @@ test_expect_success 'sparse-index is not expanded: restore --source --staged' '
 	ensure_not_expanded restore --source update-folder1 --staged .
 '
 
+test_expect_success 'sparse-index is not expanded: checkout-index' '
+	init_repos &&
+
+	test_all_match git -C deep checkout-index -f -a --ignore-skip-worktree-bits &&
+	ensure_not_expanded -C deep checkout-index -f -a --ignore-skip-worktree-bits &&
+	test_all_match git checkout-index -a --stage=2 --ignore-skip-worktree-bits &&
+	ensure_not_expanded checkout-index -a --stage=2 --ignore-skip-worktree-bits &&
+	ensure_expanded checkout-index -f -a --ignore-skip-worktree-bits
+'
+
+test_expect_success 'sparse-index is not expanded: submodule add over existing path' '
+	init_repos &&
+
+	test_all_match test_must_fail git submodule add "$(pwd)/initial-repo" folder1/a &&
+	grep "${SQ}folder1/a${SQ} already exists in the index" sparse-index-err &&
+	ensure_not_expanded ! submodule add "$(pwd)/initial-repo" folder1/a &&
+	test_all_match test_must_fail git submodule add --force "$(pwd)/initial-repo" folder1 &&
+	grep "already exists in the index and is not a submodule" sparse-index-err &&
+	ensure_not_expanded ! submodule add --force "$(pwd)/initial-repo" folder1/0
+'
+
+test_expect_success 'index.forbidSparseExpansion' '
+	init_repos &&
+
+	git -C sparse-index -c index.forbidSparseExpansion=true status &&
+	test_must_fail git -C sparse-index -c index.forbidSparseExpansion=true \
+		cat-file -p :folder1/a 2>err &&
+	grep "refusing to expand the sparse index" err &&
+
+	# changing the sparsity rules is allowed to expand
+	git -C sparse-index -c index.forbidSparseExpansion=true \
+		sparse-checkout set deep folder1
+'
+
+test_expect_success 'sparse index expansions are counted' '
+	init_repos &&
+
+	ensure_not_expanded status &&
+	test_grep ! "\"name\":\"sparse_expansions\"" trace2.txt &&
+	ensure_expanded cat-file -p :folder1/a &&
+	grep "\"category\":\"index\",\"name\":\"sparse_expansions\",\"count\":1" trace2.txt &&
+	grep "\"name\":\"sparse_expanded_entries\"" trace2.txt
+'
+
+test_expect_success 'sparse-index is not expanded: mv' '
+	init_repos &&
+
+	test_all_match git mv deep/a deep/moved-a &&
+	test_all_match git mv deep/deeper1 deep/moved-deeper1 &&
+	test_all_match git mv a deep/ &&
+	test_all_match git status --porcelain=v2 &&
+	test_all_match git reset --hard &&
+
+	ensure_not_expanded mv deep/a deep/moved-a &&
+	ensure_not_expanded mv deep/deeper1 deep/moved-deeper1 &&
+	ensure_not_expanded mv a deep/ &&
+	ensure_expanded mv --sparse folder1/a deep/folder1-a &&
+	git -C sparse-index reset --hard &&
+	ensure_expanded mv --sparse folder1 deep
+'
+
+test_expect_success 'sparse-index is not expanded: update-index --again' '
+	init_repos &&
+
+	# folder1/ differs between HEAD and the index, but as it is
+	# outside of the sparse-checkout definition there is nothing
+	# to update.
+	test_sparse_match git reset --soft update-folder1 &&
+	test_sparse_match git update-index --again &&
+	test_sparse_match git status --porcelain=v2 &&
+	ensure_not_expanded update-index --again &&
+	ensure_not_expanded update-index --remove --ignore-skip-worktree-entries --again &&
+	ensure_expanded update-index --remove --again
+'
+
 test_done
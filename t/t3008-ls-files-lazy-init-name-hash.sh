@@ -24,4 +24,19 @@ test_expect_success 'no buffer overflow in lazy_init_name_hash' '
 	test-tool lazy-init-name-hash -m
 '
 
+test_expect_success 'single and multi-threaded hashmaps agree on case variants' '
+	git read-tree --empty &&
+	for d in dir Dir DIR dir/sub DIR/Sub
+	do
+		test_seq $LAZY_THREAD_COST | sed "s|^|$d/f_|" || return 1
+	done |
+	sed "s/^/100644 $EMPTY_BLOB	/" |
+	git update-index --index-info &&
+	test-tool lazy-init-name-hash --dump --single >out.single &&
+	test-tool lazy-init-name-hash --dump --multi >out.multi &&
+	sort <out.single >sorted.single &&
+	sort <out.multi >sorted.multi &&
+	test_cmp sorted.single sorted.multi
+'
+
 test_done
@@ -309,4 +309,67 @@ test_expect_success 'last line matters too' '
 	test_cmp expected actual.munged
 '
 
+test_expect_success 'diff.renameThreads does not change the result' '
+	git checkout --orphan rename-threads &&
+	git rm -rfq . &&
+	mkdir old &&
+	for i in $(test_seq 1 20)
+	do
+		test_seq $i $((i + 30)) >old/$i || return 1
+	done &&
+	git add old &&
+	git commit -m "rename threads base" &&
+	mkdir new &&
+	for i in $(test_seq 1 20)
+	do
+		sed -e "s/^$((i + 3))\$/changed/" old/$i >new/$((21 - i)) &&
+		test_seq $i $((i + 15)) >>new/$((21 - i)) || return 1
+	done &&
+	echo unrelated >new/0 &&
+	git rm -rq old &&
+	git add new &&
+	git commit -m "rename threads moved" &&
+	for args in "-B -M" "-C -C" "-M70%" "-M"
+	do
+		git -c diff.renameThreads=1 diff --raw $args HEAD^ HEAD >expect &&
+		git -c diff.renameThreads=4 diff --raw $args HEAD^ HEAD >actual &&
+		test_cmp expect actual || return 1
+	done &&
+	grep "^:.* R[0-9]*	" expect
+'
+
+test_expect_success '--rename-candidates=approximate goes past the rename limit' '
+	git diff-tree -r -M HEAD^ HEAD >expect &&
+	git diff-tree -r -M -l2 HEAD^ HEAD >actual 2>err &&
+	! grep " R[0-9]*	" actual &&
+	test_grep "exhaustive rename detection was skipped" err &&
+	git diff-tree -r -M -l2 --rename-candidates=approximate \
+		HEAD^ HEAD >actual 2>err &&
+	test_must_be_empty err &&
+	test_cmp expect actual &&
+	test_must_fail git diff-tree -r -M --rename-candidates=bogus HEAD^ HEAD
+'
+
+test_expect_success 'diff.renameCandidates applies to porcelain only' '
+	git diff --raw -M HEAD^ HEAD >expect &&
+	git -c diff.renameCandidates=approximate \
+		diff --raw -M -l2 HEAD^ HEAD >actual 2>err &&
+	test_must_be_empty err &&
+	test_cmp expect actual &&
+	git -c diff.renameCandidates=approximate \
+		diff --raw -M -l2 --rename-candidates=exhaustive \
+		HEAD^ HEAD >actual 2>err &&
+	test_grep "exhaustive rename detection was skipped" err &&
+	git -c diff.renameCandidates=approximate \
+		diff-tree -r -M -l2 HEAD^ HEAD >actual 2>err &&
+	test_grep "exhaustive rename detection was skipped" err
+'
+
+test_expect_success 'bad diff.renameCandidates or diff.renameThreads is rejected' '
+	test_must_fail git -c diff.renameCandidates=bogus diff HEAD HEAD 2>err &&
+	test_grep "unknown value for config .diff.renamecandidates.: bogus" err &&
+	test_must_fail git -c diff.renameThreads=-1 diff HEAD HEAD 2>err &&
+	test_grep "diff.renamethreads. must be at least 0" err
+'
+
 test_done
@@ -0,0 +1,88 @@
+#!/bin/sh
+
+test_description='diff.splitLines, diff.maxCost and their options'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 2000)
+	do
+		echo "id $i" &&
+		echo "row $((i % 7))" &&
+		echo "row $((i % 5))" || return 1
+	done >file &&
+	git add file &&
+	git commit -m initial &&
+	for i in $(test_seq 2000)
+	do
+		echo "id $i" &&
+		echo "row $((i % 5))" &&
+		echo "row $((i % 3))" || return 1
+	done >file &&
+	git commit -a -m rewrite
+'
+
+for config in diff.splitLines=100 diff.maxCost=16 \
+	"diff.splitLines=100 -c diff.maxCost=16"
+do
+	test_expect_success "$config gives a diff that applies" '
+		git -c $config diff HEAD^ HEAD >patch &&
+		git checkout HEAD^ -- file &&
+		git apply patch &&
+		git diff --exit-code HEAD -- file
+	'
+done
+
+for option in --split-lines=100 --max-cost=16 "--split-lines=100 --max-cost=16"
+do
+	test_expect_success "diff-tree $option gives a diff that applies" '
+		git diff-tree -p $option HEAD^ HEAD >patch &&
+		git checkout HEAD^ -- file &&
+		git apply patch &&
+		git diff --exit-code HEAD -- file
+	'
+done
+
+test_expect_success 'options override the config' '
+	git diff HEAD^ HEAD >expect &&
+	git -c diff.splitLines=100 diff HEAD^ HEAD >split &&
+	! test_cmp expect split &&
+	git -c diff.splitLines=100 diff --split-lines=0 HEAD^ HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'plumbing ignores diff.splitLines and diff.maxCost' '
+	git diff-tree -p HEAD^ HEAD >expect &&
+	git diff-tree -p --split-lines=100 HEAD^ HEAD >split &&
+	! test_cmp expect split &&
+	git -c diff.splitLines=100 -c diff.maxCost=16 \
+		diff-tree -p HEAD^ HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'bad --split-lines or --max-cost is rejected' '
+	test_must_fail git diff --split-lines=-1 HEAD^ HEAD 2>err &&
+	test_grep "split-lines expects a non-negative integer" err &&
+	test_must_fail git diff --max-cost=many HEAD^ HEAD 2>err &&
+	test_grep "max-cost expects a numerical value" err
+'
+
+test_expect_success 'diff.splitLines does not change a simple diff' '
+	git diff HEAD^ HEAD >expect &&
+	git -c diff.splitLines=10000 diff HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+	test_write_lines a b c d e f g >pre &&
+	test_write_lines a b X d e f g Y >post &&
+	test_expect_code 1 git diff --no-index pre post >expect &&
+	test_expect_code 1 git -c diff.splitLines=2 diff --no-index pre post >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'diff.splitLines uses lines unique in both files as anchors' '
+	test_write_lines x x x x unique y y y y >pre &&
+	test_write_lines y y y y unique x x x x >post &&
+	test_expect_code 1 git -c diff.splitLines=2 diff --no-index pre post >diff &&
+	test_grep "^ unique" diff
+'
+
+test_done
@@ -0,0 +1,78 @@
+#!/bin/sh
+
+test_description='diff.threads gives the same output as a single thread'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in $(test_seq 40)
+	do
+		test_seq $i 100 >file$i || return 1
+	done &&
+	printf "\0binary\n" >binary &&
+	echo text >typechange &&
+	test_seq 200 >renamed &&
+	echo gone >deleted &&
+	git add . &&
+	git commit -m initial &&
+
+	for i in $(test_seq 40)
+	do
+		test_seq $i 100 | sed "s/0$/zero/" >file$i || return 1
+	done &&
+	printf "\0binary\nchanged\n" >binary &&
+	git mv renamed renamed-to &&
+	echo changed >>renamed-to &&
+	git rm deleted &&
+	echo new >added &&
+	chmod +x file5 &&
+	git add . &&
+	if test_have_prereq SYMLINKS
+	then
+		rm typechange &&
+		ln -s file1 typechange &&
+		git add typechange
+	fi &&
+	git commit -m second
+'
+
+for args in "" "--stat -p" "--binary" "-M --color" "--histogram -W" "-R"
+do
+	test_expect_success "diff $args with diff.threads" '
+		git diff $args HEAD^ HEAD >expect &&
+		git -c diff.threads=4 diff $args HEAD^ HEAD >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success 'log -p with diff.threads' '
+	git log -p >expect &&
+	git -c diff.threads=3 log -p >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'diff.threads uses a thread pool' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" GIT_TRACE2_EVENT_NESTING=10 \
+		git -c diff.threads=4 diff HEAD^ HEAD >/dev/null &&
+	grep "\"key\":\"patch_threads\",\"value\":\"4\"" trace.event
+'
+
+test_expect_success 'diff.threads keeps external diff output in order' '
+	write_script external <<-\EOF &&
+	echo "EXTERNAL $1"
+	EOF
+	echo "file2* diff=ext" >.gitattributes &&
+	test_config diff.ext.command ./external &&
+	git diff --ext-diff HEAD^ HEAD >expect &&
+	test_grep "^EXTERNAL file2$" expect &&
+	git -c diff.threads=4 diff --ext-diff HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+	rm .gitattributes external
+'
+
+test_expect_success 'diff.threads rejects negative values' '
+	test_must_fail git -c diff.threads=-1 diff HEAD^ HEAD 2>err &&
+	test_grep "invalid number of threads" err
+'
+
+test_done
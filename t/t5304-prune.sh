@@ -48,6 +48,29 @@ test_expect_success 'prune stale packs' '
 	test_path_is_missing .git/objects/tmp_1.pack
 '
 
+test_expect_success 'prune stale bundle-uri partial downloads' '
+	bundles=.git/objects/bundles &&
+	old=uri-$(printf "%s" "https://example.com/old.bundle" |
+		  test-tool $(test_oid algo)) &&
+	new=uri-$(printf "%s" "https://example.com/new.bundle" |
+		  test-tool $(test_oid algo)) &&
+	mkdir -p $bundles &&
+	>$bundles/$old.temp &&
+	>$bundles/$old.validator &&
+	>$bundles/$new.temp &&
+	>$bundles/$new.validator &&
+	>$bundles/other &&
+	test-tool chmtime =-86501 $bundles/$old.temp \
+		$bundles/$old.validator $bundles/other &&
+	git prune --expire 1.day &&
+	test_path_is_missing $bundles/$old.temp &&
+	test_path_is_missing $bundles/$old.validator &&
+	test_path_is_file $bundles/$new.temp &&
+	test_path_is_file $bundles/$new.validator &&
+	test_path_is_file $bundles/other &&
+	rm -rf $bundles
+'
+
 test_expect_success 'prune --expire' '
 	add_blob &&
 	git prune --expire=1.hour.ago &&
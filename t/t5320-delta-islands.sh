@@ -141,4 +141,53 @@ test_expect_success 'unmatched island core is not fatal' '
 	git -c "pack.islandcore=one" repack -adfi
 '
 
+test_expect_success 'bitmapped island repack writes island marks' '
+	git -c "pack.island=refs/heads/(.*)" repack -adfib &&
+	ls .git/objects/pack/pack-*.islands >islands &&
+	test_line_count = 1 islands &&
+	is_delta_base $one $root &&
+	is_delta_base $two $root
+'
+
+test_expect_success 'island marks are reused by the next repack' '
+	test_when_finished "rm -f trace" &&
+	commit three shared 123 two &&
+	GIT_TRACE2_EVENT="$PWD/trace" \
+		git -c "pack.island=refs/heads/(.*)" repack -adfib &&
+	grep "\"key\":\"reused-islands\",\"value\":\"3\"" trace &&
+	grep "\"key\":\"skipped-trees\"" trace &&
+	is_delta_base $one $root &&
+	is_delta_base $two $root
+'
+
+test_expect_success 'island marks of rewound islands are not reused' '
+	test_when_finished "rm -f trace" &&
+	git update-ref refs/heads/three refs/heads/one &&
+	GIT_TRACE2_EVENT="$PWD/trace" \
+		git -c "pack.island=refs/heads/(.*)" repack -adfib &&
+
+	# Of root, one, two and three, only three no longer reaches
+	# what it used to.
+	grep "\"key\":\"reused-islands\",\"value\":\"3\"" trace &&
+	is_delta_base $one $root &&
+	is_delta_base $two $root
+'
+
+test_expect_success 'island marks of deleted islands are not reused' '
+	test_when_finished "rm -f trace" &&
+	git update-ref -d refs/heads/root &&
+	GIT_TRACE2_EVENT="$PWD/trace" \
+		git -c "pack.island=refs/heads/(.*)" repack -adfib &&
+
+	# Of root, one (deduplicated with three) and two, only root
+	# is gone.
+	grep "\"key\":\"reused-islands\",\"value\":\"2\"" trace
+'
+
+test_expect_success 'pack.islandCache=false disables island marks files' '
+	git -c "pack.island=refs/heads/(.*)" -c pack.islandCache=false \
+		repack -adfib &&
+	test_path_is_missing .git/objects/pack/pack-*.islands
+'
+
 test_done
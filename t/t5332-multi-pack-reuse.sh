@@ -201,7 +201,7 @@ test_expect_success 'omit delta with uninteresting base (same pack)' '
 	test_pack_objects_reused 3 1 <in
 '
 
-test_expect_success 'omit delta from uninteresting base (cross pack)' '
+test_expect_success 'reuse delta with base from another pack' '
 	cat >in <<-EOF &&
 	$(git rev-parse $base)
 	^$(git rev-parse $delta)
@@ -214,7 +214,13 @@ test_expect_success 'omit delta from uninteresting base (cross pack)' '
 	packs_nr="$(find $packdir -type f -name "pack-*.pack" | wc -l)" &&
 	objects_nr="$(git rev-list --count --all --objects)" &&
 
-	test_pack_objects_reused_all $(($objects_nr - 1)) $packs_nr
+	# The MIDX picks the base of "$delta:f" from the preferred pack,
+	# but the delta itself is still reused, pointing at that copy of
+	# the base by name.
+	test_pack_objects_reused_all $objects_nr $packs_nr &&
+
+	git verify-pack -v got.idx >out &&
+	grep "^$(git rev-parse $delta:f) blob .* 1 $(git rev-parse $base:f)\$" out
 '
 
 test_expect_success 'non-omitted delta in MIDX preferred pack' '
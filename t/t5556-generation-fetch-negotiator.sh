@@ -0,0 +1,136 @@
+#!/bin/sh
+
+test_description='test generation fetch negotiator'
+
+. ./test-lib.sh
+
+have_sent () {
+	while test "$#" -ne 0
+	do
+		grep "fetch> have $(git -C client rev-parse $1)" trace
+		if test $? -ne 0
+		then
+			echo "No have $(git -C client rev-parse $1) ($1)"
+			return 1
+		fi
+		shift
+	done
+}
+
+have_not_sent () {
+	while test "$#" -ne 0
+	do
+		grep "fetch> have $(git -C client rev-parse $1)" trace
+		if test $? -eq 0
+		then
+			return 1
+		fi
+		shift
+	done
+}
+
+# trace_fetch <client_dir> <server_dir> [args]
+#
+# Trace the packet output of fetch, but make sure we disable the variable
+# in the child upload-pack, so we don't combine the results in the same file.
+trace_fetch () {
+	client=$1; shift
+	server=$1; shift
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+	git -C "$client" fetch \
+	  --upload-pack 'unset GIT_TRACE_PACKET; git-upload-pack' \
+	  "$server" "$@"
+}
+
+test_expect_success 'gaps between haves double' '
+	git init server &&
+	test_commit -C server to_fetch &&
+
+	git init client &&
+	for i in $(test_seq 31)
+	do
+		test_commit -C client c$i || return 1
+	done &&
+
+	# We send "c31", skip 1, send "c29", skip 3, send "c25", skip 7,
+	# send "c17", and then skip 15, which takes us to "c1".
+	test_config -C client fetch.negotiationalgorithm generation &&
+	trace_fetch client "$(pwd)/server" &&
+	have_sent c31 c29 c25 c17 c1 &&
+	have_not_sent c30 c28 c27 c26 c24 c18 c16 c2
+'
+
+test_expect_success 'commit-graph generations override clock skew' '
+	rm -rf server client trace &&
+	git init server &&
+	test_commit -C server to_fetch &&
+
+	git init client &&
+
+	# 2 regular commits
+	test_tick=2000000000 &&
+	test_commit -C client c1 &&
+	test_commit -C client c2 &&
+
+	# 4 old commits
+	test_tick=1000000000 &&
+	git -C client checkout c1 &&
+	test_commit -C client old1 &&
+	test_commit -C client old2 &&
+	test_commit -C client old3 &&
+	test_commit -C client old4 &&
+	git -C client commit-graph write --reachable &&
+
+	# The generations put "c1" below "old1", so it is not visited
+	# before it, and the gaps from both tips end up on "c1".
+	test_config -C client fetch.negotiationalgorithm generation &&
+	trace_fetch client "$(pwd)/server" &&
+	have_sent c2 old4 old2 c1 &&
+	have_not_sent old3 old1
+'
+
+test_expect_success 'remote-tracking tips are sent first' '
+	rm -rf server client trace &&
+	git init server &&
+	test_commit -C server base &&
+	git -C server checkout -b feature &&
+	test_commit -C server feature &&
+	git -C server checkout - &&
+
+	git clone server client &&
+	test_commit -C client local1 &&
+	test_commit -C client local2 &&
+	git -C server branch -D feature &&
+	git -C server tag -d feature &&
+	test_commit -C server to_fetch &&
+
+	test_config -C client fetch.negotiationalgorithm generation &&
+	trace_fetch client origin &&
+	grep "fetch> have" trace >haves &&
+	head -n 1 haves >actual &&
+	echo "$(git -C client rev-parse origin/feature)" >expect &&
+	grep -f expect actual
+'
+
+test_expect_success 'more haves go into the first request' '
+	rm -rf server client trace &&
+	git init server &&
+	test_commit -C server to_fetch &&
+
+	git init client &&
+	tree=$(git -C client mktree </dev/null) &&
+	for i in $(test_seq 70)
+	do
+		commit=$(git -C client commit-tree -m "b$i" $tree) &&
+		echo "create refs/heads/b$i $commit" || return 1
+	done | git -C client update-ref --stdin &&
+
+	test_config -C client fetch.negotiationalgorithm generation &&
+	GIT_TRACE2_EVENT="$(pwd)/trace2" \
+		git -C client -c protocol.version=2 fetch "$(pwd)/server" &&
+	grep "\"key\":\"haves_added\"" trace2 >rounds &&
+	head -n 1 rounds >first &&
+	grep "\"value\":\"64\"" first
+'
+
+test_done
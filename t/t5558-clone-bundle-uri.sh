@@ -1280,6 +1280,60 @@ test_expect_success 'bundles are downloaded once during fetch --all' '
 	test_line_count = 1 bundle-fetches
 '
 
+test_expect_success 'interrupted bundle download is resumed' '
+	test_when_finished "rm -rf etag resume curl.txt trace.txt" &&
+
+	# Apache only hands out strong validators for files that were
+	# not modified within the last second.
+	test-tool chmtime =-10 "$HTTPD_DOCUMENT_ROOT_PATH/B.bundle" &&
+	uri="$HTTPD_URL/B.bundle" &&
+	git init etag &&
+	GIT_TRACE_CURL="$(pwd)/curl.txt" \
+		git -C etag -c fetch.bundleURI="$uri" \
+		fetch "$HTTPD_URL/smart/fetch.git" &&
+	etag=$(sed -n "s/^.*<= Recv header: ETag: //p" curl.txt | tr -d "\r") &&
+	test -n "$etag" &&
+
+	# Leave the first part of the download behind, as an earlier
+	# process that was interrupted would have.
+	git init resume &&
+	name=uri-$(printf "%s" "$uri" | test-tool $(test_oid algo)) &&
+	mkdir -p resume/.git/objects/bundles &&
+	test_copy_bytes 100 <clone-from/B.bundle \
+		>resume/.git/objects/bundles/$name.temp &&
+	echo "$etag" >resume/.git/objects/bundles/$name.validator &&
+
+	>"$HTTPD_ROOT_PATH"/access.log &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git -C resume -c fetch.bundleURI="$uri" \
+		fetch "$HTTPD_URL/smart/fetch.git" &&
+	test_grep "\"key\":\"http/resume-offset\",\"value\":\"100\"" trace.txt &&
+	test_grep "GET /B.bundle HTTP/[0-9.]*\" 206 " "$HTTPD_ROOT_PATH"/access.log &&
+	git -C resume rev-parse refs/bundles/heads/topic >actual &&
+	git -C clone-from rev-parse topic >expect &&
+	test_cmp expect actual &&
+	test_path_is_missing resume/.git/objects/bundles/$name.temp
+'
+
+test_expect_success 'stale partial bundle download is discarded' '
+	test_when_finished "rm -rf resume" &&
+	git init resume &&
+
+	uri="$HTTPD_URL/B.bundle" &&
+	name=uri-$(printf "%s" "$uri" | test-tool $(test_oid algo)) &&
+	mkdir -p resume/.git/objects/bundles &&
+	size=$(test_file_size clone-from/B.bundle) &&
+	test-tool genrandom stale $((size + 1)) \
+		>resume/.git/objects/bundles/$name.temp &&
+
+	git -C resume -c fetch.bundleURI="$uri" \
+		fetch "$HTTPD_URL/smart/fetch.git" &&
+	git -C resume rev-parse refs/bundles/heads/topic >actual &&
+	git -C clone-from rev-parse topic >expect &&
+	test_cmp expect actual &&
+	test_path_is_missing resume/.git/objects/bundles/$name.temp
+'
+
 test_expect_success 'bundles with space in URI are rejected' '
 	test_when_finished "rm -rf busted repo" &&
 	mkdir -p "$HOME/busted/ /$HOME/repo/.git/objects/bundles" &&
@@ -0,0 +1,76 @@
+#!/bin/sh
+
+test_description='upload-pack generating packs without running pack-objects'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git tag -a -m annotated annotated &&
+	git config --global uploadpack.packObjectsInProcess true
+'
+
+spawned_pack_objects () {
+	grep "\"event\":\"child_start\".*\"pack-objects\"" "$1"
+}
+
+for version in 0 2
+do
+	test_expect_success "clone with protocol v$version" "
+		rm -rf dst.git trace.txt &&
+		GIT_TRACE2_EVENT=\"\$(pwd)/trace.txt\" \
+			git -c protocol.version=$version clone --bare --no-local . dst.git &&
+		! spawned_pack_objects trace.txt &&
+		grep '\"category\":\"pack-objects\",\"label\":\"write-pack-file\"' trace.txt &&
+		git -C dst.git fsck &&
+		git for-each-ref >expect &&
+		git -C dst.git for-each-ref >actual &&
+		test_cmp expect actual
+	"
+done
+
+test_expect_success 'incremental fetch sends only what is missing' '
+	test_commit three &&
+	rm -f trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git -C dst.git fetch origin "+refs/heads/*:refs/heads/*" &&
+	! spawned_pack_objects trace.txt &&
+	grep "\"key\":\"written\",\"value\":\"3\"" trace.txt &&
+	git -C dst.git fsck &&
+	git rev-parse HEAD >expect &&
+	git -C dst.git rev-parse HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'partial clone' '
+	test_config uploadpack.allowFilter true &&
+	rm -rf dst.git trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git clone --bare --no-local --filter=blob:none . dst.git &&
+	! spawned_pack_objects trace.txt &&
+	git -C dst.git rev-list --objects --missing=print HEAD >objects &&
+	grep "^?$(git rev-parse HEAD:three.t)" objects
+'
+
+test_expect_success 'shallow clone runs pack-objects' '
+	rm -rf dst.git trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git clone --bare --no-local --depth=1 . dst.git &&
+	spawned_pack_objects trace.txt &&
+	git -C dst.git fsck
+'
+
+test_expect_success 'uploadpack.packObjectsHook takes precedence' '
+	write_script .git/hook <<-\EOF &&
+	echo >&2 "hook running"
+	exec "$@"
+	EOF
+	test_config_global uploadpack.packObjectsHook ./hook &&
+	rm -rf dst.git &&
+	git clone --bare --no-local . dst.git 2>stderr &&
+	grep "hook running" stderr &&
+	git -C dst.git fsck
+'
+
+test_done
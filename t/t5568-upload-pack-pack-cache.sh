@@ -0,0 +1,116 @@
+#!/bin/sh
+
+test_description='upload-pack answering repeated requests from its pack cache'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git tag -a -m annotated annotated &&
+	git config --global uploadpack.packCache true
+'
+
+cache_counter () {
+	grep "\"event\":\"counter\".*\"name\":\"pack_cache_$1\",\"count\":$2" trace.txt
+}
+
+clone_and_check () {
+	rm -rf dst.git trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git clone --bare --no-local "$@" . dst.git &&
+	git -C dst.git fsck
+}
+
+refs_match () {
+	git for-each-ref >expect &&
+	git -C dst.git for-each-ref >actual &&
+	test_cmp expect actual
+}
+
+for version in 0 2
+do
+	test_expect_success "repeated clone is served from the cache (v$version)" "
+		rm -rf .git/upload-pack-cache &&
+		clone_and_check -c protocol.version=$version &&
+		cache_counter misses 1 &&
+		refs_match &&
+		ls .git/upload-pack-cache/*.pack >packs &&
+		test_line_count = 1 packs &&
+		clone_and_check -c protocol.version=$version &&
+		cache_counter hits 1 &&
+		! grep write-pack-file trace.txt &&
+		refs_match
+	"
+done
+
+test_expect_success 'different requests use different entries' '
+	rm -rf .git/upload-pack-cache &&
+	clone_and_check &&
+	clone_and_check --no-tags &&
+	cache_counter misses 1 &&
+	test_config uploadpack.allowFilter true &&
+	clone_and_check --filter=blob:none &&
+	cache_counter misses 1 &&
+	ls .git/upload-pack-cache/*.pack >packs &&
+	test_line_count = 3 packs
+'
+
+test_expect_success 'a new tag changes the response' '
+	clone_and_check &&
+	cache_counter hits 1 &&
+	git tag -a -m another another one &&
+	clone_and_check &&
+	cache_counter misses 1 &&
+	refs_match
+'
+
+test_expect_success 'incremental fetch uses the cache' '
+	git clone --bare --no-local . fetch.git &&
+	test_commit three &&
+	git -C fetch.git config remote.origin.fetch "+refs/heads/*:refs/heads/*" &&
+	cp -R fetch.git fetch2.git &&
+	rm -f trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" git -C fetch.git fetch &&
+	cache_counter misses 1 &&
+	rm -f trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" git -C fetch2.git fetch &&
+	cache_counter hits 1 &&
+	git -C fetch2.git fsck &&
+	git rev-parse HEAD >expect &&
+	git -C fetch2.git rev-parse HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'shallow clones are not cached' '
+	rm -rf dst.git trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git clone --bare --no-local --depth=1 . dst.git &&
+	! grep pack_cache trace.txt
+'
+
+test_expect_success 'expired entries are not used' '
+	clone_and_check &&
+	test-tool chmtime -700 .git/upload-pack-cache/*.pack &&
+	clone_and_check &&
+	cache_counter misses 1 &&
+	test_config uploadpack.packCacheMaxAge 0 &&
+	test-tool chmtime -1 .git/upload-pack-cache/*.pack &&
+	clone_and_check &&
+	cache_counter misses 1
+'
+
+test_expect_success 'cache is kept below uploadpack.packCacheMaxSize' '
+	rm -rf .git/upload-pack-cache &&
+	clone_and_check &&
+	full=$(ls .git/upload-pack-cache/*.pack) &&
+	test-tool chmtime -10 "$full" &&
+	size=$(test-tool path-utils file-size "$full") &&
+	test_config uploadpack.packCacheMaxSize $((size + 1)) &&
+	clone_and_check --no-tags &&
+	ls .git/upload-pack-cache/*.pack >packs &&
+	test_line_count = 1 packs &&
+	! grep "$full" packs
+'
+
+test_done
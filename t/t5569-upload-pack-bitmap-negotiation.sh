@@ -0,0 +1,86 @@
+#!/bin/sh
+
+test_description='upload-pack negotiating with reachability bitmaps'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git init server &&
+	test_commit_bulk -C server 20 &&
+	git clone --no-local server client &&
+	test_commit_bulk -C server --start=21 5 &&
+	git -C server repack -adb
+'
+
+bitmapped_wants () {
+	grep "\"key\":\"negotiation/bitmapped-wants\",\"value\":\"$1\"" trace.txt
+}
+
+fetch_and_check () {
+	rm -rf tmp trace.txt &&
+	cp -R client tmp &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git -C tmp "$@" fetch origin &&
+	git -C tmp fsck &&
+	git -C server rev-parse HEAD >expect &&
+	git -C tmp rev-parse origin/HEAD >actual &&
+	test_cmp expect actual
+}
+
+for version in 0 2
+do
+	test_expect_success "fetch with protocol v$version" "
+		fetch_and_check -c protocol.version=$version &&
+		bitmapped_wants 1
+	"
+done
+
+test_expect_success 'fetch without bitmaps' '
+	test_config -C server pack.useBitmaps false &&
+	fetch_and_check &&
+	! grep negotiation/bitmapped-wants trace.txt
+'
+
+test_expect_success 'wants without a bitmap are walked from' '
+	test_commit -C server unbitmapped &&
+	fetch_and_check &&
+	bitmapped_wants 0
+'
+
+test_expect_success 'only a limited number of wants get a bitmap' '
+	git -C server repack -adb &&
+	git -C server branch other HEAD~1 &&
+	git -C server repack -adb &&
+	fetch_and_check &&
+	bitmapped_wants 2 &&
+	git -C server rev-parse other >expect &&
+	git -C tmp rev-parse origin/other >actual &&
+	test_cmp expect actual &&
+	test_env GIT_TEST_UPLOAD_PACK_WANT_BITMAPS_MAX_BYTES=16 \
+		fetch_and_check &&
+	bitmapped_wants 1 &&
+	git -C server rev-parse other >expect &&
+	git -C tmp rev-parse origin/other >actual &&
+	test_cmp expect actual &&
+	git -C server branch -D other
+'
+
+test_expect_success 'pack sent with bitmaps matches the one without' '
+	git -C server repack -adb &&
+	rm -rf tmp trace.txt &&
+	cp -R client tmp &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" git -C tmp fetch origin &&
+	bitmapped_wants 1 &&
+	grep "\"category\":\"pack-objects\",\"key\":\"written\"" trace.txt >with &&
+	rm -rf tmp trace.txt &&
+	cp -R client tmp &&
+	git -C server config pack.useBitmaps false &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" git -C tmp fetch origin &&
+	git -C server config --unset pack.useBitmaps &&
+	grep "\"category\":\"pack-objects\",\"key\":\"written\"" trace.txt >without &&
+	sed "s/.*\"value\"//" with >expect &&
+	sed "s/.*\"value\"//" without >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -1322,6 +1322,84 @@ test_expect_success 'fetching with valid packfile URI but invalid hash fails' '
 	test_grep "pack downloaded from.*does not match expected hash" err
 '
 
+test_expect_success 'packfile URIs are downloaded in parallel' '
+	P="$HTTPD_DOCUMENT_ROOT_PATH/http_parent" &&
+	rm -rf "$P" http_child trace &&
+
+	git init "$P" &&
+	git -C "$P" config "uploadpack.allowsidebandall" "true" &&
+
+	for b in one two three
+	do
+		echo $b-blob >"$P/$b-blob" &&
+		git -C "$P" add $b-blob || return 1
+	done &&
+	git -C "$P" commit -m x &&
+
+	configure_exclusion "$P" one-blob >h1 &&
+	configure_exclusion "$P" two-blob >h2 &&
+	configure_exclusion "$P" three-blob >h3 &&
+
+	GIT_TRACE2_EVENT="$(pwd)/trace" GIT_TEST_SIDEBAND_ALL=1 \
+	git -c protocol.version=2 \
+		-c fetch.uriprotocols=http,https \
+		-c fetch.packfileUriJobs=2 \
+		clone "$HTTPD_URL/smart/http_parent" http_child &&
+	git -C http_child fsck &&
+
+	ls http_child/.git/objects/pack/*.pack >packlist &&
+	test_line_count = 4 packlist &&
+
+	# Two downloads are started before the first one is waited for,
+	# and the third only once the first has finished.
+	sid=$(sed -n -e "s/^{\"event\":\"start\",\"sid\":\"\([^\"]*\)\".*\"argv\":\[\"[^\"]*\",\"fetch-pack\".*/\1/p" trace) &&
+	grep "\"sid\":\"$sid\"" trace >fetch-pack-trace &&
+	sed -n -e "s/.*\"event\":\"child_start\".*\"child_id\":\([0-9]*\),.*\"http-fetch\".*/\1/p" \
+		fetch-pack-trace >ids &&
+	test_line_count = 3 ids &&
+	a=$(sed -n 1p ids) && b=$(sed -n 2p ids) && c=$(sed -n 3p ids) &&
+	sed -n -e "s/.*\"event\":\"child_start\".*\"child_id\":\([0-9]*\),.*/start \1/p" \
+	       -e "s/.*\"event\":\"child_exit\".*\"child_id\":\([0-9]*\),.*/exit \1/p" \
+		fetch-pack-trace >events &&
+	grep -e " $a\$" -e " $b\$" -e " $c\$" events >actual &&
+	cat >expect <<-EOF &&
+	start $a
+	start $b
+	exit $a
+	start $c
+	exit $b
+	exit $c
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'failure of one parallel packfile URI download fails the fetch' '
+	P="$HTTPD_DOCUMENT_ROOT_PATH/http_parent" &&
+	rm -rf "$P" http_child &&
+
+	git init "$P" &&
+	git -C "$P" config "uploadpack.allowsidebandall" "true" &&
+
+	echo my-blob >"$P/my-blob" &&
+	git -C "$P" add my-blob &&
+	echo other-blob >"$P/other-blob" &&
+	git -C "$P" add other-blob &&
+	git -C "$P" commit -m x &&
+
+	configure_exclusion "$P" my-blob >h &&
+	git -C "$P" hash-object other-blob >objh &&
+	git -C "$P" pack-objects "$HTTPD_DOCUMENT_ROOT_PATH/mypack" <objh >packh &&
+	git -C "$P" config --add \
+		"uploadpack.blobpackfileuri" \
+		"$(cat objh) $(cat packh) $HTTPD_URL/dumb/missing-$(cat packh).pack" &&
+
+	test_must_fail env GIT_TEST_SIDEBAND_ALL=1 \
+		git -c protocol.version=2 \
+		-c fetch.uriprotocols=http,https \
+		clone "$HTTPD_URL/smart/http_parent" http_child 2>err &&
+	test_grep "unable to finish http-fetch" err
+'
+
 test_expect_success 'packfile-uri with transfer.fsckobjects' '
 	P="$HTTPD_DOCUMENT_ROOT_PATH/http_parent" &&
 	rm -rf "$P" http_child log &&
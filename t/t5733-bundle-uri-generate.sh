@@ -0,0 +1,173 @@
+#!/bin/sh
+
+test_description='generating and advertising bundles with the bundle-uri maintenance task'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+bundles () {
+	ls server/.git/bundle-uri/bundle-*.bundle
+}
+
+test_expect_success 'setup' '
+	git init server &&
+	test_commit -C server one &&
+	test_commit -C server two &&
+	git -C server branch side
+'
+
+test_expect_success 'first run writes a full bundle and a bundle list' '
+	git -C server maintenance run --task=bundle-uri &&
+	bundles >list &&
+	test_line_count = 1 list &&
+	git bundle list-heads $(cat list) >heads &&
+	cut -d" " -f2 heads | sort >actual &&
+	cat >expect <<-\EOF &&
+	refs/heads/main
+	refs/heads/side
+	refs/tags/one
+	refs/tags/two
+	EOF
+	test_cmp expect actual &&
+
+	git config --file=server/.git/bundle-uri/bundle-list bundle.heuristic >actual &&
+	echo creationToken >expect &&
+	test_cmp expect actual &&
+	git config --file=server/.git/bundle-uri/bundle-list \
+		--get-regexp "bundle\..*\.uri" >actual &&
+	echo "bundle.$(basename $(cat list) .bundle).uri $(basename $(cat list))" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'run without changes writes no bundle' '
+	git -C server maintenance run --task=bundle-uri &&
+	bundles >list2 &&
+	test_cmp list list2
+'
+
+test_expect_success 'run after changes writes an increment' '
+	test_commit -C server three &&
+	git -C server maintenance run --task=bundle-uri &&
+	bundles >list &&
+	test_line_count = 2 list &&
+	git bundle list-heads $(tail -n 1 list) >heads &&
+	cut -d" " -f2 heads | sort >actual &&
+	cat >expect <<-\EOF &&
+	refs/heads/main
+	refs/tags/three
+	EOF
+	test_cmp expect actual &&
+
+	# The increment only contains what the base does not.
+	git -C server bundle verify "$PWD/$(tail -n 1 list)" >out &&
+	grep "requires this ref" out &&
+	git -C server rev-parse two >expect &&
+	grep $(cat expect) out &&
+
+	git config --file=server/.git/bundle-uri/bundle-list \
+		--get-regexp "bundle\..*\.creationtoken" >tokens &&
+	test_line_count = 2 tokens
+'
+
+test_expect_success 'refs pointing into bundled history write no bundle' '
+	test_commit -C server --no-tag untagged-1 &&
+	test_commit -C server --no-tag untagged-2 &&
+	git -C server maintenance run --task=bundle-uri &&
+	bundles >before &&
+
+	git -C server branch old main~1 &&
+	git -C server branch -f side main~1 &&
+	git -C server maintenance run --task=bundle-uri &&
+	bundles >after &&
+	test_cmp before after
+'
+
+test_expect_success 'maxIncrementals starts over with a new base' '
+	test_config -C server maintenance.bundle-uri.maxIncrementals 1 &&
+	test_commit -C server four &&
+	git -C server maintenance run --task=bundle-uri &&
+	bundles >list &&
+	test_line_count = 1 list &&
+	git bundle list-heads $(cat list) >heads &&
+	grep refs/tags/one heads &&
+	grep refs/tags/four heads &&
+	git config --file=server/.git/bundle-uri/bundle-list \
+		--get-regexp "bundle\..*\.uri" >uris &&
+	test_line_count = 1 uris
+'
+
+test_expect_success 'generated list is not advertised without bundleURIBase' '
+	test_when_finished "rm -f log" &&
+	GIT_TRACE_PACKET="$PWD/log" \
+	git -c protocol.version=2 ls-remote "file://$PWD/server" &&
+	! grep "< bundle-uri" log
+'
+
+test_expect_success 'generated list is advertised with bundleURIBase' '
+	test_config -C server uploadpack.bundleURIBase "https://example.com/bundles/" &&
+	test_commit -C server five &&
+	git -C server maintenance run --task=bundle-uri &&
+	bundles >list &&
+
+	{
+		cat <<-\EOF &&
+		[bundle]
+			version = 1
+			mode = all
+			heuristic = creationToken
+		EOF
+		for b in $(cat list)
+		do
+			id=$(basename $b .bundle) &&
+			echo "[bundle \"$id\"]" &&
+			echo "	uri = https://example.com/bundles/$id.bundle" &&
+			echo "	creationToken = ${id#bundle-}" || return 1
+		done
+	} >expect &&
+
+	test_config_global transfer.bundleURI true &&
+	test-tool bundle-uri ls-remote "file://$PWD/server" >actual &&
+	test_cmp_config_output expect actual
+'
+
+test_expect_success 'configured bundle list takes precedence' '
+	test_config -C server uploadpack.bundleURIBase "https://example.com/bundles/" &&
+	test_config -C server bundle.only.uri "https://example.com/only.bundle" &&
+	cat >expect <<-\EOF &&
+	[bundle]
+		version = 1
+		mode = all
+	[bundle "only"]
+		uri = https://example.com/only.bundle
+	EOF
+	test_config_global transfer.bundleURI true &&
+	test-tool bundle-uri ls-remote "file://$PWD/server" >actual &&
+	test_cmp_config_output expect actual
+'
+
+test_expect_success 'advertiseBundleURIs=false disables the generated list' '
+	test_when_finished "rm -f log" &&
+	test_config -C server uploadpack.bundleURIBase "https://example.com/bundles/" &&
+	test_config -C server uploadpack.advertiseBundleURIs false &&
+	GIT_TRACE_PACKET="$PWD/log" \
+	git -c protocol.version=2 ls-remote "file://$PWD/server" &&
+	! grep "< bundle-uri" log
+'
+
+test_expect_success 'clone downloads the generated bundles' '
+	test_config -C server uploadpack.bundleURIBase \
+		"file://$PWD/server/.git/bundle-uri/" &&
+	git -c protocol.version=2 \
+		-c protocol.file.allow=always \
+		-c transfer.bundleURI=true \
+		clone "file://$PWD/server" clone &&
+	git -C clone for-each-ref --format="%(refname)" refs/bundles/ >refs &&
+	grep refs/bundles/heads/main refs &&
+	git -C clone rev-parse main >actual &&
+	git -C server rev-parse main >expect &&
+	test_cmp expect actual
+'
+
+test_done
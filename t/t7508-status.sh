@@ -1773,6 +1773,65 @@ test_expect_success 'slow status advice when core.untrackedCache true, and fsmon
 	)
 '
 
+test_expect_success 'preloaded status sees changes in nested directories' '
+	git init preload-nested &&
+	(
+		cd preload-nested &&
+		mkdir -p a/b/c d &&
+		for f in top a/one a/b/two a/b/c/three a/b/c/four d/five
+		do
+			echo "$f" >"$f" || return 1
+		done &&
+		git add . &&
+		git commit -m "nested files" &&
+
+		echo changed >a/b/c/three &&
+		rm d/five &&
+		rm -r a/b/c &&
+		mkdir a/b/c &&
+		echo a/b/c/four >a/b/c/four &&
+
+		cat >expect <<-\EOF &&
+		 D a/b/c/three
+		 D d/five
+		EOF
+		for dont_sync in false true
+		do
+			GIT_TEST_PRELOAD_INDEX=1 \
+			git -c core.statDontSync=$dont_sync \
+				status --porcelain --untracked-files=no >actual &&
+			test_cmp expect actual || return 1
+		done
+	)
+'
+
+test_expect_success 'core.untrackedWalkThreads does not change the results' '
+	git init walk-threads &&
+	(
+		cd walk-threads &&
+		for d in a a/b a/b/c build build/x build/x/y ignored ignored/z
+		do
+			mkdir -p $d &&
+			echo $d >$d/file || return 1
+		done &&
+		echo ignored/ >.gitignore &&
+		git add .gitignore a/file &&
+		git commit -m initial &&
+		for args in "status --porcelain" \
+			    "status --porcelain -uall" \
+			    "status --porcelain --ignored" \
+			    "clean -n -d" \
+			    "clean -n -d -X"
+		do
+			git $args >../expect &&
+			GIT_TRACE2_EVENT="$(pwd)/../trace" GIT_TRACE2_EVENT_NESTING=10 \
+				git -c core.untrackedWalkThreads=4 $args >../actual &&
+			test_cmp ../expect ../actual || return 1
+		done
+	) &&
+	test_grep "\"key\":\"read_directory/prefetch_threads\",\"value\":\"4\"" trace
+'
+
 test_expect_success EXPENSIVE 'status does not re-read unchanged 4 or 8 GiB file' '
 	(
 		mkdir large-file &&
@@ -594,6 +594,87 @@ test_expect_success 'rapid nested directory creation' '
 	git fsmonitor--daemon status
 '
 
+# The fanotify listener watches the whole filesystem and usually needs
+# CAP_SYS_ADMIN, so only exercise it where it can actually be set up.
+#
+test_lazy_prereq FANOTIFY '
+	git init test_fanotify_smoke &&
+	git -C test_fanotify_smoke config fsmonitor.linuxBackend fanotify &&
+	GIT_TRACE_FSMONITOR="$PWD/fanotify.trace" &&
+	export GIT_TRACE_FSMONITOR &&
+	maybe_timeout 30 \
+		git -C test_fanotify_smoke fsmonitor--daemon start \
+			--start-timeout=10
+	unset GIT_TRACE_FSMONITOR
+	maybe_timeout 5 \
+		git -C test_fanotify_smoke fsmonitor--daemon stop 2>/dev/null
+	grep -q "using fanotify listener" fanotify.trace 2>/dev/null
+	ret=$?
+	rm -rf test_fanotify_smoke fanotify.trace
+	return $ret
+'
+
+test_expect_success FANOTIFY 'fanotify: edit, create, delete and rename' '
+	test_when_finished clean_up_repo_and_stop_daemon &&
+	test_config fsmonitor.linuxBackend fanotify &&
+
+	start_daemon --tf "$PWD/.git/trace" &&
+	grep "using fanotify listener" .git/trace &&
+
+	edit_files &&
+	create_files &&
+	delete_files &&
+	rename_files &&
+
+	retry_grep "^event: dir1/modified$" .git/trace &&
+	retry_grep "^event: dir1/untracked$" .git/trace &&
+	retry_grep "^event: dir2/new$" .git/trace &&
+	retry_grep "^event: delete$" .git/trace &&
+	retry_grep "^event: dir1/rename$" .git/trace &&
+	retry_grep "^event: dir1/renamed$" .git/trace
+'
+
+test_expect_success FANOTIFY 'fanotify: directory events have a trailing slash' '
+	test_when_finished clean_up_repo_and_stop_daemon &&
+	test_config fsmonitor.linuxBackend fanotify &&
+
+	start_daemon --tf "$PWD/.git/trace" &&
+
+	mv dirtorename dirrenamed &&
+	mkdir -p newdir/sub &&
+	>newdir/sub/file &&
+
+	retry_grep "^event: dirtorename/$" .git/trace &&
+	retry_grep "^event: dirrenamed/$" .git/trace &&
+	retry_grep "^event: newdir/sub/$" .git/trace &&
+	retry_grep "^event: newdir/sub/file$" .git/trace
+'
+
+test_expect_success FANOTIFY 'fanotify: status sees changes' '
+	test_when_finished clean_up_repo_and_stop_daemon &&
+	test_config fsmonitor.linuxBackend fanotify &&
+
+	start_daemon &&
+	git status --porcelain >actual.before &&
+
+	echo changed >dir1/modified &&
+	mv dir2/rename dir2/renamed &&
+
+	git status --porcelain >actual &&
+	grep "^ M dir1/modified" actual &&
+	grep "^ D dir2/rename" actual &&
+	grep "^?? dir2/renamed" actual
+'
+
+test_expect_success 'fsmonitor.linuxBackend=auto always starts' '
+	test_when_finished clean_up_repo_and_stop_daemon &&
+	test_config fsmonitor.linuxBackend auto &&
+
+	start_daemon --tf "$PWD/.git/trace" &&
+	edit_files &&
+	retry_grep "^event: dir1/modified$" .git/trace
+'
+
 # The next few test cases exercise the token-resync code.  When filesystem
 # drops events (because of filesystem velocity or because the daemon isn't
 # polling fast enough), we need to discard the cached data (relative to the
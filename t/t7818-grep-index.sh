@@ -0,0 +1,111 @@
+#!/bin/sh
+
+test_description='git grep with a trigram index of the blobs'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	cat >hello.c <<-\EOF &&
+	#include <stdio.h>
+
+	int main(void)
+	{
+		printf("Hello, world!\n");
+		return 0;
+	}
+	EOF
+	cat >list.txt <<-\EOF &&
+	apple pie
+	banana split
+	cherry tart
+	EOF
+	printf "Mixed CASE Text\n" >case.txt &&
+	printf "x" >short &&
+	printf "binary\0data with needle\n" >binary.bin &&
+	git add . &&
+	git commit -m initial &&
+	git maintenance run --task=grep-index &&
+	test_path_is_file .git/objects/info/grep-index
+'
+
+test_grep_index () {
+	test_expect_success "grep $1 gives the same result with the index" "
+		test_might_fail git -c grep.useIndex=false grep $1 HEAD >expect &&
+		test_might_fail git grep $1 HEAD >actual &&
+		test_cmp expect actual
+	"
+}
+
+test_grep_index '-e printf'
+test_grep_index '-e nothing-like-this'
+test_grep_index '-i -e HELLO'
+test_grep_index '-e "case"'
+test_grep_index '-i -e "mixed case"'
+test_grep_index '-F -e "world!"'
+test_grep_index '-e "wor.d"'
+test_grep_index '-e "ch[e]rry"'
+test_grep_index '-e "ba\\(na\\)*na"'
+test_grep_index '-E -e "(ap)?ple"'
+test_grep_index '-E -e "apple|world"'
+test_grep_index '-E -e "ban{1,2}ana"'
+test_grep_index '-w -e tart'
+test_grep_index '-c -e needle'
+test_grep_index '-l -e apple -e cherry'
+test_grep_index '--all-match -e apple -e cherry'
+test_grep_index '--all-match -e apple -e world'
+test_grep_index '-e apple --and -e pie'
+test_grep_index '-e apple --and --not -e pie'
+test_grep_index '-v -e apple'
+test_grep_index '-L -e apple'
+
+test_expect_success 'grep skips blobs that cannot match' '
+	test_must_fail env GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git grep nothing-like-this HEAD &&
+	grep "\"key\":\"index/skipped-blobs\",\"value\":\"5\"" trace.txt
+'
+
+test_expect_success 'grep.useIndex=false disables the index' '
+	rm -f trace.txt &&
+	test_must_fail env GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git -c grep.useIndex=false grep nothing-like-this HEAD &&
+	! grep index/skipped-blobs trace.txt
+'
+
+test_expect_success 'blobs missing from the index are searched' '
+	echo "fresh needle" >new.txt &&
+	git add new.txt &&
+	git commit -m new &&
+	git grep -l "fresh needle" HEAD >actual &&
+	echo HEAD:new.txt >expect &&
+	test_cmp expect actual &&
+	git grep --cached -l "fresh needle" >actual &&
+	echo new.txt >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'maintenance updates the index incrementally' '
+	rm -f trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git maintenance run --task=grep-index &&
+	grep "\"key\":\"blobs\",\"value\":\"6\"" trace.txt &&
+	grep "\"key\":\"reused\",\"value\":\"5\"" trace.txt &&
+	rm -f trace.txt &&
+	test_must_fail env GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git grep "fresh needle" HEAD~1 &&
+	grep "\"key\":\"index/skipped-blobs\",\"value\":\"5\"" trace.txt
+'
+
+test_expect_success 'blobs above core.bigFileThreshold are not indexed' '
+	test_seq 1000 >big.txt &&
+	git add big.txt &&
+	git commit -m big &&
+	rm -f trace.txt &&
+	GIT_TRACE2_EVENT="$(pwd)/trace.txt" \
+		git -c core.bigFileThreshold=1k maintenance run --task=grep-index &&
+	grep "\"key\":\"blobs\",\"value\":\"6\"" trace.txt &&
+	git grep -l 999 HEAD >actual &&
+	echo HEAD:big.txt >expect &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,128 @@
+#!/bin/sh
+
+test_description='git blame with blame.cache'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_write_lines a b c d e f g h i j >file &&
+	git add file &&
+	test_tick &&
+	git commit -m one &&
+
+	test_write_lines a B c d e f g h i j >file &&
+	test_tick &&
+	git commit -a -m two &&
+
+	git mv file renamed &&
+	test_write_lines a B c D e f g h i j >renamed &&
+	test_tick &&
+	git commit -a -m three &&
+
+	test_write_lines a B c D e F g h i j k >renamed &&
+	test_tick &&
+	git commit -a -m four &&
+
+	test_write_lines a B c D e F g H i j k >renamed &&
+	test_tick &&
+	git commit -a -m five
+'
+
+test_expect_success 'cache is not used by default' '
+	git blame HEAD~2 -- renamed >/dev/null &&
+	test_path_is_missing .git/blame-cache
+'
+
+test_expect_success 'blaming a commit stores its result' '
+	git blame --porcelain HEAD~2 -- renamed >expect &&
+	git -c blame.cache=true blame --porcelain HEAD~2 -- renamed >actual &&
+	test_cmp expect actual &&
+	test_path_is_dir .git/blame-cache
+'
+
+test_expect_success 'blaming the same commit again uses the cache' '
+	GIT_TRACE2_EVENT="$(pwd)/trace.event" \
+		git -c blame.cache=true blame --porcelain HEAD~2 -- renamed >actual &&
+	test_cmp expect actual &&
+	grep "\"key\":\"cache/hits\",\"value\":\"1\"" trace.event
+'
+
+test_expect_success 'blaming a descendant stops at the cached commit' '
+	git blame --porcelain HEAD -- renamed >expect &&
+	git blame --show-stats HEAD -- renamed >full &&
+	grep "num commits: 4" full &&
+	git -c blame.cache=true blame --porcelain HEAD -- renamed >actual &&
+	test_cmp expect actual &&
+	rm -rf .git/blame-cache/* &&
+	git -c blame.cache=true blame HEAD~2 -- renamed >/dev/null &&
+	git -c blame.cache=true blame --show-stats HEAD -- renamed >cached &&
+	grep "num commits: 2" cached
+'
+
+test_expect_success 'partial and incremental blames use the cache' '
+	git blame -L3,6 HEAD -- renamed >expect &&
+	git -c blame.cache=true blame -L3,6 HEAD -- renamed >actual &&
+	test_cmp expect actual &&
+	git blame --incremental HEAD -- renamed >expect &&
+	git -c blame.cache=true blame --incremental HEAD -- renamed >actual &&
+	sort expect >expect.sorted &&
+	sort actual >actual.sorted &&
+	test_cmp expect.sorted actual.sorted
+'
+
+test_expect_success 'options that change the result get their own entries' '
+	git blame --root HEAD -- renamed >expect &&
+	git -c blame.cache=true blame --root HEAD -- renamed >actual &&
+	test_cmp expect actual &&
+	git blame -b HEAD -- renamed >expect &&
+	git -c blame.cache=true blame -b HEAD -- renamed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cache is not used with a revision range' '
+	rm -rf .git/blame-cache &&
+	git blame HEAD~3..HEAD -- renamed >expect &&
+	git -c blame.cache=true blame HEAD~3..HEAD -- renamed >actual &&
+	test_cmp expect actual &&
+	test_path_is_missing .git/blame-cache
+'
+
+test_expect_success 'cache is not used when looking for moved lines' '
+	git -c blame.cache=true blame -M HEAD -- renamed >/dev/null &&
+	test_path_is_missing .git/blame-cache
+'
+
+test_expect_success 'corrupt cache files are ignored' '
+	git blame --porcelain HEAD -- renamed >expect &&
+	git -c blame.cache=true blame HEAD -- renamed >/dev/null &&
+	for f in .git/blame-cache/*
+	do
+		echo garbage >"$f" || return 1
+	done &&
+	git -c blame.cache=true blame --porcelain HEAD -- renamed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'gc expires cached results that were not used' '
+	rm -rf .git/blame-cache &&
+	git -c blame.cache=true blame HEAD~1 -- renamed >/dev/null &&
+	ls .git/blame-cache >old &&
+	test_line_count = 1 old &&
+	git -c blame.cache=true blame HEAD -- renamed >/dev/null &&
+	ls .git/blame-cache >all &&
+	test_line_count = 2 all &&
+	test-tool chmtime =-5000000 .git/blame-cache/* &&
+	git -c blame.cache=true blame HEAD -- renamed >/dev/null &&
+	git gc --quiet &&
+	ls .git/blame-cache >actual &&
+	comm -23 all old >expect &&
+	test_cmp expect actual &&
+	git -c gc.blameCacheExpire=never gc --quiet &&
+	ls .git/blame-cache >actual &&
+	test_cmp expect actual &&
+	git -c gc.blameCacheExpire=now gc --quiet &&
+	ls .git/blame-cache >actual &&
+	test_must_be_empty actual
+'
+
+test_done
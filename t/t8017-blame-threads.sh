@@ -0,0 +1,63 @@
+#!/bin/sh
+
+test_description='git blame with blame.threads'
+
+GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME=main
+export GIT_TEST_DEFAULT_INITIAL_BRANCH_NAME
+
+. ./test-lib.sh
+
+# The files have to be large enough for blame to bother with threads.
+test_expect_success setup '
+	test_seq 1 40000 | sed "s/^/one /" >one &&
+	test_seq 1 40000 | sed "s/^/two /" >two &&
+	test_seq 1 40000 | sed "s/^/three /" >three &&
+	git add one two three &&
+	test_tick &&
+	git commit -m initial &&
+
+	git checkout -b side &&
+	sed -e "s/^one 1000$/side 1000/" one >one.new &&
+	mv one.new one &&
+	sed -n "/^two 20000$/,/^two 20050$/p" two >chunk &&
+	cat chunk >>one &&
+	sed -n "/^three 100$/,/^three 150$/p" three >chunk &&
+	cat chunk >>one &&
+	test_tick &&
+	git commit -a -m side &&
+
+	git checkout main &&
+	sed -e "s/^one 30000$/main 30000/" one >one.new &&
+	mv one.new one &&
+	sed -n "/^two 10000$/,/^two 10050$/p" two >chunk &&
+	cat chunk >>one &&
+	sed -e "/^two 10020$/d" two >two.new &&
+	mv two.new two &&
+	test_tick &&
+	git commit -a -m main &&
+
+	test_tick &&
+	test_must_fail git merge side &&
+	sed -e "/^[<=>][<=>]*/d" one >one.new &&
+	mv one.new one &&
+	git commit -a -m merge
+'
+
+test_expect_success 'negative blame.threads is rejected' '
+	test_must_fail git -c blame.threads=-1 blame one 2>err &&
+	test_grep "invalid number of threads" err
+'
+
+for opts in "" "-M" "-C" "-C -C" "-C -C -C -M"
+do
+	test_expect_success "threads do not change output of blame $opts" "
+		git -c blame.threads=1 blame --porcelain $opts HEAD -- one >expect &&
+		GIT_TRACE2_EVENT=\"\$(pwd)/trace.event\" \
+			git -c blame.threads=4 blame --porcelain $opts HEAD -- one >actual &&
+		test_cmp expect actual &&
+		grep '\"key\":\"threaded-diffs\",\"value\":\"[1-9]' trace.event &&
+		rm trace.event
+	"
+done
+
+test_done
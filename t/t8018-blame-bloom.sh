@@ -0,0 +1,84 @@
+#!/bin/sh
+
+test_description='git blame with changed-path Bloom filters'
+
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_write_lines a b c d e f g h i j >file &&
+	git add file &&
+	test_tick &&
+	git commit -m initial &&
+
+	for i in 1 2 3 4 5
+	do
+		echo $i >other &&
+		git add other &&
+		test_tick &&
+		git commit -m "other $i" || return 1
+	done &&
+
+	git mv file renamed &&
+	test_tick &&
+	git commit -m rename &&
+
+	for i in 6 7 8 9 10
+	do
+		echo $i >other &&
+		git add other &&
+		test_tick &&
+		git commit -m "other $i" || return 1
+	done &&
+
+	test_write_lines a b C d e f g h i j >renamed &&
+	git add renamed &&
+	test_tick &&
+	git commit -m change &&
+
+	for i in 11 12 13 14 15
+	do
+		echo $i >other &&
+		git add other &&
+		test_tick &&
+		git commit -m "other $i" || return 1
+	done &&
+
+	git commit-graph write --reachable --changed-paths
+'
+
+blame_with_and_without_bloom () {
+	git -c core.commitGraph=false blame --porcelain "$@" >expect &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git blame --porcelain "$@" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'runs of unchanged commits are skipped' '
+	test_when_finished "rm -f trace.perf" &&
+	blame_with_and_without_bloom HEAD -- renamed &&
+	grep "bloom/skipped-commits:[1-9]" trace.perf
+'
+
+test_expect_success 'renamed-from path is looked up on its own' '
+	test_when_finished "rm -f trace.perf" &&
+	blame_with_and_without_bloom HEAD~6 -- renamed &&
+	grep "bloom/response-no:10" trace.perf
+'
+
+test_expect_success 'skipping stops at the boundary' '
+	test_when_finished "rm -f trace.perf" &&
+	blame_with_and_without_bloom HEAD~13..HEAD -- renamed &&
+	blame_with_and_without_bloom --since="@$((test_tick - 600))" -- renamed
+'
+
+test_expect_success 'skipping stops at commits with a cached blame' '
+	test_when_finished "rm -rf trace.perf .git/blame-cache" &&
+	git -c blame.cache=true blame HEAD~3 -- renamed >/dev/null &&
+	GIT_TRACE2_PERF="$(pwd)/trace.perf" \
+		git -c blame.cache=true blame HEAD -- renamed >actual &&
+	grep "cache/hits:1" trace.perf &&
+	git blame HEAD -- renamed >expect &&
+	test_cmp expect actual
+'
+
+test_done
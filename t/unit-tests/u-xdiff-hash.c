@@ -0,0 +1,74 @@
+#include "unit-test.h"
+#include "xdiff/xinclude.h"
+
+/* The plain djb2 loop that xdl_hash_record_verbatim() must agree with. */
+static uint64_t hash_reference(uint8_t const **data, uint8_t const *top)
+{
+	uint64_t ha = 5381;
+	uint8_t const *ptr = *data;
+
+	for (; ptr < top && *ptr != '\n'; ptr++) {
+		ha += (ha << 5);
+		ha += (uint64_t) *ptr;
+	}
+	*data = ptr < top ? ptr + 1: ptr;
+	return ha;
+}
+
+static void check_hash_all_lines(const uint8_t *buf, size_t len)
+{
+	const uint8_t *top = buf + len;
+	const uint8_t *a = buf, *b = buf;
+
+	while (a < top) {
+		uint64_t ha = xdl_hash_record_verbatim(&a, top);
+		uint64_t hb = hash_reference(&b, top);
+
+		cl_assert_equal_u(ha, hb);
+		cl_assert_equal_i(a - buf, b - buf);
+	}
+}
+
+void test_xdiff_hash__short_lines(void)
+{
+	const char *s = "\n\na\nab\nabc\nabcdefg\nabcdefgh\nabcdefghi\nno newline";
+
+	check_hash_all_lines((const uint8_t *)s, strlen(s));
+}
+
+void test_xdiff_hash__every_length_and_offset(void)
+{
+	uint8_t buf[80];
+	size_t len, nl;
+
+	/*
+	 * Put a single newline at every position of lines of every length
+	 * around the eight-byte steps, and include bytes with the high bit
+	 * set, which must not be mistaken for newlines.
+	 */
+	for (len = 1; len < sizeof(buf); len++) {
+		for (nl = 0; nl <= len; nl++) {
+			size_t i;
+
+			for (i = 0; i < len; i++)
+				buf[i] = (uint8_t)(0x80 + 7 * i + len);
+			if (nl < len)
+				buf[nl] = '\n';
+			check_hash_all_lines(buf, len);
+		}
+	}
+}
+
+void test_xdiff_hash__pseudo_random(void)
+{
+	uint8_t buf[4096];
+	uint32_t seed = 12345;
+	size_t i;
+
+	for (i = 0; i < sizeof(buf); i++) {
+		seed = seed * 1103515245 + 12345;
+		/* about one newline every 40 bytes */
+		buf[i] = (seed >> 16) % 40 ? (uint8_t)(seed >> 8) : '\n';
+	}
+	check_hash_all_lines(buf, sizeof(buf));
+}
@@ -560,6 +560,14 @@ enum trace2_counter_id {
 	TRACE2_COUNTER_ID_FSYNC_WRITEOUT_ONLY,
 	TRACE2_COUNTER_ID_FSYNC_HARDWARE_FLUSH,
 
+	/* counts sparse index expansions and the entries they add */
+	TRACE2_COUNTER_ID_SPARSE_INDEX_EXPANSIONS,
+	TRACE2_COUNTER_ID_SPARSE_INDEX_EXPANDED_ENTRIES,
+
+	/* counts upload-pack responses served from or missing the pack cache */
+	TRACE2_COUNTER_ID_UPLOAD_PACK_CACHE_HITS,
+	TRACE2_COUNTER_ID_UPLOAD_PACK_CACHE_MISSES,
+
 	/* Add additional counter definitions before here. */
 	TRACE2_NUMBER_OF_COUNTERS
 };
@@ -46,6 +46,26 @@ static struct tr2_counter_metadata tr2_counter_metadata[TRACE2_NUMBER_OF_COUNTER
 		.name = "hardware-flush",
 		.want_per_thread_events = 0,
 	},
+	[TRACE2_COUNTER_ID_SPARSE_INDEX_EXPANSIONS] = {
+		.category = "index",
+		.name = "sparse_expansions",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_SPARSE_INDEX_EXPANDED_ENTRIES] = {
+		.category = "index",
+		.name = "sparse_expanded_entries",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_UPLOAD_PACK_CACHE_HITS] = {
+		.category = "upload-pack",
+		.name = "pack_cache_hits",
+		.want_per_thread_events = 0,
+	},
+	[TRACE2_COUNTER_ID_UPLOAD_PACK_CACHE_MISSES] = {
+		.category = "upload-pack",
+		.name = "pack_cache_misses",
+		.want_per_thread_events = 0,
+	},
 
 	/* Add additional metadata before here. */
 };
@@ -34,6 +34,11 @@
 #include "json-writer.h"
 #include "strmap.h"
 #include "promisor-remote.h"
+#include "pack-bitmap.h"
+#include "ewah/ewok.h"
+#include "tempfile.h"
+#include "path.h"
+#include "dir.h"
 
 /* Remember to update object flag allocation in object.h */
 #define THEY_HAVE	(1u << 11)
@@ -81,6 +86,16 @@ struct upload_pack_data {
 	int shallow_nr;
 	timestamp_t oldest_have;
 
+	/*
+	 * Reachability bitmaps of the wants, to tell whether they reach
+	 * something the client has without walking. See ok_to_give_up().
+	 */
+	struct bitmap_index *bitmap_git;
+	struct bitmap **want_bitmaps;
+	unsigned char *want_reaches_have;
+	int bitmap_haves_checked;
+	int use_bitmaps;
+
 	unsigned int timeout;					/* v0 only */
 	enum {
 		NO_MULTI_ACK = 0,
@@ -101,6 +116,9 @@ struct upload_pack_data {
 
 	char *pack_objects_hook;
 
+	unsigned long pack_cache_max_size;
+	int pack_cache_max_age;
+
 	unsigned stateless_rpc : 1;				/* v0 only */
 	unsigned no_done : 1;					/* v0 only */
 	unsigned daemon_mode : 1;				/* v0 only */
@@ -113,6 +131,8 @@ struct upload_pack_data {
 	unsigned wait_for_done : 1;
 	unsigned allow_filter : 1;
 	unsigned allow_filter_fallback : 1;
+	unsigned pack_objects_in_process : 1;
+	unsigned use_pack_cache : 1;
 	unsigned long tree_filter_max_depth;
 
 	unsigned done : 1;					/* v2 only */
@@ -154,6 +174,9 @@ static void upload_pack_data_init(struct upload_pack_data *data)
 	list_objects_filter_init(&data->filter_options);
 
 	data->keepalive = 5;
+	data->use_bitmaps = 1;
+	data->pack_cache_max_size = 1024 * 1024 * 1024;
+	data->pack_cache_max_age = 600;
 	data->advertise_sid = 0;
 }
 
@@ -162,7 +185,6 @@ static void upload_pack_data_clear(struct upload_pack_data *data)
 	string_list_clear(&data->symref, 1);
 	strmap_clear(&data->wanted_refs, 1);
 	strvec_clear(&data->hidden_refs);
-	object_array_clear(&data->want_obj);
 	object_array_clear(&data->have_obj);
 	object_array_clear(&data->shallows);
 	oidset_clear(&data->deepen_not);
@@ -172,6 +194,22 @@ static void upload_pack_data_clear(struct upload_pack_data *data)
 	string_list_clear(&data->uri_protocols, 0);
 
 	free((char *)data->pack_objects_hook);
+
+	if (data->want_bitmaps) {
+		int i, nr = 0;
+
+		for (i = 0; i < data->want_obj.nr; i++) {
+			if (data->want_bitmaps[i])
+				nr++;
+			bitmap_free(data->want_bitmaps[i]);
+		}
+		trace2_data_intmax("upload-pack", the_repository,
+				   "negotiation/bitmapped-wants", nr);
+	}
+	free(data->want_bitmaps);
+	free(data->want_reaches_have);
+	free_bitmap_index(data->bitmap_git);
+	object_array_clear(&data->want_obj);
 }
 
 static void reset_timeout(unsigned int timeout)
@@ -216,6 +254,8 @@ struct output_state {
 	int used;
 	unsigned packfile_uris_started : 1;
 	unsigned packfile_started : 1;
+	/* where to keep a copy of the pack, if it is to be cached */
+	struct tempfile *cache;
 };
 
 static int relay_pack_data(int pack_objects_out, struct output_state *os,
@@ -241,6 +281,10 @@ static int relay_pack_data(int pack_objects_out, struct output_state *os,
 	if (readsz < 0) {
 		return readsz;
 	}
+	if (os->cache && readsz &&
+	    write_in_full(get_tempfile_fd(os->cache),
+			  os->buffer + os->used, readsz) < 0)
+		delete_tempfile(&os->cache);
 	os->used += readsz;
 
 	while (!os->packfile_started) {
@@ -296,10 +340,253 @@ static int relay_pack_data(int pack_objects_out, struct output_state *os,
 	return readsz;
 }
 
+static upload_pack_pack_objects_fn pack_objects_fn;
+
+void upload_pack_set_pack_objects_fn(upload_pack_pack_objects_fn fn)
+{
+	pack_objects_fn = fn;
+}
+
+/*
+ * Whether this response can be generated by pack_objects_fn in our
+ * own process. The hook needs a command line to wrap, shallow
+ * responses need pack-objects to see a different set of grafts than
+ * we do, and pack-objects can only run once per process.
+ */
+static int use_pack_objects_in_process(struct upload_pack_data *pack_data)
+{
+	static int used;
+
+	if (!pack_data->pack_objects_in_process || !pack_objects_fn ||
+	    pack_data->pack_objects_hook || pack_data->shallow_nr || used)
+		return 0;
+	used = 1;
+	return 1;
+}
+
+static int pack_objects_async(int in, int out, void *data)
+{
+	return pack_objects_fn(the_repository, data, in, out);
+}
+
+/*
+ * The pack generated for a request only depends on what goes into
+ * pack-objects: the objects wanted and had, the options, and for
+ * --include-tag the tags we have. Identical requests, like those of
+ * CI machines all fetching the same push, can thus be answered from
+ * a copy of an earlier response.
+ *
+ * Shallow requests make pack-objects look at grafts, packfile URIs
+ * depend on the configuration, and promisor remotes may fill in
+ * objects later, so we do not cache responses to those.
+ */
+static int use_pack_cache(struct upload_pack_data *pack_data,
+			  const struct string_list *uri_protocols)
+{
+	return pack_data->use_pack_cache && !pack_data->shallow_nr &&
+		!uri_protocols &&
+		!repo_has_accepted_promisor_remote(the_repository);
+}
+
+static int hash_cache_key_oid(const struct object_id *oid, void *data)
+{
+	git_hash_update(data, oid_to_hex(oid), the_hash_algo->hexsz);
+	git_hash_update(data, "\n", 1);
+	return 0;
+}
+
+static int hash_cache_key_tag(const struct reference *ref, void *data)
+{
+	git_hash_update(data, ref->name, strlen(ref->name) + 1);
+	hash_cache_key_oid(ref->oid, data);
+	return 0;
+}
+
+static void hash_cache_key_objects(struct git_hash_ctx *ctx, const char *label,
+				   const struct object_array *a,
+				   const struct object_array *b)
+{
+	struct oid_array oids = OID_ARRAY_INIT;
+	int i;
+
+	for (i = 0; i < a->nr; i++)
+		oid_array_append(&oids, &a->objects[i].item->oid);
+	for (i = 0; b && i < b->nr; i++)
+		oid_array_append(&oids, &b->objects[i].item->oid);
+
+	git_hash_update(ctx, label, strlen(label) + 1);
+	oid_array_for_each_unique(&oids, hash_cache_key_oid, ctx);
+	oid_array_clear(&oids);
+}
+
+static char *pack_cache_path(struct upload_pack_data *pack_data)
+{
+	struct git_hash_ctx ctx;
+	struct strbuf buf = STRBUF_INIT;
+	struct object_id key;
+
+	strbuf_addf(&buf, "upload-pack-cache 1\nthin %d\nofs-delta %d\n"
+		    "include-tag %d\n",
+		    pack_data->use_thin_pack, pack_data->use_ofs_delta,
+		    pack_data->use_include_tag);
+	if (pack_data->filter_options.choice)
+		strbuf_addf(&buf, "filter %s\n",
+			    expand_list_objects_filter_spec(&pack_data->filter_options));
+
+	the_hash_algo->init_fn(&ctx);
+	git_hash_update(&ctx, buf.buf, buf.len + 1);
+	hash_cache_key_objects(&ctx, "want", &pack_data->want_obj, NULL);
+	hash_cache_key_objects(&ctx, "have", &pack_data->have_obj,
+			       &pack_data->extra_edge_obj);
+	if (pack_data->use_include_tag) {
+		git_hash_update(&ctx, "tags", 5);
+		refs_for_each_tag_ref(get_main_ref_store(the_repository),
+				      hash_cache_key_tag, &ctx);
+	}
+	git_hash_final_oid(&key, &ctx);
+
+	strbuf_release(&buf);
+	return repo_git_path(the_repository, "upload-pack-cache/%s.pack",
+			     oid_to_hex(&key));
+}
+
+static int send_cached_pack(struct upload_pack_data *pack_data,
+			    const char *path)
+{
+	struct stat st;
+	const char *map;
+	size_t size, off;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) ||
+	    time(NULL) - st.st_mtime > pack_data->pack_cache_max_age ||
+	    st.st_size < 12 + the_hash_algo->rawsz) {
+		close(fd);
+		return 0;
+	}
+	size = xsize_t(st.st_size);
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (memcmp(map, "PACK", 4)) {
+		munmap((void *)map, size);
+		return 0;
+	}
+
+	/*
+	 * Send straight from the mapping; there is nothing to look at
+	 * on the way. Go in slices so that a large pack does not trip
+	 * the inactivity timeout.
+	 */
+	for (off = 0; off < size; off += 1024 * 1024) {
+		reset_timeout(pack_data->timeout);
+		send_client_data(1, map + off, size - off < 1024 * 1024 ?
+				 size - off : 1024 * 1024,
+				 pack_data->use_sideband);
+	}
+	munmap((void *)map, size);
+	if (pack_data->use_sideband)
+		packet_flush(1);
+	return 1;
+}
+
+static struct tempfile *create_pack_cache_tempfile(void)
+{
+	char *path = repo_git_path(the_repository,
+				   "upload-pack-cache/tmp_pack_XXXXXX");
+	struct tempfile *tempfile = NULL;
+
+	if (safe_create_leading_directories(the_repository, path) == SCLD_OK)
+		tempfile = mks_tempfile_m(path, 0444);
+	free(path);
+	return tempfile;
+}
+
+struct pack_cache_entry {
+	char *path;
+	time_t mtime;
+	off_t size;
+};
+
+static int pack_cache_entry_cmp(const void *va, const void *vb)
+{
+	const struct pack_cache_entry *a = va, *b = vb;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+	return strcmp(a->path, b->path);
+}
+
+/*
+ * Drop cached packs older than uploadpack.packCacheMaxAge, and then
+ * the oldest ones until the rest fits into uploadpack.packCacheMaxSize.
+ * Temporary files of responses still being written are left alone
+ * unless they are old enough to have been left behind.
+ */
+static void prune_pack_cache(struct upload_pack_data *pack_data)
+{
+	char *dir = repo_git_path(the_repository, "upload-pack-cache");
+	struct strbuf path = STRBUF_INIT;
+	struct pack_cache_entry *entries = NULL;
+	size_t nr = 0, alloc = 0, i;
+	uintmax_t total = 0;
+	time_t now = time(NULL);
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d)
+		goto out;
+	while ((de = readdir(d))) {
+		struct stat st;
+
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", dir, de->d_name);
+		if (lstat(path.buf, &st) || !S_ISREG(st.st_mode))
+			continue;
+		if (now - st.st_mtime > pack_data->pack_cache_max_age) {
+			unlink_or_warn(path.buf);
+			continue;
+		}
+		if (!ends_with(de->d_name, ".pack"))
+			continue;
+
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr].path = xstrdup(path.buf);
+		entries[nr].mtime = st.st_mtime;
+		entries[nr].size = st.st_size;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(d);
+
+	QSORT(entries, nr, pack_cache_entry_cmp);
+	for (i = 0; i < nr; i++) {
+		if (total > pack_data->pack_cache_max_size) {
+			unlink_or_warn(entries[i].path);
+			total -= entries[i].size;
+		}
+		free(entries[i].path);
+	}
+	free(entries);
+out:
+	strbuf_release(&path);
+	free(dir);
+}
+
 static void create_pack_file(struct upload_pack_data *pack_data,
 			     const struct string_list *uri_protocols)
 {
 	struct child_process pack_objects = CHILD_PROCESS_INIT;
+	struct async pack_objects_thread = { 0 };
+	struct strvec args = STRVEC_INIT;
+	int in_process;
+	int pack_out, pack_err;
+	char *cache_path = NULL;
 	struct output_state *output_state = xcalloc(1, sizeof(struct output_state));
 	char progress[128];
 	char abort_msg[] = "aborting due to possible repository "
@@ -309,54 +596,96 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 	int i;
 	FILE *pipe_fd;
 
-	if (!pack_data->pack_objects_hook)
-		pack_objects.git_cmd = 1;
-	else {
-		strvec_push(&pack_objects.args, pack_data->pack_objects_hook);
-		strvec_push(&pack_objects.args, "git");
-		pack_objects.use_shell = 1;
+	if (use_pack_cache(pack_data, uri_protocols)) {
+		cache_path = pack_cache_path(pack_data);
+		if (send_cached_pack(pack_data, cache_path)) {
+			trace2_counter_add(TRACE2_COUNTER_ID_UPLOAD_PACK_CACHE_HITS, 1);
+			free(cache_path);
+			free(output_state);
+			return;
+		}
+		trace2_counter_add(TRACE2_COUNTER_ID_UPLOAD_PACK_CACHE_MISSES, 1);
+		output_state->cache = create_pack_cache_tempfile();
 	}
 
-	if (pack_data->shallow_nr) {
-		strvec_push(&pack_objects.args, "--shallow-file");
-		strvec_push(&pack_objects.args, "");
-	}
-	strvec_push(&pack_objects.args, "pack-objects");
-	strvec_push(&pack_objects.args, "--revs");
+	in_process = use_pack_objects_in_process(pack_data);
+
+	strvec_push(&args, "--revs");
 	if (pack_data->use_thin_pack)
-		strvec_push(&pack_objects.args, "--thin");
+		strvec_push(&args, "--thin");
 
-	strvec_push(&pack_objects.args, "--stdout");
+	strvec_push(&args, "--stdout");
 	if (pack_data->shallow_nr)
-		strvec_push(&pack_objects.args, "--shallow");
-	if (!pack_data->no_progress)
-		strvec_push(&pack_objects.args, "--progress");
+		strvec_push(&args, "--shallow");
+	/*
+	 * In-process, our stderr is pack-objects' stderr, so there is
+	 * nothing we could relay progress from.
+	 */
+	if (in_process)
+		strvec_push(&args, "--quiet");
+	else if (!pack_data->no_progress)
+		strvec_push(&args, "--progress");
 	if (pack_data->use_ofs_delta)
-		strvec_push(&pack_objects.args, "--delta-base-offset");
+		strvec_push(&args, "--delta-base-offset");
 	if (pack_data->use_include_tag)
-		strvec_push(&pack_objects.args, "--include-tag");
+		strvec_push(&args, "--include-tag");
 	if (repo_has_accepted_promisor_remote(the_repository))
-		strvec_push(&pack_objects.args, "--missing=allow-promisor");
+		strvec_push(&args, "--missing=allow-promisor");
 	if (pack_data->filter_options.choice) {
 		const char *spec =
 			expand_list_objects_filter_spec(&pack_data->filter_options);
-		strvec_pushf(&pack_objects.args, "--filter=%s", spec);
+		strvec_pushf(&args, "--filter=%s", spec);
 	}
 	if (uri_protocols) {
 		for (i = 0; i < uri_protocols->nr; i++)
-			strvec_pushf(&pack_objects.args, "--uri-protocol=%s",
+			strvec_pushf(&args, "--uri-protocol=%s",
 					 uri_protocols->items[i].string);
 	}
 
-	pack_objects.in = -1;
-	pack_objects.out = -1;
-	pack_objects.err = -1;
-	pack_objects.clean_on_exit = 1;
-
-	if (start_command(&pack_objects))
-		die("git upload-pack: unable to fork git-pack-objects");
+	if (in_process) {
+		/*
+		 * The revision walk in pack-objects starts from a clean
+		 * slate, but it shares our object store and would trip
+		 * over the flags we left behind during negotiation.
+		 */
+		clear_object_flags(the_repository, ~0);
+
+		pack_objects_thread.proc = pack_objects_async;
+		pack_objects_thread.data = &args;
+		pack_objects_thread.in = -1;
+		pack_objects_thread.out = -1;
+		if (start_async(&pack_objects_thread))
+			die("git upload-pack: unable to start pack-objects");
+		pipe_fd = xfdopen(pack_objects_thread.in, "w");
+		pack_out = pack_objects_thread.out;
+		pack_err = -1;
+	} else {
+		if (!pack_data->pack_objects_hook)
+			pack_objects.git_cmd = 1;
+		else {
+			strvec_push(&pack_objects.args, pack_data->pack_objects_hook);
+			strvec_push(&pack_objects.args, "git");
+			pack_objects.use_shell = 1;
+		}
 
-	pipe_fd = xfdopen(pack_objects.in, "w");
+		if (pack_data->shallow_nr) {
+			strvec_push(&pack_objects.args, "--shallow-file");
+			strvec_push(&pack_objects.args, "");
+		}
+		strvec_push(&pack_objects.args, "pack-objects");
+		strvec_pushv(&pack_objects.args, args.v);
+
+		pack_objects.in = -1;
+		pack_objects.out = -1;
+		pack_objects.err = -1;
+		pack_objects.clean_on_exit = 1;
+
+		if (start_command(&pack_objects))
+			die("git upload-pack: unable to fork git-pack-objects");
+		pipe_fd = xfdopen(pack_objects.in, "w");
+		pack_out = pack_objects.out;
+		pack_err = pack_objects.err;
+	}
 
 	if (pack_data->shallow_nr)
 		for_each_commit_graft(write_one_shallow, pipe_fd);
@@ -375,8 +704,8 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 	fflush(pipe_fd);
 	fclose(pipe_fd);
 
-	/* We read from pack_objects.err to capture stderr output for
-	 * progress bar, and pack_objects.out to capture the pack data.
+	/* We read from pack_err to capture stderr output for
+	 * progress bar, and pack_out to capture the pack data.
 	 */
 
 	while (1) {
@@ -393,14 +722,14 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 		pollsize = 0;
 		pe = pu = -1;
 
-		if (0 <= pack_objects.out) {
-			pfd[pollsize].fd = pack_objects.out;
+		if (0 <= pack_out) {
+			pfd[pollsize].fd = pack_out;
 			pfd[pollsize].events = POLLIN;
 			pu = pollsize;
 			pollsize++;
 		}
-		if (0 <= pack_objects.err) {
-			pfd[pollsize].fd = pack_objects.err;
+		if (0 <= pack_err) {
+			pfd[pollsize].fd = pack_err;
 			pfd[pollsize].events = POLLIN;
 			pe = pollsize;
 			pollsize++;
@@ -437,15 +766,15 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 			/* Status ready; we ship that in the side-band
 			 * or dump to the standard error.
 			 */
-			sz = xread(pack_objects.err, progress,
+			sz = xread(pack_err, progress,
 				  sizeof(progress));
 			if (0 < sz) {
 				send_client_data(2, progress, sz,
 						 pack_data->use_sideband);
 				last_sent_ms = now_ms;
 			} else if (sz == 0) {
-				close(pack_objects.err);
-				pack_objects.err = -1;
+				close(pack_err);
+				pack_err = -1;
 			}
 			else
 				goto fail;
@@ -455,15 +784,15 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 
 		if (0 <= pu && (pfd[pu].revents & (POLLIN|POLLHUP))) {
 			bool did_send_data;
-			int result = relay_pack_data(pack_objects.out,
+			int result = relay_pack_data(pack_out,
 						     output_state,
 						     pack_data->use_sideband,
 						     !!uri_protocols,
 						     &did_send_data);
 
 			if (result == 0) {
-				close(pack_objects.out);
-				pack_objects.out = -1;
+				close(pack_out);
+				pack_out = -1;
 			} else if (result < 0) {
 				goto fail;
 			}
@@ -498,10 +827,19 @@ static void create_pack_file(struct upload_pack_data *pack_data,
 		}
 	}
 
-	if (finish_command(&pack_objects)) {
+	if (in_process ? finish_async(&pack_objects_thread) :
+			 finish_command(&pack_objects)) {
 		error("git upload-pack: git-pack-objects died with error.");
 		goto fail;
 	}
+	strvec_clear(&args);
+
+	if (output_state->cache &&
+	    !rename_tempfile(&output_state->cache, cache_path)) {
+		adjust_shared_perm(the_repository, cache_path);
+		prune_pack_cache(pack_data);
+	}
+	free(cache_path);
 
 	/* flush the data */
 	if (output_state->used > 0)
@@ -558,16 +896,123 @@ static int got_oid(struct upload_pack_data *data,
 	return do_got_oid(data, oid);
 }
 
+/*
+ * Expanding a bitmap takes one bit per object in the bitmapped packs,
+ * for every want. Only expand that many bytes' worth, and walk from
+ * the remaining wants as if they had no bitmap, so that a request
+ * with many wants on a big repository does not use a lot of memory.
+ */
+#define WANT_BITMAPS_MAX_BYTES (32 * 1024 * 1024)
+
+static void prepare_want_bitmaps(struct upload_pack_data *data)
+{
+	size_t budget = git_env_ulong("GIT_TEST_UPLOAD_PACK_WANT_BITMAPS_MAX_BYTES",
+				      WANT_BITMAPS_MAX_BYTES);
+	int i;
+
+	/* Whatever the outcome, do not try again. */
+	data->use_bitmaps = 0;
+	if (!data->want_obj.nr)
+		return;
+	data->bitmap_git = prepare_bitmap_git(the_repository);
+	if (!data->bitmap_git)
+		return;
+
+	CALLOC_ARRAY(data->want_bitmaps, data->want_obj.nr);
+	CALLOC_ARRAY(data->want_reaches_have, data->want_obj.nr);
+	for (i = 0; i < data->want_obj.nr; i++) {
+		struct object *o = data->want_obj.objects[i].item;
+		struct ewah_bitmap *ewah;
+
+		if (o->type != OBJ_COMMIT)
+			continue;
+		ewah = bitmap_for_commit(data->bitmap_git, (struct commit *)o);
+		if (ewah) {
+			size_t size = DIV_ROUND_UP(ewah->bit_size, BITS_IN_EWORD) *
+				      sizeof(eword_t);
+
+			if (size > budget)
+				break;
+			budget -= size;
+			data->want_bitmaps[i] = ewah_to_bitmap(ewah);
+		}
+	}
+}
+
+/*
+ * Look up the haves that arrived since the last call, and their
+ * parents (which got THEY_HAVE, too), in the bitmaps of the wants.
+ */
+static void check_haves_in_want_bitmaps(struct upload_pack_data *data)
+{
+	for (; data->bitmap_haves_checked < data->have_obj.nr;
+	     data->bitmap_haves_checked++) {
+		struct object *have =
+			data->have_obj.objects[data->bitmap_haves_checked].item;
+		int i;
+
+		for (i = 0; i < data->want_obj.nr; i++) {
+			struct bitmap *reach = data->want_bitmaps[i];
+			struct commit_list *p = NULL;
+
+			if (!reach || data->want_reaches_have[i])
+				continue;
+			if (bitmap_walk_contains(data->bitmap_git, reach,
+						 &have->oid)) {
+				data->want_reaches_have[i] = 1;
+				continue;
+			}
+			if (have->type == OBJ_COMMIT)
+				p = ((struct commit *)have)->parents;
+			for (; p; p = p->next) {
+				if (bitmap_walk_contains(data->bitmap_git, reach,
+							 &p->item->object.oid)) {
+					data->want_reaches_have[i] = 1;
+					break;
+				}
+			}
+		}
+	}
+}
+
 static int ok_to_give_up(struct upload_pack_data *data)
 {
 	timestamp_t min_generation = GENERATION_NUMBER_ZERO;
+	struct object_array unbitmapped = OBJECT_ARRAY_INIT;
+	int i, ret;
 
 	if (!data->have_obj.nr)
 		return 0;
 
-	return can_all_from_reach_with_flag(&data->want_obj, THEY_HAVE,
-					    COMMON_KNOWN, data->oldest_have,
-					    min_generation);
+	if (data->use_bitmaps)
+		prepare_want_bitmaps(data);
+	if (!data->bitmap_git)
+		return can_all_from_reach_with_flag(&data->want_obj, THEY_HAVE,
+						    COMMON_KNOWN, data->oldest_have,
+						    min_generation);
+
+	/*
+	 * The bitmap of a want holds everything reachable from it, so
+	 * it settles the question for that want either way, and we only
+	 * have to walk from the wants without one. Unlike the walk, the
+	 * answer does not depend on the commit dates either.
+	 */
+	check_haves_in_want_bitmaps(data);
+	for (i = 0; i < data->want_obj.nr; i++) {
+		if (!data->want_bitmaps[i])
+			add_object_array(data->want_obj.objects[i].item, NULL,
+					 &unbitmapped);
+		else if (!data->want_reaches_have[i]) {
+			object_array_clear(&unbitmapped);
+			return 0;
+		}
+	}
+
+	ret = can_all_from_reach_with_flag(&unbitmapped, THEY_HAVE,
+					   COMMON_KNOWN, data->oldest_have,
+					   min_generation);
+	object_array_clear(&unbitmapped);
+	return ret;
 }
 
 static int get_common_commits(struct upload_pack_data *data,
@@ -1363,6 +1808,16 @@ static int upload_pack_config(const char *var, const char *value,
 		data->allow_ref_in_want = git_config_bool(var, value);
 	} else if (!strcmp("uploadpack.allowsidebandall", var)) {
 		data->allow_sideband_all = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packobjectsinprocess", var)) {
+		data->pack_objects_in_process = git_config_bool(var, value);
+	} else if (!strcmp("pack.usebitmaps", var)) {
+		data->use_bitmaps = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packcache", var)) {
+		data->use_pack_cache = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packcachemaxsize", var)) {
+		data->pack_cache_max_size = git_config_ulong(var, value, ctx->kvi);
+	} else if (!strcmp("uploadpack.packcachemaxage", var)) {
+		data->pack_cache_max_age = git_config_int(var, value, ctx->kvi);
 	} else if (!strcmp("uploadpack.blobpackfileuri", var)) {
 		if (value)
 			data->allow_packfile_uris = 1;
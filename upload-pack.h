@@ -12,4 +12,17 @@ struct strbuf;
 int upload_pack_advertise(struct repository *r,
 			  struct strbuf *value);
 
+/*
+ * With uploadpack.packObjectsInProcess, the pack is generated by
+ * calling this function in a thread instead of running "git
+ * pack-objects". It is given the arguments pack-objects would have
+ * been run with (without the command name), reads the objects to pack
+ * from "in" and writes the pack to "out", and has to close both.
+ */
+struct strvec;
+typedef int (*upload_pack_pack_objects_fn)(struct repository *r,
+					   const struct strvec *args,
+					   int in, int out);
+void upload_pack_set_pack_objects_fn(upload_pack_pack_objects_fn fn);
+
 #endif /* UPLOAD_PACK_H */
@@ -265,6 +265,28 @@ ssize_t xwrite(int fd, const void *buf, size_t len)
 	}
 }
 
+/*
+ * xwritev() is the same as writev(), but it automatically restarts
+ * writev() operations with a recoverable error (EAGAIN and EINTR).
+ * xwritev() DOES NOT GUARANTEE that all buffers are written even if the
+ * operation is successful.
+ */
+ssize_t xwritev(int fd, const struct iovec *iov, int iovcnt)
+{
+	ssize_t nr;
+	while (1) {
+		nr = writev(fd, iov, iovcnt);
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			if (handle_nonblock(fd, POLLOUT, errno))
+				continue;
+		}
+
+		return nr;
+	}
+}
+
 /*
  * xpread() is the same as pread(), but it automatically restarts pread()
  * operations with a recoverable error (EAGAIN and EINTR). xpread() DOES
@@ -323,6 +345,42 @@ ssize_t write_in_full(int fd, const void *buf, size_t count)
 	return total;
 }
 
+ssize_t writev_in_full(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t total = 0;
+
+	while (iovcnt) {
+		ssize_t written;
+
+		if (!iov->iov_len) {
+			iov++;
+			iovcnt--;
+			continue;
+		}
+
+		written = xwritev(fd, iov, iovcnt);
+		if (written < 0)
+			return -1;
+		if (!written) {
+			errno = ENOSPC;
+			return -1;
+		}
+		total += written;
+
+		while (iovcnt && (size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (written) {
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	return total;
+}
+
 ssize_t pread_in_full(int fd, void *buf, size_t count, off_t offset)
 {
 	char *p = buf;
@@ -88,6 +88,15 @@ typedef struct s_xpparam {
 	/* See Documentation/diff-options.adoc. */
 	char **anchors;
 	size_t anchors_nr;
+
+	/*
+	 * Split the Myers diff of files longer than this many lines at
+	 * lines that are unique in both files (0: never).
+	 */
+	long split_lines;
+
+	/* Edit cost after which Myers settles for a non-minimal split (0: automatic). */
+	long max_cost;
 } xpparam_t;
 
 typedef struct s_xdemitcb {
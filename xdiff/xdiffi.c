@@ -311,6 +311,150 @@ int xdl_recs_cmp(xdfile_t *xdf1, long off1, long lim1,
 }
 
 
+static void xdl_setup_algoenv(xpparam_t const *xpp, long ndiags,
+			      xdalgoenv_t *xenv) {
+
+	if (xpp->max_cost > 0) {
+		xenv->mxcost = xpp->max_cost;
+	} else {
+		xenv->mxcost = (long)xdl_bogosqrt((uint64_t)ndiags);
+		if (xenv->mxcost < XDL_MAX_COST_MIN)
+			xenv->mxcost = XDL_MAX_COST_MIN;
+	}
+	xenv->snake_cnt = XDL_SNAKE_CNT;
+	xenv->heur_min = XDL_HEUR_MIN_COST;
+}
+
+
+/*
+ * Find the lines that occur exactly once in each file and return in
+ * "anchors" (as pairs of indices into the reduced records of each file)
+ * the longest run of them that appears in the same order in both files,
+ * like the patience algorithm does at its top level.
+ */
+static long xdl_find_unique_anchors(xdfenv_t *xe, long **anchors) {
+	xdfile_t *xdf1 = &xe->xdf1, *xdf2 = &xe->xdf2;
+	long n1 = (long)xdf1->nreff, n2 = (long)xdf2->nreff;
+	size_t nclass = xdf1->nrec + xdf2->nrec, h;
+	uint8_t *cnt1 = NULL, *cnt2 = NULL;
+	long *pos2 = NULL, *cand = NULL, *tails = NULL, *prev = NULL;
+	long i, ncand = 0, len = 0, k, res = -1;
+
+	*anchors = NULL;
+	if (!XDL_CALLOC_ARRAY(cnt1, nclass) ||
+	    !XDL_CALLOC_ARRAY(cnt2, nclass) ||
+	    !XDL_ALLOC_ARRAY(pos2, nclass))
+		goto out;
+
+	for (i = 0; i < n2; i++) {
+		h = get_hash(xdf2, i);
+		if (cnt2[h] < 2)
+			cnt2[h]++;
+		pos2[h] = i;
+	}
+	for (i = 0; i < n1; i++) {
+		h = get_hash(xdf1, i);
+		if (cnt1[h] < 2)
+			cnt1[h]++;
+	}
+
+	/* the candidates, in the order of the first file */
+	if (!XDL_ALLOC_ARRAY(cand, n1 + 1))
+		goto out;
+	for (i = 0; i < n1; i++) {
+		h = get_hash(xdf1, i);
+		if (cnt1[h] == 1 && cnt2[h] == 1)
+			cand[ncand++] = i;
+	}
+
+	/*
+	 * Longest increasing subsequence of their positions in the second
+	 * file: tails[k] is the candidate ending the best run of length
+	 * k + 1 found so far, prev[] links each candidate to the one before
+	 * it in its run.
+	 */
+	if (!XDL_ALLOC_ARRAY(tails, ncand + 1) ||
+	    !XDL_ALLOC_ARRAY(prev, ncand + 1))
+		goto out;
+	for (i = 0; i < ncand; i++) {
+		long p = pos2[get_hash(xdf1, cand[i])], lo = 0, hi = len;
+
+		while (lo < hi) {
+			long mid = lo + (hi - lo) / 2;
+			if (pos2[get_hash(xdf1, cand[tails[mid]])] < p)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		prev[i] = lo ? tails[lo - 1] : -1;
+		tails[lo] = i;
+		if (lo == len)
+			len++;
+	}
+
+	if (!XDL_ALLOC_ARRAY(*anchors, 2 * len + 2))
+		goto out;
+	for (k = len - 1, i = len ? tails[len - 1] : -1; i >= 0; i = prev[i], k--) {
+		(*anchors)[2 * k] = cand[i];
+		(*anchors)[2 * k + 1] = pos2[get_hash(xdf1, cand[i])];
+	}
+	res = len;
+
+ out:
+	xdl_free(cnt1);
+	xdl_free(cnt2);
+	xdl_free(pos2);
+	xdl_free(cand);
+	xdl_free(tails);
+	xdl_free(prev);
+	return res;
+}
+
+
+/*
+ * Diff very large files by first matching up the lines that are unique
+ * in both files, and then running the Myers algorithm independently in
+ * each window between two such anchors. The cost of each search, and
+ * the heuristic that cuts it short, then only depend on the size of the
+ * window rather than on the size of the whole file.
+ */
+static int xdl_do_split_diff(xpparam_t const *xpp, xdfenv_t *xe,
+			     long *kvdf, long *kvdb) {
+	xdfile_t *xdf1 = &xe->xdf1, *xdf2 = &xe->xdf2;
+	long *anchors, nanchors, i;
+	long off1 = 0, off2 = 0, lim1, lim2;
+	xdalgoenv_t xenv;
+	int need_min = (xpp->flags & XDF_NEED_MINIMAL) != 0;
+
+	if ((nanchors = xdl_find_unique_anchors(xe, &anchors)) < 0)
+		return -1;
+
+	for (i = 0; i <= nanchors; i++) {
+		if (i < nanchors) {
+			lim1 = anchors[2 * i];
+			lim2 = anchors[2 * i + 1];
+		} else {
+			lim1 = (long)xdf1->nreff;
+			lim2 = (long)xdf2->nreff;
+		}
+
+		xdl_setup_algoenv(xpp, (lim1 - off1) + (lim2 - off2) + 3, &xenv);
+		if (xdl_recs_cmp(xdf1, off1, lim1, xdf2, off2, lim2,
+				 kvdf, kvdb, need_min, &xenv) < 0) {
+			xdl_free(anchors);
+			return -1;
+		}
+
+		/* the anchor lines themselves are unchanged */
+		off1 = lim1 + 1;
+		off2 = lim2 + 1;
+	}
+
+	xdl_free(anchors);
+	return 0;
+}
+
+
 int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 		xdfenv_t *xe) {
 	long ndiags;
@@ -348,15 +492,16 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	kvdf += xe->xdf2.nreff + 1;
 	kvdb += xe->xdf2.nreff + 1;
 
-	xenv.mxcost = (long)xdl_bogosqrt((uint64_t)ndiags);
-	if (xenv.mxcost < XDL_MAX_COST_MIN)
-		xenv.mxcost = XDL_MAX_COST_MIN;
-	xenv.snake_cnt = XDL_SNAKE_CNT;
-	xenv.heur_min = XDL_HEUR_MIN_COST;
-
-	res = xdl_recs_cmp(&xe->xdf1, 0, xe->xdf1.nreff, &xe->xdf2, 0, xe->xdf2.nreff,
-			   kvdf, kvdb, (xpp->flags & XDF_NEED_MINIMAL) != 0,
-			   &xenv);
+	if (xpp->split_lines > 0 &&
+	    xe->xdf1.nrec > (size_t)xpp->split_lines &&
+	    xe->xdf2.nrec > (size_t)xpp->split_lines) {
+		res = xdl_do_split_diff(xpp, xe, kvdf, kvdb);
+	} else {
+		xdl_setup_algoenv(xpp, ndiags, &xenv);
+		res = xdl_recs_cmp(&xe->xdf1, 0, xe->xdf1.nreff, &xe->xdf2, 0, xe->xdf2.nreff,
+				   kvdf, kvdb, (xpp->flags & XDF_NEED_MINIMAL) != 0,
+				   &xenv);
+	}
 	xdl_free(kvd);
  out:
 	if (res < 0)
@@ -304,6 +304,14 @@ uint64_t xdl_hash_record_with_whitespace(uint8_t const **data,
 #define REASSOC_FENCE(x, y)
 #endif
 
+/*
+ * A word has a zero byte iff (w - ONES) & ~w & HIGHBITS is non-zero;
+ * XOR-ing with NEWLINES first turns newlines into zero bytes.
+ */
+#define XDL_WORD_ONES		0x0101010101010101ULL
+#define XDL_WORD_HIGHBITS	0x8080808080808080ULL
+#define XDL_WORD_NEWLINES	0x0a0a0a0a0a0a0a0aULL
+
 uint64_t xdl_hash_record_verbatim(uint8_t const **data, uint8_t const *top) {
 	uint64_t ha = 5381, c0, c1;
 	uint8_t const *ptr = *data;
@@ -318,6 +326,40 @@ uint64_t xdl_hash_record_verbatim(uint8_t const **data, uint8_t const *top) {
 	}
 	*data = ptr < top ? ptr + 1: ptr;
 #else
+	/*
+	 * Process eight characters per iteration for as long as the next
+	 * eight do not contain a newline, which is tested for all of them
+	 * at once in a single word. The two-characters loop below then
+	 * finds the end of the line in what remains.
+	 */
+	while (top - ptr >= 8) {
+		uint64_t w;
+
+		memcpy(&w, ptr, sizeof(w));
+		w ^= XDL_WORD_NEWLINES;
+		if ((w - XDL_WORD_ONES) & ~w & XDL_WORD_HIGHBITS)
+			break;
+
+		/*
+		 * HA = HA * 33^8 + (C0 * 33^7 + ... + C7). Only the first
+		 * term depends on the previous value of HA, the others can
+		 * be computed in parallel.
+		 */
+		c0 = (uint64_t)ptr[0] * 42618442977ULL +
+		     (uint64_t)ptr[1] * 1291467969ULL +
+		     (uint64_t)ptr[2] * 39135393ULL +
+		     (uint64_t)ptr[3] * 1185921ULL;
+		c1 = (uint64_t)ptr[4] * 35937ULL +
+		     (uint64_t)ptr[5] * 1089ULL +
+		     (uint64_t)ptr[6] * 33ULL +
+		     (uint64_t)ptr[7];
+		c1 += c0;
+		REASSOC_FENCE(c1, ha);
+		ha = ha * 1406408618241ULL + c1;
+
+		ptr += 8;
+	}
+
 	/* Process two characters per iteration. */
 	if (top - ptr >= 2) do {
 		if ((c0 = ptr[0]) == '\n') {